@@ -0,0 +1,161 @@
+/*
+ * This file is part of telepathy-idle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "idle-alias-cache.h"
+
+#include <string.h>
+
+typedef struct {
+	/* our link in the LRU list; unlinked while the entry is pinned */
+	GList link;
+	TpHandle handle;
+	gsize size;
+	gchar alias[];
+} AliasEntry;
+
+struct _IdleAliasCache {
+	/* TpHandle -> owned AliasEntry */
+	GHashTable *entries;
+	/* most recently used at the head */
+	GQueue lru;
+	TpHandle pinned;
+
+	guint max_entries;
+	gsize max_bytes;
+	gsize bytes;
+
+	IdleAliasCacheEvictedFunc evicted;
+	gpointer user_data;
+};
+
+/* what an entry costs us besides its own allocation: a hash table node */
+#define ENTRY_OVERHEAD (3 * sizeof(gpointer) + sizeof(guint))
+
+IdleAliasCache *idle_alias_cache_new(guint max_entries, gsize max_bytes, IdleAliasCacheEvictedFunc evicted, gpointer user_data) {
+	IdleAliasCache *cache = g_slice_new0(IdleAliasCache);
+
+	cache->entries = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+	g_queue_init(&cache->lru);
+	cache->max_entries = max_entries;
+	cache->max_bytes = max_bytes;
+	cache->evicted = evicted;
+	cache->user_data = user_data;
+
+	return cache;
+}
+
+void idle_alias_cache_free(IdleAliasCache *cache) {
+	if (cache == NULL)
+		return;
+
+	g_hash_table_unref(cache->entries);
+	g_slice_free(IdleAliasCache, cache);
+}
+
+static void _remove_entry(IdleAliasCache *cache, AliasEntry *entry) {
+	if (entry->handle != cache->pinned)
+		g_queue_unlink(&cache->lru, &entry->link);
+
+	cache->bytes -= entry->size;
+	g_hash_table_remove(cache->entries, GUINT_TO_POINTER(entry->handle));
+}
+
+static void _evict(IdleAliasCache *cache) {
+	while (g_queue_get_length(&cache->lru) > 0 &&
+			(g_hash_table_size(cache->entries) > cache->max_entries || cache->bytes > cache->max_bytes)) {
+		AliasEntry *entry = cache->lru.tail->data;
+		TpHandle handle = entry->handle;
+
+		_remove_entry(cache, entry);
+
+		if (cache->evicted != NULL)
+			cache->evicted(handle, cache->user_data);
+	}
+}
+
+const gchar *idle_alias_cache_lookup(IdleAliasCache *cache, TpHandle handle) {
+	AliasEntry *entry = g_hash_table_lookup(cache->entries, GUINT_TO_POINTER(handle));
+
+	if (entry == NULL)
+		return NULL;
+
+	if (handle != cache->pinned && cache->lru.head != &entry->link) {
+		g_queue_unlink(&cache->lru, &entry->link);
+		g_queue_push_head_link(&cache->lru, &entry->link);
+	}
+
+	return entry->alias;
+}
+
+void idle_alias_cache_insert(IdleAliasCache *cache, TpHandle handle, const gchar *alias) {
+	AliasEntry *entry = g_hash_table_lookup(cache->entries, GUINT_TO_POINTER(handle));
+	gsize len = strlen(alias);
+
+	if (entry != NULL)
+		_remove_entry(cache, entry);
+
+	entry = g_malloc(sizeof(AliasEntry) + len + 1);
+	entry->link.data = entry;
+	entry->link.prev = entry->link.next = NULL;
+	entry->handle = handle;
+	entry->size = sizeof(AliasEntry) + len + 1 + ENTRY_OVERHEAD;
+	memcpy(entry->alias, alias, len + 1);
+
+	g_hash_table_insert(cache->entries, GUINT_TO_POINTER(handle), entry);
+	cache->bytes += entry->size;
+
+	if (handle != cache->pinned)
+		g_queue_push_head_link(&cache->lru, &entry->link);
+
+	_evict(cache);
+}
+
+void idle_alias_cache_remove(IdleAliasCache *cache, TpHandle handle) {
+	AliasEntry *entry = g_hash_table_lookup(cache->entries, GUINT_TO_POINTER(handle));
+
+	if (entry != NULL)
+		_remove_entry(cache, entry);
+}
+
+void idle_alias_cache_set_pinned(IdleAliasCache *cache, TpHandle handle) {
+	AliasEntry *entry;
+
+	if (handle == cache->pinned)
+		return;
+
+	/* the previously pinned entry goes back to being an ordinary one */
+	entry = g_hash_table_lookup(cache->entries, GUINT_TO_POINTER(cache->pinned));
+	if (entry != NULL)
+		g_queue_push_head_link(&cache->lru, &entry->link);
+
+	entry = g_hash_table_lookup(cache->entries, GUINT_TO_POINTER(handle));
+	if (entry != NULL)
+		g_queue_unlink(&cache->lru, &entry->link);
+
+	cache->pinned = handle;
+
+	_evict(cache);
+}
+
+guint idle_alias_cache_get_size(const IdleAliasCache *cache) {
+	return g_hash_table_size(cache->entries);
+}
+
+gsize idle_alias_cache_get_bytes(const IdleAliasCache *cache) {
+	return cache->bytes;
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is part of telepathy-idle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __IDLE_ALIAS_CACHE_H__
+#define __IDLE_ALIAS_CACHE_H__
+
+#include <glib.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+/* Contact handle -> canonical-case nick, for those contacts whose nick
+ * differs from their (normalized) handle name. Bounded both in number of
+ * entries and in (approximate) bytes; the least recently used entry is
+ * evicted first, except for the pinned handle, which is never evicted.
+ * @evicted is told about each entry evicted, as the contact's alias has just
+ * gone back to being their handle's name. */
+typedef struct _IdleAliasCache IdleAliasCache;
+
+typedef void (*IdleAliasCacheEvictedFunc)(TpHandle handle, gpointer user_data);
+
+IdleAliasCache *idle_alias_cache_new(guint max_entries, gsize max_bytes, IdleAliasCacheEvictedFunc evicted, gpointer user_data);
+void idle_alias_cache_free(IdleAliasCache *cache);
+
+const gchar *idle_alias_cache_lookup(IdleAliasCache *cache, TpHandle handle);
+void idle_alias_cache_insert(IdleAliasCache *cache, TpHandle handle, const gchar *alias);
+void idle_alias_cache_remove(IdleAliasCache *cache, TpHandle handle);
+void idle_alias_cache_set_pinned(IdleAliasCache *cache, TpHandle handle);
+
+guint idle_alias_cache_get_size(const IdleAliasCache *cache);
+gsize idle_alias_cache_get_bytes(const IdleAliasCache *cache);
+
+G_END_DECLS
+
+#endif /* #ifndef __IDLE_ALIAS_CACHE_H__ */
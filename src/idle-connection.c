@@ -23,6 +23,7 @@
 
 #include "idle-connection.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
@@ -30,21 +31,28 @@
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
 #define IDLE_DEBUG_FLAG IDLE_DEBUG_CONNECTION
+#include "idle-alias-cache.h"
 #include "idle-contact-info.h"
 #include "idle-ctcp.h"
 #include "idle-debug.h"
 #include "idle-handles.h"
 #include "idle-im-manager.h"
 #include "idle-muc-manager.h"
+#include "idle-presence.h"
 #include "idle-roomlist-manager.h"
 #include "idle-parser.h"
 #include "idle-server-connection.h"
+#include "idle-text.h"
 #include "server-tls-manager.h"
 
 #include "extensions/extensions.h"    /* IRCCommand */
 
 #define DEFAULT_KEEPALIVE_INTERVAL 30 /* sec */
 #define MISSED_KEEPALIVES_BEFORE_DISCONNECTING 3
+#define DEFAULT_WHOIS_PIPELINE_DEPTH 4
+#define DEFAULT_CONTACT_INFO_TTL 300 /* sec */
+#define DEFAULT_ROOM_LIST_TTL 300 /* sec */
+#define DEFAULT_MEMBERS_FLUSH_INTERVAL 100 /* ms */
 
 /* From RFC 2813 :
  * This in essence means that the client may send one (1) message every
@@ -54,10 +62,35 @@
 #define MSG_QUEUE_TIMEOUT 2
 static gboolean flush_queue_faster = FALSE;
 
+/* how long to gather alias changes before emitting AliasesChanged */
+#define ALIASES_CHANGED_DELAY 100 /* ms */
+
+/* bounds on how many canonical-case nicks we remember */
+#define ALIAS_CACHE_MAX_ENTRIES 4096
+#define ALIAS_CACHE_MAX_BYTES (256 * 1024)
+
+/* AUTHENTICATE payloads are sent base64-encoded in chunks of this size */
+#define SASL_CHUNK_LEN 400
+
 #define SERVER_CMD_MIN_PRIORITY 0
 #define SERVER_CMD_NORMAL_PRIORITY G_MAXUINT/2
 #define SERVER_CMD_MAX_PRIORITY G_MAXUINT
 
+/* IRCv3 capabilities we ask for if the server offers them */
+static const gchar * const wanted_caps[] = {
+	"multi-prefix",
+	"userhost-in-names",
+	"away-notify",
+	"account-notify",
+	"extended-join",
+	"chghost",
+	"echo-message",
+	"server-time",
+	"batch",
+	"draft/multiline",
+	NULL
+};
+
 static void _free_alias_pair(gpointer data, gpointer user_data)
 {
 	g_boxed_free(TP_STRUCT_TYPE_ALIAS_PAIR, data);
@@ -72,38 +105,47 @@ G_DEFINE_TYPE_WITH_CODE(IdleConnection, idle_connection, TP_TYPE_BASE_CONNECTION
 		G_IMPLEMENT_INTERFACE(TP_TYPE_SVC_CONNECTION_INTERFACE_CONTACT_INFO, idle_contact_info_iface_init);
 		G_IMPLEMENT_INTERFACE(TP_TYPE_SVC_CONNECTION_INTERFACE_RENAMING, _renaming_iface_init);
 		G_IMPLEMENT_INTERFACE(TP_TYPE_SVC_CONNECTION_INTERFACE_CONTACTS, tp_contacts_mixin_iface_init);
+		G_IMPLEMENT_INTERFACE(TP_TYPE_SVC_CONNECTION_INTERFACE_SIMPLE_PRESENCE, tp_presence_mixin_simple_presence_iface_init);
 		G_IMPLEMENT_INTERFACE(IDLE_TYPE_SVC_CONNECTION_INTERFACE_IRC_COMMAND1, irc_command_iface_init);
 );
 
 typedef struct _IdleOutputPendingMsg IdleOutputPendingMsg;
 
 struct _IdleOutputPendingMsg {
-	gchar *message;
+	/* one or more lines, <CR><LF>-terminated and in the connection's charset,
+	 * ready to be written out as they are */
+	GBytes *data;
 	guint priority;
 	guint64 id;
+	/* monotonic time at which it was queued */
+	gint64 queued_at;
+	IdleConnectionSentFunc callback;
+	gpointer user_data;
 };
 
-/* Steals @message. */
+/* Steals @data. */
 static IdleOutputPendingMsg *
 idle_output_pending_msg_new (
-    gchar *message,
+    GBytes *data,
     guint priority)
 {
-	IdleOutputPendingMsg *msg = g_slice_new(IdleOutputPendingMsg);
+	IdleOutputPendingMsg *msg = g_slice_new0(IdleOutputPendingMsg);
 	static guint64 last_id = 0;
 
-	msg->message = message;
+	msg->data = data;
 	msg->priority = priority;
 	msg->id = last_id++;
+	msg->queued_at = g_get_monotonic_time();
 
 	return msg;
 }
 
-static void idle_output_pending_msg_free(IdleOutputPendingMsg *msg) {
-	if (!msg)
-		return;
+/* Tells whoever queued @msg whether it was written out, and frees it. */
+static void idle_output_pending_msg_complete(IdleConnection *conn, IdleOutputPendingMsg *msg, gboolean sent) {
+	if (msg->callback != NULL)
+		msg->callback(conn, msg->queued_at, sent, msg->user_data);
 
-	g_free(msg->message);
+	g_bytes_unref(msg->data);
 	g_slice_free(IdleOutputPendingMsg, msg);
 }
 
@@ -131,6 +173,13 @@ enum {
 	PROP_QUITMESSAGE,
 	PROP_USE_SSL,
 	PROP_PASSWORD_PROMPT,
+	PROP_WHOIS_PIPELINE_DEPTH,
+	PROP_CONTACT_INFO_TTL,
+	PROP_WHO_ON_JOIN,
+	PROP_ROOM_LIST_TTL,
+	PROP_MEMBERS_FLUSH_INTERVAL,
+	PROP_SASL_MECHANISM,
+	PROP_CLIENT_CERTIFICATE,
 	LAST_PROPERTY_ENUM
 };
 
@@ -161,10 +210,19 @@ struct _IdleConnectionPrivate {
 	char *realname;
 	char *username;
 	char *charset;
+	/* no need to convert what we send, which is UTF-8 already */
+	gboolean charset_is_utf8;
 	guint keepalive_interval;
 	char *quit_message;
 	gboolean use_ssl;
 	gboolean password_prompt;
+	guint whois_pipeline_depth;
+	guint contact_info_ttl;
+	gboolean who_on_join;
+	guint room_list_ttl;
+	guint members_flush_interval;
+	char *sasl_mechanism;
+	char *client_certificate;
 
 	/* the string used by the a server as a prefix to any messages we send that
 	 * it relays to other users.  We need to know this so we can keep our sent
@@ -172,11 +230,16 @@ struct _IdleConnectionPrivate {
 	 * this prefix added */
 	char *relay_prefix;
 
+	/* what idle_connection_get_max_message_length() last worked out, or 0 if
+	 * LINELEN or relay_prefix have changed since */
+	gsize max_message_length;
+
 	/* output message queue */
 	GQueue *msg_queue;
 
 	/* has it submitted a message for sending and waiting for acknowledgement */
 	gboolean msg_sending;
+	IdleOutputPendingMsg *msg_in_flight;
 
 	/* UNIX time the last message was sent on */
 	time_t last_msg_sent;
@@ -194,6 +257,7 @@ struct _IdleConnectionPrivate {
 	/* AliasChanged aggregation */
 	GPtrArray *queued_aliases;
 	TpHandleSet *queued_aliases_owners;
+	guint queued_aliases_timeout;
 
 	/* if idle_connection_dispose has already run once */
 	gboolean dispose_has_run;
@@ -204,8 +268,26 @@ struct _IdleConnectionPrivate {
 	/* TLS channel */
 	IdleServerTLSManager *tls_manager;
 
-	/* TpHandle -> owned gchar * */
-	GHashTable *aliases;
+	/* TpHandle -> canonical-case nick, where it differs from the handle's
+	 * name; least recently used entries are forgotten first */
+	IdleAliasCache *aliases;
+
+	/* IRCv3 capability negotiation: TRUE until we've sent CAP END */
+	gboolean cap_negotiating;
+	/* capability name -> value (or "") as advertised by CAP LS/NEW */
+	GHashTable *caps_available;
+	/* set of enabled capability names */
+	GHashTable *caps_enabled;
+	/* TRUE while an AUTHENTICATE exchange is holding CAP END back */
+	gboolean sasl_in_progress;
+	/* TRUE once the server has said we're logged in */
+	gboolean sasl_logged_in;
+
+	/* server features and limits from RPL_ISUPPORT */
+	IdleISupport *isupport;
+
+	/* the last LIST reply, shared by successive room list channels */
+	IdleRoomDirectory *rooms;
 };
 
 static void _iface_create_handle_repos(TpBaseConnection *self, TpHandleRepoIface **repos);
@@ -215,12 +297,18 @@ static void _iface_disconnected(TpBaseConnection *self);
 static void _iface_shut_down(TpBaseConnection *self);
 static gboolean _iface_start_connecting(TpBaseConnection *self, GError **error);
 
+static IdleParserHandlerResult _authenticate_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
+static IdleParserHandlerResult _cap_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
+static IdleParserHandlerResult _chghost_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _error_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _erroneous_nickname_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
+static IdleParserHandlerResult _isupport_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _nick_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _nickname_in_use_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _ping_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _pong_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
+static IdleParserHandlerResult _sasl_fail_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
+static IdleParserHandlerResult _sasl_success_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _unknown_command_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _version_privmsg_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _welcome_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
@@ -240,10 +328,12 @@ static void idle_connection_add_queue_timeout (IdleConnection *self);
 static void idle_connection_clear_queue_timeout (IdleConnection *self);
 
 static void _send_with_priority(IdleConnection *conn, const gchar *msg, guint priority);
+static void _send_with_callback(IdleConnection *conn, const gchar *msg, guint priority, IdleConnectionSentFunc callback, gpointer user_data);
 static void conn_aliasing_fill_contact_attributes (
     GObject *obj,
     const GArray *contacts,
     GHashTable *attributes_hash);
+static void _alias_evicted(TpHandle handle, gpointer user_data);
 
 static void idle_connection_init(IdleConnection *obj) {
 	IdleConnectionPrivate *priv = G_TYPE_INSTANCE_GET_PRIVATE (obj, IDLE_TYPE_CONNECTION, IdleConnectionPrivate);
@@ -251,7 +341,11 @@ static void idle_connection_init(IdleConnection *obj) {
 	obj->priv = priv;
 	priv->sconn_connected = FALSE;
 	priv->msg_queue = g_queue_new();
-	priv->aliases = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+	priv->aliases = idle_alias_cache_new(ALIAS_CACHE_MAX_ENTRIES, ALIAS_CACHE_MAX_BYTES, _alias_evicted, obj);
+	priv->caps_available = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	priv->caps_enabled = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	priv->isupport = idle_isupport_new();
+	priv->rooms = idle_room_directory_new();
 
 	tp_contacts_mixin_init ((GObject *) obj, G_STRUCT_OFFSET (IdleConnection, contacts));
 	tp_base_connection_register_with_contacts_mixin ((TpBaseConnection *) obj);
@@ -264,6 +358,8 @@ idle_connection_constructed (GObject *object)
 
   self->parser = g_object_new (IDLE_TYPE_PARSER, "connection", self, NULL);
   idle_contact_info_init (self);
+  idle_presence_init (self);
+  idle_text_init (self);
   tp_contacts_mixin_add_contact_attributes_iface (object,
       TP_IFACE_CONNECTION_INTERFACE_ALIASING,
       conn_aliasing_fill_contact_attributes);
@@ -306,6 +402,8 @@ static void idle_connection_set_property(GObject *obj, guint prop_id, const GVal
 		case PROP_CHARSET:
 			g_free(priv->charset);
 			priv->charset = g_value_dup_string(value);
+			priv->charset_is_utf8 = priv->charset != NULL &&
+				(!g_ascii_strcasecmp(priv->charset, "UTF-8") || !g_ascii_strcasecmp(priv->charset, "UTF8"));
 			break;
 
 		case PROP_KEEPALIVE_INTERVAL:
@@ -325,6 +423,36 @@ static void idle_connection_set_property(GObject *obj, guint prop_id, const GVal
 			priv->password_prompt = g_value_get_boolean(value);
 			break;
 
+		case PROP_WHOIS_PIPELINE_DEPTH:
+			priv->whois_pipeline_depth = g_value_get_uint(value);
+			break;
+
+		case PROP_CONTACT_INFO_TTL:
+			priv->contact_info_ttl = g_value_get_uint(value);
+			break;
+
+		case PROP_WHO_ON_JOIN:
+			priv->who_on_join = g_value_get_boolean(value);
+			break;
+
+		case PROP_ROOM_LIST_TTL:
+			priv->room_list_ttl = g_value_get_uint(value);
+			break;
+
+		case PROP_MEMBERS_FLUSH_INTERVAL:
+			priv->members_flush_interval = g_value_get_uint(value);
+			break;
+
+		case PROP_SASL_MECHANISM:
+			g_free(priv->sasl_mechanism);
+			priv->sasl_mechanism = g_value_dup_string(value);
+			break;
+
+		case PROP_CLIENT_CERTIFICATE:
+			g_free(priv->client_certificate);
+			priv->client_certificate = g_value_dup_string(value);
+			break;
+
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 			break;
@@ -380,6 +508,34 @@ static void idle_connection_get_property(GObject *obj, guint prop_id, GValue *va
 			g_value_set_boolean(value, priv->password_prompt);
 			break;
 
+		case PROP_WHOIS_PIPELINE_DEPTH:
+			g_value_set_uint(value, priv->whois_pipeline_depth);
+			break;
+
+		case PROP_CONTACT_INFO_TTL:
+			g_value_set_uint(value, priv->contact_info_ttl);
+			break;
+
+		case PROP_WHO_ON_JOIN:
+			g_value_set_boolean(value, priv->who_on_join);
+			break;
+
+		case PROP_ROOM_LIST_TTL:
+			g_value_set_uint(value, priv->room_list_ttl);
+			break;
+
+		case PROP_MEMBERS_FLUSH_INTERVAL:
+			g_value_set_uint(value, priv->members_flush_interval);
+			break;
+
+		case PROP_SASL_MECHANISM:
+			g_value_set_string(value, priv->sasl_mechanism);
+			break;
+
+		case PROP_CLIENT_CERTIFICATE:
+			g_value_set_string(value, priv->client_certificate);
+			break;
+
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 			break;
@@ -410,15 +566,24 @@ static void idle_connection_dispose (GObject *object) {
 
 	g_clear_object (&priv->connect_cancellable);
 
+	if (priv->queued_aliases_timeout) {
+		g_source_remove(priv->queued_aliases_timeout);
+		priv->queued_aliases_timeout = 0;
+	}
+
 	if (priv->queued_aliases_owners)
 		tp_handle_set_destroy(priv->queued_aliases_owners);
 
 	if (priv->queued_aliases)
 		g_ptr_array_free(priv->queued_aliases, TRUE);
 
+	idle_presence_dispose(self);
+
 	g_object_unref(self->parser);
 
-	tp_clear_pointer (&priv->aliases, g_hash_table_unref);
+	tp_clear_pointer (&priv->aliases, idle_alias_cache_free);
+	tp_clear_pointer (&priv->caps_available, g_hash_table_unref);
+	tp_clear_pointer (&priv->caps_enabled, g_hash_table_unref);
 
 	if (G_OBJECT_CLASS(idle_connection_parent_class)->dispose)
 		G_OBJECT_CLASS(idle_connection_parent_class)->dispose (object);
@@ -430,6 +595,7 @@ static void idle_connection_finalize (GObject *object) {
 	IdleOutputPendingMsg *msg;
 
 	idle_contact_info_finalize(object);
+	idle_presence_finalize(object);
 
 	g_free(priv->nickname);
 	g_free(priv->server);
@@ -439,13 +605,24 @@ static void idle_connection_finalize (GObject *object) {
 	g_free(priv->charset);
 	g_free(priv->relay_prefix);
 	g_free(priv->quit_message);
+	g_free(priv->sasl_mechanism);
+	g_free(priv->client_certificate);
+
+	if (priv->msg_in_flight != NULL)
+		idle_output_pending_msg_complete(self, priv->msg_in_flight, FALSE);
 
 	while ((msg = g_queue_pop_head(priv->msg_queue)) != NULL)
-		idle_output_pending_msg_free(msg);
+		idle_output_pending_msg_complete(self, msg, FALSE);
 
 	g_queue_free(priv->msg_queue);
+	idle_text_finalize(object);
 	tp_contacts_mixin_finalize (object);
 
+	/* the handle repos use this as their normalization context, and are only
+	 * released by TpBaseConnection's dispose */
+	idle_isupport_free(priv->isupport);
+	idle_room_directory_free(priv->rooms);
+
 	G_OBJECT_CLASS(idle_connection_parent_class)->finalize(object);
 }
 
@@ -455,6 +632,7 @@ static const gchar * interfaces_always_present[] = {
 	TP_IFACE_CONNECTION_INTERFACE_RENAMING,
 	TP_IFACE_CONNECTION_INTERFACE_REQUESTS,
 	TP_IFACE_CONNECTION_INTERFACE_CONTACTS,
+	TP_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE,
 	NULL};
 
 const gchar * const *idle_connection_get_implemented_interfaces (void) {
@@ -533,8 +711,30 @@ static void idle_connection_class_init(IdleConnectionClass *klass) {
 	param_spec = g_param_spec_boolean("password-prompt", "Password prompt", "Whether the connection should pop up a SASL channel if no password is given", FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT);
 	g_object_class_install_property(object_class, PROP_PASSWORD_PROMPT, param_spec);
 
+	param_spec = g_param_spec_uint("whois-pipeline-depth", "WHOIS pipeline depth", "How many WHOIS requests for contact info may be awaiting a reply at once", 1, G_MAXUINT, DEFAULT_WHOIS_PIPELINE_DEPTH, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT);
+	g_object_class_install_property(object_class, PROP_WHOIS_PIPELINE_DEPTH, param_spec);
+
+	param_spec = g_param_spec_uint("contact-info-ttl", "Contact info lifetime", "Seconds for which a contact's WHOIS reply is reused, or 0 to always ask the server", 0, G_MAXUINT, DEFAULT_CONTACT_INFO_TTL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT);
+	g_object_class_install_property(object_class, PROP_CONTACT_INFO_TTL, param_spec);
+
+	param_spec = g_param_spec_boolean("who-on-join", "WHO on join", "Whether to fetch information about all of a channel's members with a single WHO when joining it", FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT);
+	g_object_class_install_property(object_class, PROP_WHO_ON_JOIN, param_spec);
+
+	param_spec = g_param_spec_uint("room-list-ttl", "Room list lifetime", "Seconds for which the server's channel list is reused by ListRooms, or 0 to always ask the server", 0, G_MAXUINT, DEFAULT_ROOM_LIST_TTL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT);
+	g_object_class_install_property(object_class, PROP_ROOM_LIST_TTL, param_spec);
+
+	param_spec = g_param_spec_uint("members-flush-interval", "Members flush interval", "Milliseconds for which other contacts' joins and parts are merged before a channel's members change, or 0 to change them at once", 0, G_MAXUINT, DEFAULT_MEMBERS_FLUSH_INTERVAL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT);
+	g_object_class_install_property(object_class, PROP_MEMBERS_FLUSH_INTERVAL, param_spec);
+
+	param_spec = g_param_spec_string("sasl-mechanism", "SASL mechanism", "PLAIN to log in with the username and password, or EXTERNAL to log in with the client certificate, during registration; empty to not use SASL", NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+	g_object_class_install_property(object_class, PROP_SASL_MECHANISM, param_spec);
+
+	param_spec = g_param_spec_string("client-certificate", "Client certificate", "Path to a PEM file holding the certificate and private key to present to the server over SSL", NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+	g_object_class_install_property(object_class, PROP_CLIENT_CERTIFICATE, param_spec);
+
 	tp_contacts_mixin_class_init (object_class, G_STRUCT_OFFSET (IdleConnectionClass, contacts));
 	idle_contact_info_class_init(klass);
+	idle_presence_class_init(klass);
 
 	/* This is a hack to make the test suite run in finite time. */
 	if (!tp_str_empty (g_getenv ("IDLE_HTFU")))
@@ -571,7 +771,7 @@ static void _iface_create_handle_repos(TpBaseConnection *self, TpHandleRepoIface
 	for (int i = 0; i < TP_NUM_HANDLE_TYPES; i++)
 		repos[i] = NULL;
 
-	idle_handle_repos_init(repos);
+	idle_handle_repos_init(repos, IDLE_CONNECTION(self)->priv->isupport);
 }
 
 static gchar *_iface_get_unique_connection_name(TpBaseConnection *base) {
@@ -742,7 +942,17 @@ static void _connection_connect_ready(GObject *source_object, GAsyncResult *res,
 	g_signal_connect(sconn, "received", (GCallback)(sconn_received_cb), conn);
 
 	idle_parser_add_handler(conn->parser, IDLE_PARSER_CMD_ERROR, _error_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_CAP, _cap_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_CMD_AUTHENTICATE, _authenticate_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_AUTHENTICATE, _authenticate_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_SASLSUCCESS, _sasl_success_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_SASLALREADY, _sasl_success_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_SASLFAIL, _sasl_fail_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_SASLTOOLONG, _sasl_fail_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_SASLABORTED, _sasl_fail_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_CHGHOST, _chghost_handler, conn);
 	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_ERRONEOUSNICKNAME, _erroneous_nickname_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_ISUPPORT, _isupport_handler, conn);
 	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_NICKNAMEINUSE, _nickname_in_use_handler, conn);
 	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_WELCOME, _welcome_handler, conn);
 	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_WHOISUSER, _whois_user_handler, conn);
@@ -760,6 +970,19 @@ static void _connection_connect_ready(GObject *source_object, GAsyncResult *res,
 static void _start_connecting_continue(IdleConnection *conn) {
 	IdleConnectionPrivate *priv = conn->priv;
 	IdleServerConnection *sconn;
+	GTlsCertificate *certificate = NULL;
+
+	if (priv->use_ssl && !tp_str_empty(priv->client_certificate)) {
+		GError *error = NULL;
+
+		certificate = g_tls_certificate_new_from_file(priv->client_certificate, &error);
+		if (certificate == NULL) {
+			IDLE_DEBUG("couldn't load client certificate %s: %s", priv->client_certificate, error->message);
+			_connection_disconnect_with_error(conn, TP_CONNECTION_STATUS_REASON_AUTHENTICATION_FAILED, "debug-message", TP_ERROR, TP_ERROR_AUTHENTICATION_FAILED, error->message);
+			g_error_free(error);
+			return;
+		}
+	}
 
 	if (tp_str_empty(priv->realname)) {
 		const gchar *g_realname = g_get_real_name();
@@ -785,6 +1008,11 @@ static void _start_connecting_continue(IdleConnection *conn) {
 	if (priv->use_ssl)
 		idle_server_connection_set_tls(sconn, TRUE);
 
+	if (certificate != NULL) {
+		idle_server_connection_set_client_certificate(sconn, certificate);
+		g_object_unref(certificate);
+	}
+
 	g_signal_connect(sconn, "disconnected", (GCallback)(sconn_disconnected_cb), conn);
 
 	priv->conn = sconn;
@@ -881,15 +1109,20 @@ static void _msg_queue_timeout_ready(GObject *source_object, GAsyncResult *res,
 	IdleConnectionPrivate *priv = conn->priv;
 	GError *error = NULL;
 
+	IdleOutputPendingMsg *output_msg = priv->msg_in_flight;
+
 	priv->msg_sending = FALSE;
+	priv->msg_in_flight = NULL;
 
 	if (!idle_server_connection_send_finish(sconn, res, &error)) {
 		IDLE_DEBUG("idle_server_connection_send failed: %s", error->message);
 		g_error_free(error);
+		idle_output_pending_msg_complete(conn, output_msg, FALSE);
 		return;
 	}
 
 	priv->last_msg_sent = time(NULL);
+	idle_output_pending_msg_complete(conn, output_msg, TRUE);
 }
 
 static gboolean msg_queue_timeout_cb(gpointer user_data) {
@@ -918,8 +1151,8 @@ static gboolean msg_queue_timeout_cb(gpointer user_data) {
 	}
 
 	priv->msg_sending = TRUE;
-	idle_server_connection_send_async(priv->conn, output_msg->message, NULL, _msg_queue_timeout_ready, conn);
-	idle_output_pending_msg_free (output_msg);
+	priv->msg_in_flight = output_msg;
+	idle_server_connection_send_async(priv->conn, output_msg->data, NULL, _msg_queue_timeout_ready, conn);
 
 	return TRUE;
 }
@@ -961,54 +1194,135 @@ idle_connection_clear_queue_timeout (IdleConnection *self)
 }
 
 /**
- * Queue a IRC command for sending, clipping it to IRC_MSG_MAXLEN bytes and appending the required <CR><LF> to it
+ * Queue a IRC command for sending, clipping it to the server's LINELEN (less <CR><LF>) and appending the required <CR><LF> to it
  */
 static void _send_with_priority(IdleConnection *conn, const gchar *msg, guint priority) {
+	_send_with_callback(conn, msg, priority, NULL, NULL);
+}
+
+/* Appends @msg to @out as a line for the server, clipped to LINELEN (less
+ * <CR><LF>) and in the connection's charset. IRCv3 message tags don't count
+ * towards LINELEN, so are left out of the clipping (and of the charset
+ * conversion: they're ASCII anyway). */
+static void _append_line(IdleConnection *conn, GString *out, const gchar *msg) {
 	IdleConnectionPrivate *priv = conn->priv;
-	gchar cmd[IRC_MSG_MAXLEN + 3];
-	int len;
-	gchar *converted;
-	GError *convert_error = NULL;
+	gsize max_len = idle_isupport_get_linelen(priv->isupport) - 2;
+	const gchar *tags_end;
+	gsize start;
+	gsize len = 0;
 
 	g_assert(msg != NULL);
 
+	if (msg[0] == '@' && (tags_end = strchr(msg, ' ')) != NULL) {
+		g_string_append_len(out, msg, tags_end + 1 - msg);
+		msg = tags_end + 1;
+	}
+
 	/* Clip the message */
-	g_strlcpy(cmd, msg, IRC_MSG_MAXLEN + 1);
+	while (len < max_len && msg[len] != '\0')
+		len++;
+
+	start = out->len;
 
-	/* Strip out any <CR>/<LF> which have crept in */
-	g_strdelimit (cmd, "\r\n", ' ');
+	if (priv->charset_is_utf8) {
+		/* straight into @out: there's nothing to convert */
+		g_string_append_len(out, msg, len);
 
-	/* Append <CR><LF> */
-	len = strlen(cmd);
-	cmd[len++] = '\r';
-	cmd[len++] = '\n';
+		/* Strip out any <CR>/<LF> which have crept in */
+		g_strdelimit(out->str + start, "\r\n", ' ');
+	} else {
+		gchar *clipped = g_strndup(msg, len);
+		gchar *converted;
+		GError *convert_error = NULL;
 
-	cmd[len] = '\0';
+		g_strdelimit(clipped, "\r\n", ' ');
 
-	if (!idle_connection_hton(conn, cmd, &converted, &convert_error)) {
-		IDLE_DEBUG("hton: %s", convert_error->message);
-		g_error_free(convert_error);
-		converted = g_strdup(cmd);
+		if (!idle_connection_hton(conn, clipped, &converted, &convert_error)) {
+			IDLE_DEBUG("hton: %s", convert_error->message);
+			g_error_free(convert_error);
+			converted = clipped;
+			clipped = NULL;
+		}
+
+		g_string_append(out, converted);
+		g_free(converted);
+		g_free(clipped);
 	}
 
-	g_queue_insert_sorted(priv->msg_queue,
-		idle_output_pending_msg_new(converted, priority),
-		pending_msg_compare, NULL);
+	g_string_append_len(out, "\r\n", 2);
+}
+
+/* Steals @lines, which end up being written out from where they are now. */
+static void _queue_lines(IdleConnection *conn, GString *lines, guint priority, IdleConnectionSentFunc callback, gpointer user_data) {
+	IdleConnectionPrivate *priv = conn->priv;
+	gsize len = lines->len;
+	IdleOutputPendingMsg *output_msg = idle_output_pending_msg_new(g_bytes_new_take(g_string_free(lines, FALSE), len), priority);
+
+	output_msg->callback = callback;
+	output_msg->user_data = user_data;
+
+	g_queue_insert_sorted(priv->msg_queue, output_msg, pending_msg_compare, NULL);
 	idle_connection_add_queue_timeout (conn);
 }
 
+static void _send_with_callback(IdleConnection *conn, const gchar *msg, guint priority, IdleConnectionSentFunc callback, gpointer user_data) {
+	GString *line = g_string_sized_new(IRC_MSG_MAXLEN + 2);
+
+	_append_line(conn, line, msg);
+	_queue_lines(conn, line, priority, callback, user_data);
+}
+
 void idle_connection_send(IdleConnection *conn, const gchar *msg) {
 	_send_with_priority(conn, msg, SERVER_CMD_NORMAL_PRIORITY);
 }
 
+/* @callback is called once @msg has been written to the socket, or with
+ * sent = FALSE if it never will be */
+void idle_connection_send_with_callback(IdleConnection *conn, const gchar *msg, IdleConnectionSentFunc callback, gpointer user_data) {
+	_send_with_callback(conn, msg, SERVER_CMD_NORMAL_PRIORITY, callback, user_data);
+}
+
+/* Like idle_connection_send_with_callback(), but for an IRCv3 BATCH: @msgs
+ * are written out together, taking up one place in the flood queue between
+ * them, and @callback is only called once. */
+void idle_connection_send_batch_with_callback(IdleConnection *conn, const gchar * const *msgs, IdleConnectionSentFunc callback, gpointer user_data) {
+	GString *lines = g_string_new(NULL);
+
+	for (const gchar * const *msg = msgs; *msg != NULL; msg++)
+		_append_line(conn, lines, *msg);
+
+	_queue_lines(conn, lines, SERVER_CMD_NORMAL_PRIORITY, callback, user_data);
+}
+
+/* Whether something queued with @user_data is being written out right now: the
+ * server may already have it, although its callback hasn't been called yet. */
+gboolean idle_connection_is_writing(IdleConnection *conn, gpointer user_data) {
+	IdleOutputPendingMsg *msg = conn->priv->msg_in_flight;
+
+	return (msg != NULL) && (msg->callback != NULL) && (msg->user_data == user_data);
+}
+
+/* for housekeeping traffic which shouldn't hold up anything the user did */
+void idle_connection_send_background(IdleConnection *conn, const gchar *msg) {
+	_send_with_priority(conn, msg, SERVER_CMD_MIN_PRIORITY);
+}
+
 gsize
 idle_connection_get_max_message_length(IdleConnection *conn)
 {
 	IdleConnectionPrivate *priv = conn->priv;
+	gsize max_len;
+
+	if (priv->max_message_length != 0)
+		return priv->max_message_length;
+
+	max_len = idle_isupport_get_linelen(priv->isupport) - 2;
+
 	if (priv->relay_prefix != NULL) {
 		/* server will add ':<relay_prefix> ' to all messages it relays on to
 		 * other users.  the +2 is for the initial : and the trailing space */
-		return IRC_MSG_MAXLEN - (strlen(priv->relay_prefix) + 2);
+		priv->max_message_length = max_len - (strlen(priv->relay_prefix) + 2);
+		return priv->max_message_length;
 	}
 	/* Before we've gotten our user info, we don't know how long our relay
 	 * prefix will be, so just assume worst-case.  The max possible prefix is:
@@ -1018,7 +1332,397 @@ idle_connection_get_max_message_length(IdleConnection *conn)
 	 * length, but the testing I've done seems to indicate that 8-10 is a
 	 * common limit.  I'll add some extra buffer to be safe.
 	 * */
-	return IRC_MSG_MAXLEN - 100;
+	priv->max_message_length = max_len - 100;
+	return priv->max_message_length;
+}
+
+static gboolean _sasl_mechanism_is(IdleConnection *conn, const gchar *mechanism) {
+	return (conn->priv->sasl_mechanism != NULL) && !g_ascii_strcasecmp(conn->priv->sasl_mechanism, mechanism);
+}
+
+/* Whether the password is for SASL PLAIN, which rather than the server's is the
+ * account's: so if we can't log in with it, we mustn't register without. */
+static gboolean _sasl_required(IdleConnection *conn) {
+	return _sasl_mechanism_is(conn, "PLAIN") && !tp_str_empty(conn->priv->password);
+}
+
+static void _cap_end(IdleConnection *conn) {
+	IdleConnectionPrivate *priv = conn->priv;
+
+	if (!priv->cap_negotiating || priv->sasl_in_progress)
+		return;
+
+	if (_sasl_required(conn) && !priv->sasl_logged_in) {
+		IDLE_DEBUG("the server can't do SASL %s, and the password isn't one to send as PASS", priv->sasl_mechanism);
+		priv->cap_negotiating = FALSE;
+		connection_connect_cb(conn, FALSE, TP_CONNECTION_STATUS_REASON_AUTHENTICATION_FAILED);
+		return;
+	}
+
+	priv->cap_negotiating = FALSE;
+	_send_with_priority(conn, "CAP END", SERVER_CMD_NORMAL_PRIORITY + 2);
+}
+
+/* Whether we've been asked to use SASL and the server offers our mechanism.
+ * CAP LS 302 lists the mechanisms as the value of "sasl"; older servers
+ * don't, and we just try. */
+static gboolean _sasl_wanted(IdleConnection *conn) {
+	IdleConnectionPrivate *priv = conn->priv;
+	const gchar *mechanisms;
+	gchar **list;
+	gboolean found = FALSE;
+
+	if (tp_str_empty(priv->sasl_mechanism))
+		return FALSE;
+
+	mechanisms = g_hash_table_lookup(priv->caps_available, "sasl");
+	if (mechanisms == NULL)
+		return FALSE;
+
+	if (*mechanisms == '\0')
+		return TRUE;
+
+	list = g_strsplit(mechanisms, ",", -1);
+	for (guint i = 0; list[i] != NULL && !found; i++)
+		found = _sasl_mechanism_is(conn, list[i]);
+	g_strfreev(list);
+
+	if (!found)
+		IDLE_DEBUG("server doesn't offer SASL %s, only %s", priv->sasl_mechanism, mechanisms);
+
+	return found;
+}
+
+static void _sasl_start(IdleConnection *conn) {
+	IdleConnectionPrivate *priv = conn->priv;
+	gchar cmd[IRC_MSG_MAXLEN + 1];
+
+	if (priv->sasl_in_progress)
+		return;
+
+	priv->sasl_in_progress = TRUE;
+
+	g_snprintf(cmd, IRC_MSG_MAXLEN + 1, "AUTHENTICATE %s", priv->sasl_mechanism);
+	_send_with_priority(conn, cmd, SERVER_CMD_NORMAL_PRIORITY + 2);
+}
+
+static void _sasl_finish(IdleConnection *conn) {
+	conn->priv->sasl_in_progress = FALSE;
+	_cap_end(conn);
+}
+
+/* Sends the initial response in chunks, with a lone "+" marking the end if
+ * the last chunk was a full one. */
+static void _sasl_respond(IdleConnection *conn, const guchar *response, gsize len) {
+	gchar *encoded = g_base64_encode(response, len);
+	gsize encoded_len = strlen(encoded);
+	gchar cmd[IRC_MSG_MAXLEN + 1];
+	gsize offset = 0;
+
+	do {
+		gsize chunk = MIN(encoded_len - offset, SASL_CHUNK_LEN);
+
+		g_snprintf(cmd, IRC_MSG_MAXLEN + 1, "AUTHENTICATE %.*s", (int) chunk, encoded + offset);
+		_send_with_priority(conn, cmd, SERVER_CMD_NORMAL_PRIORITY + 2);
+		offset += chunk;
+
+		if (chunk == SASL_CHUNK_LEN && offset == encoded_len)
+			_send_with_priority(conn, "AUTHENTICATE +", SERVER_CMD_NORMAL_PRIORITY + 2);
+	} while (offset < encoded_len);
+
+	g_free(encoded);
+}
+
+/* Asks for those of our wanted capabilities which are available but not yet
+ * enabled. Returns FALSE if there was nothing to ask for. */
+static gboolean _cap_request_wanted(IdleConnection *conn) {
+	IdleConnectionPrivate *priv = conn->priv;
+	GString *req = g_string_new("CAP REQ :");
+	gsize empty_len = req->len;
+	gboolean requested = FALSE;
+
+	for (const gchar * const *cap = wanted_caps; *cap != NULL; cap++) {
+		if (!g_hash_table_lookup(priv->caps_available, *cap) || g_hash_table_lookup(priv->caps_enabled, *cap))
+			continue;
+
+		if (req->len > empty_len)
+			g_string_append_c(req, ' ');
+
+		g_string_append(req, *cap);
+	}
+
+	if (_sasl_wanted(conn) && !g_hash_table_lookup(priv->caps_enabled, "sasl")) {
+		if (req->len > empty_len)
+			g_string_append_c(req, ' ');
+
+		g_string_append(req, "sasl");
+	}
+
+	if (req->len > empty_len) {
+		_send_with_priority(conn, req->str, SERVER_CMD_NORMAL_PRIORITY + 2);
+		requested = TRUE;
+	}
+
+	g_string_free(req, TRUE);
+
+	return requested;
+}
+
+static IdleParserHandlerResult _cap_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	IdleConnectionPrivate *priv = conn->priv;
+	const gchar *subcommand = g_value_get_string(g_value_array_get_nth(args, 0));
+	gboolean more = FALSE;
+
+	for (guint i = 1; i < args->n_values; i++) {
+		const gchar *token = g_value_get_string(g_value_array_get_nth(args, i));
+		const gchar *eq;
+
+		/* CAP LS 302 marks all but the last line of a multi-line reply with a
+		 * lone '*' before the list */
+		if (i == 1 && (args->n_values > 2) && !strcmp(token, "*")) {
+			more = TRUE;
+			continue;
+		}
+
+		if (token[0] == '\0')
+			continue;
+
+		if (!g_ascii_strcasecmp(subcommand, "LS") || !g_ascii_strcasecmp(subcommand, "NEW")) {
+			eq = strchr(token, '=');
+
+			if (eq)
+				g_hash_table_insert(priv->caps_available, g_strndup(token, eq - token), g_strdup(eq + 1));
+			else
+				g_hash_table_insert(priv->caps_available, g_strdup(token), g_strdup(""));
+		} else if (!g_ascii_strcasecmp(subcommand, "ACK")) {
+			if (token[0] == '-') {
+				g_hash_table_remove(priv->caps_enabled, token + 1);
+			} else {
+				IDLE_DEBUG("enabled capability %s", token);
+				g_hash_table_insert(priv->caps_enabled, g_strdup(token), GUINT_TO_POINTER(TRUE));
+			}
+		} else if (!g_ascii_strcasecmp(subcommand, "DEL")) {
+			g_hash_table_remove(priv->caps_available, token);
+			g_hash_table_remove(priv->caps_enabled, token);
+		}
+	}
+
+	if (more)
+		return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+
+	if (!g_ascii_strcasecmp(subcommand, "LS")) {
+		if (!_cap_request_wanted(conn))
+			_cap_end(conn);
+	} else if (!g_ascii_strcasecmp(subcommand, "NEW")) {
+		_cap_request_wanted(conn);
+	} else if (!g_ascii_strcasecmp(subcommand, "ACK") && priv->cap_negotiating && _sasl_wanted(conn) && g_hash_table_lookup(priv->caps_enabled, "sasl")) {
+		/* log in before registration completes, so that everything after 001
+		 * (and in particular joining channels which need it) already happens
+		 * as the account */
+		_sasl_start(conn);
+	} else if (!g_ascii_strcasecmp(subcommand, "ACK") || !g_ascii_strcasecmp(subcommand, "NAK")) {
+		_cap_end(conn);
+	}
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+static IdleParserHandlerResult _authenticate_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	IdleConnectionPrivate *priv = conn->priv;
+	const gchar *challenge = g_value_get_string(g_value_array_get_nth(args, 0));
+
+	if (!priv->sasl_in_progress)
+		return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+
+	/* neither mechanism expects a challenge beyond the empty one */
+	if (strcmp(challenge, "+")) {
+		IDLE_DEBUG("unexpected SASL challenge %s", challenge);
+		_send_with_priority(conn, "AUTHENTICATE *", SERVER_CMD_NORMAL_PRIORITY + 2);
+		return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+	}
+
+	if (_sasl_mechanism_is(conn, "PLAIN")) {
+		/* authzid NUL authcid NUL password; the account needn't be named
+		 * after our nick, so leave the authzid to the server and log in as
+		 * the username */
+		GString *response = g_string_new(NULL);
+
+		g_string_append_c(response, '\0');
+		g_string_append(response, priv->username);
+		g_string_append_c(response, '\0');
+		g_string_append(response, (priv->password != NULL) ? priv->password : "");
+
+		_sasl_respond(conn, (const guchar *) response->str, response->len);
+
+		memset(response->str, 0, response->len);
+		g_string_free(response, TRUE);
+	} else {
+		/* EXTERNAL: the server already has our certificate */
+		_send_with_priority(conn, "AUTHENTICATE +", SERVER_CMD_NORMAL_PRIORITY + 2);
+	}
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+static IdleParserHandlerResult _sasl_success_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+
+	IDLE_DEBUG("logged in with SASL %s", conn->priv->sasl_mechanism);
+	conn->priv->sasl_logged_in = TRUE;
+	_sasl_finish(conn);
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+static IdleParserHandlerResult _sasl_fail_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+
+	if (!conn->priv->sasl_in_progress)
+		return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+
+	/* we were asked to log in, so carrying on as a guest would be wrong */
+	IDLE_DEBUG("SASL %s failed", conn->priv->sasl_mechanism);
+	conn->priv->sasl_in_progress = FALSE;
+
+	if (tp_base_connection_get_status(TP_BASE_CONNECTION(conn)) == TP_CONNECTION_STATUS_CONNECTING)
+		connection_connect_cb(conn, FALSE, TP_CONNECTION_STATUS_REASON_AUTHENTICATION_FAILED);
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+gboolean idle_connection_has_cap(IdleConnection *conn, const gchar *cap) {
+	return (g_hash_table_lookup(conn->priv->caps_enabled, cap) != NULL);
+}
+
+/* Whether we can send draft/multiline batches, and if so how many bytes of
+ * text and lines (0 for no limit) the server takes in each. */
+gboolean idle_connection_get_multiline_limits(IdleConnection *conn, guint *max_bytes, guint *max_lines) {
+	const gchar *value;
+	gchar **tokens;
+
+	if (!idle_connection_has_cap(conn, "batch") || !idle_connection_has_cap(conn, "draft/multiline"))
+		return FALSE;
+
+	value = g_hash_table_lookup(conn->priv->caps_available, "draft/multiline");
+	tokens = g_strsplit((value != NULL) ? value : "", ",", 0);
+	*max_bytes = 0;
+	*max_lines = 0;
+
+	for (gchar **token = tokens; *token != NULL; token++) {
+		if (g_str_has_prefix(*token, "max-bytes="))
+			*max_bytes = strtoul(*token + strlen("max-bytes="), NULL, 10);
+		else if (g_str_has_prefix(*token, "max-lines="))
+			*max_lines = strtoul(*token + strlen("max-lines="), NULL, 10);
+	}
+
+	g_strfreev(tokens);
+
+	/* max-bytes is mandatory */
+	return *max_bytes > 0;
+}
+
+/* Our handle was made before the server told us its CASEMAPPING, so may not be
+ * the one our nick resolves to any more.
+ *
+ * Only our own handle is moved. Other handles made before RPL_ISUPPORT (and
+ * any channels with them) keep the identifiers the rfc1459 mapping gave them,
+ * so a nick differing only in "[]\~" may now resolve to a second handle, and
+ * a second channel. Telepathy handles can't be renamed, and the window is
+ * short: the server sends RPL_ISUPPORT straight after RPL_WELCOME, before a
+ * client has had much chance to ask for anything. */
+static void _casemapping_changed(IdleConnection *conn) {
+	TpBaseConnection *base = TP_BASE_CONNECTION(conn);
+	TpHandleRepoIface *handles = tp_base_connection_get_handles(base, TP_HANDLE_TYPE_CONTACT);
+	TpHandle old_handle = tp_base_connection_get_self_handle(base);
+	TpHandle new_handle;
+	const gchar *nick;
+
+	if (old_handle == 0)
+		return;
+
+	nick = idle_alias_cache_lookup(conn->priv->aliases, old_handle);
+	if (nick == NULL)
+		nick = tp_handle_inspect(handles, old_handle);
+
+	new_handle = tp_handle_ensure(handles, nick, NULL, NULL);
+	if (new_handle == 0 || new_handle == old_handle)
+		return;
+
+	IDLE_DEBUG("CASEMAPPING moved us from handle %u to %u", old_handle, new_handle);
+
+	idle_connection_canon_nick_receive(conn, new_handle, nick);
+	tp_base_connection_set_self_handle(base, new_handle);
+	idle_alias_cache_set_pinned(conn->priv->aliases, new_handle);
+	idle_alias_cache_remove(conn->priv->aliases, old_handle);
+}
+
+static IdleParserHandlerResult _isupport_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	IdleCaseMapping old_mapping = idle_isupport_get_casemapping(conn->priv->isupport);
+
+	/* the trailing "are supported by this server" is rejected as not being
+	 * well-formed parameters, so needs no special treatment */
+	for (guint i = 0; i < args->n_values; i++)
+		idle_isupport_parse_token(conn->priv->isupport, g_value_get_string(g_value_array_get_nth(args, i)));
+
+	/* LINELEN may have changed */
+	conn->priv->max_message_length = 0;
+
+	/* CASEMAPPING, CHANTYPES and CHANNELLEN all affect which handle (if any)
+	 * a token resolves to */
+	idle_parser_invalidate_handle_cache(parser);
+
+	if (idle_isupport_get_casemapping(conn->priv->isupport) != old_mapping) {
+		idle_room_directory_set_casemapping(conn->priv->rooms, idle_isupport_get_casemapping(conn->priv->isupport));
+		_casemapping_changed(conn);
+	}
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+IdleISupport *idle_connection_get_isupport(IdleConnection *conn) {
+	return conn->priv->isupport;
+}
+
+guint idle_connection_get_whois_pipeline_depth(IdleConnection *conn) {
+	return conn->priv->whois_pipeline_depth;
+}
+
+guint idle_connection_get_contact_info_ttl(IdleConnection *conn) {
+	return conn->priv->contact_info_ttl;
+}
+
+gboolean idle_connection_get_who_on_join(IdleConnection *conn) {
+	return conn->priv->who_on_join;
+}
+
+guint idle_connection_get_room_list_ttl(IdleConnection *conn) {
+	return conn->priv->room_list_ttl;
+}
+
+guint idle_connection_get_members_flush_interval(IdleConnection *conn) {
+	return conn->priv->members_flush_interval;
+}
+
+IdleRoomDirectory *idle_connection_get_room_directory(IdleConnection *conn) {
+	return conn->priv->rooms;
+}
+
+static IdleParserHandlerResult _chghost_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	TpHandle handle = g_value_get_uint(g_value_array_get_nth(args, 0));
+	const gchar *user = g_value_get_string(g_value_array_get_nth(args, 1));
+	const gchar *host = g_value_get_string(g_value_array_get_nth(args, 2));
+	gchar *userhost = g_strdup_printf("%s@%s", user, host);
+
+	/* keeps our idea of how long our own prefix is in step with a cloak or
+	 * vhost being applied, without another WHOIS */
+	idle_connection_userhost_receive(conn, handle, userhost);
+	g_free(userhost);
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 }
 
 static IdleParserHandlerResult _error_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
@@ -1085,11 +1789,13 @@ static IdleParserHandlerResult _nick_handler(IdleParser *parser, IdleParserMessa
 	if (old_handle == tp_base_connection_get_self_handle (TP_BASE_CONNECTION (conn))) {
 		IDLE_DEBUG("Self renamed: handle was %d, now %d", old_handle, new_handle);
 		tp_base_connection_set_self_handle(TP_BASE_CONNECTION(conn), new_handle);
+		idle_alias_cache_set_pinned(conn->priv->aliases, new_handle);
 	}
 
-	tp_svc_connection_interface_renaming_emit_renamed(conn, old_handle, new_handle);
+	/* whoever takes the old nick next is likely to spell it differently */
+	idle_alias_cache_remove(conn->priv->aliases, old_handle);
 
-	idle_connection_emit_queued_aliases_changed(conn);
+	tp_svc_connection_interface_renaming_emit_renamed(conn, old_handle, new_handle);
 
 	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 }
@@ -1167,7 +1873,20 @@ static IdleParserHandlerResult _welcome_handler(IdleParser *parser, IdleParserMe
 	IdleConnection *conn = IDLE_CONNECTION(user_data);
 	TpHandle handle = g_value_get_uint(g_value_array_get_nth(args, 0));
 
+	/* registration is over, whether or not the server ever answered CAP LS */
+	conn->priv->cap_negotiating = FALSE;
+	conn->priv->sasl_in_progress = FALSE;
+
+	/* a server which doesn't know about CAP registers us without waiting for
+	 * SASL; our password went nowhere, so we aren't who we were asked to be */
+	if (_sasl_required(conn) && !conn->priv->sasl_logged_in) {
+		IDLE_DEBUG("registered without logging in with SASL %s", conn->priv->sasl_mechanism);
+		connection_connect_cb(conn, FALSE, TP_CONNECTION_STATUS_REASON_AUTHENTICATION_FAILED);
+		return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+	}
+
 	tp_base_connection_set_self_handle(TP_BASE_CONNECTION(conn), handle);
+	idle_alias_cache_set_pinned(conn->priv->aliases, handle);
 
 	connection_connect_cb(conn, TRUE, 0);
 
@@ -1195,6 +1914,7 @@ _whois_user_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray
 			host = g_value_get_string(g_value_array_get_nth(args, 2));
 			priv->relay_prefix = g_strdup_printf("%s!%s@%s", priv->nickname, user, host);
 			IDLE_DEBUG("user host prefix = %s", priv->relay_prefix);
+			priv->max_message_length = 0;
 	}
 	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 }
@@ -1208,7 +1928,19 @@ static void irc_handshakes(IdleConnection *conn) {
 
 	priv = conn->priv;
 
-	if ((priv->password != NULL) && (priv->password[0] != '\0')) {
+	/* Servers which know about CAP hold registration back until CAP END;
+	 * others just ignore it or reply with ERR_UNKNOWNCOMMAND. */
+	g_hash_table_remove_all(priv->caps_available);
+	g_hash_table_remove_all(priv->caps_enabled);
+	priv->cap_negotiating = TRUE;
+	priv->sasl_in_progress = FALSE;
+	priv->sasl_logged_in = FALSE;
+	_send_with_priority(conn, "CAP LS 302", SERVER_CMD_NORMAL_PRIORITY + 2);
+
+	/* with SASL PLAIN the password is the account's rather than the server's,
+	 * and goes in AUTHENTICATE instead; if CAP LS says the server can't do
+	 * that, _cap_end() gives up rather than registering without it */
+	if ((priv->password != NULL) && (priv->password[0] != '\0') && !_sasl_required(conn)) {
 		g_snprintf(msg, IRC_MSG_MAXLEN + 1, "PASS %s", priv->password);
 		_send_with_priority(conn, msg, SERVER_CMD_NORMAL_PRIORITY + 1);
 	}
@@ -1264,6 +1996,17 @@ static void connection_disconnect_cb(IdleConnection *conn, TpConnectionStatusRea
 	idle_connection_clear_queue_timeout (conn);
 }
 
+static void _emit_queued_aliases_changed(IdleConnection *conn);
+
+static gboolean _queued_aliases_timeout_cb(gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+
+	conn->priv->queued_aliases_timeout = 0;
+	_emit_queued_aliases_changed(conn);
+
+	return FALSE;
+}
+
 static void
 _queue_alias_changed(IdleConnection *conn, TpHandle handle, const gchar *alias) {
 	IdleConnectionPrivate *priv = conn->priv;
@@ -1283,24 +2026,65 @@ _queue_alias_changed(IdleConnection *conn, TpHandle handle, const gchar *alias)
 			G_TYPE_UINT, handle,
 			G_TYPE_STRING, alias,
 			G_TYPE_INVALID));
+
+	/* coalesce everything seen in the next little while (a NAMES burst, a
+	 * netjoin...) into a single signal */
+	if (!priv->queued_aliases_timeout)
+		priv->queued_aliases_timeout = g_timeout_add(ALIASES_CHANGED_DELAY, _queued_aliases_timeout_cb, conn);
 }
 
+/* The contact may well still be around, so they'll see their alias go back to
+ * their handle's name until we next hear from them; and so that we do, the
+ * parser mustn't answer for them from its cache. */
+static void _alias_evicted(TpHandle handle, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	TpHandleRepoIface *handles = tp_base_connection_get_handles(TP_BASE_CONNECTION(conn), TP_HANDLE_TYPE_CONTACT);
+
+	_queue_alias_changed(conn, handle, tp_handle_inspect(handles, handle));
+	idle_parser_forget_contact(conn->parser, handle);
+}
+
+/* Called by the parser for every nick it hasn't got cached, so the common
+ * case of nothing having changed must stay cheap. */
 void idle_connection_canon_nick_receive(IdleConnection *conn, TpHandle handle, const gchar *canon_nick) {
 	TpHandleRepoIface *handles = tp_base_connection_get_handles(TP_BASE_CONNECTION(conn), TP_HANDLE_TYPE_CONTACT);
-	const gchar *old_alias = g_hash_table_lookup (conn->priv->aliases, GUINT_TO_POINTER (handle));
+	const gchar *name = tp_handle_inspect(handles, handle);
+	const gchar *old_alias = idle_alias_cache_lookup(conn->priv->aliases, handle);
 
 	if (!old_alias)
-		old_alias = tp_handle_inspect(handles, handle);
+		old_alias = name;
 
 	if (!strcmp(old_alias, canon_nick))
 		return;
 
-	g_hash_table_insert (conn->priv->aliases, GUINT_TO_POINTER (handle), g_strdup (canon_nick));
+	/* only nicks which differ from the handle's name need remembering */
+	if (!strcmp(name, canon_nick))
+		idle_alias_cache_remove(conn->priv->aliases, handle);
+	else
+		idle_alias_cache_insert(conn->priv->aliases, handle, canon_nick);
 
 	_queue_alias_changed(conn, handle, canon_nick);
 }
 
-void idle_connection_emit_queued_aliases_changed(IdleConnection *conn) {
+void idle_connection_userhost_receive(IdleConnection *conn, TpHandle handle, const gchar *userhost) {
+	IdleConnectionPrivate *priv = conn->priv;
+	const gchar *old_userhost;
+
+	if (handle != tp_base_connection_get_self_handle(TP_BASE_CONNECTION(conn)))
+		return;
+
+	old_userhost = (priv->relay_prefix != NULL) ? strchr(priv->relay_prefix, '!') : NULL;
+
+	if (old_userhost != NULL && !strcmp(old_userhost + 1, userhost))
+		return;
+
+	g_free(priv->relay_prefix);
+	priv->relay_prefix = g_strdup_printf("%s!%s", priv->nickname, userhost);
+	IDLE_DEBUG("user host prefix = %s", priv->relay_prefix);
+	priv->max_message_length = 0;
+}
+
+static void _emit_queued_aliases_changed(IdleConnection *conn) {
 	IdleConnectionPrivate *priv = conn->priv;
 
 	if (!priv->queued_aliases)
@@ -1325,8 +2109,7 @@ gimme_an_alias (IdleConnection *self,
     TpHandleRepoIface *repo,
     TpHandle handle)
 {
-  const gchar *alias = g_hash_table_lookup (self->priv->aliases,
-      GUINT_TO_POINTER (handle));
+  const gchar *alias = idle_alias_cache_lookup (self->priv->aliases, handle);
 
   if (alias != NULL)
     return alias;
@@ -1418,9 +2201,10 @@ static void idle_connection_request_aliases(TpSvcConnectionInterfaceAliasing *if
 static gboolean _send_rename_request(IdleConnection *obj, const gchar *nick, DBusGMethodInvocation *context) {
 	TpHandleRepoIface *handles = tp_base_connection_get_handles(TP_BASE_CONNECTION(obj), TP_HANDLE_TYPE_CONTACT);
 	TpHandle handle = tp_handle_ensure(handles, nick, NULL, NULL);
+	guint nicklen = idle_isupport_get_nicklen(obj->priv->isupport);
 	gchar msg[IRC_MSG_MAXLEN + 1];
 
-	if (handle == 0) {
+	if (handle == 0 || (nicklen != 0 && strlen(nick) > nicklen)) {
 		GError error = {TP_ERROR, TP_ERROR_NOT_AVAILABLE, "Invalid nickname requested"};
 
 		IDLE_DEBUG("failed to get handle for \"%s\"", nick);
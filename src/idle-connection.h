@@ -24,7 +24,9 @@
 #include <glib-object.h>
 #include <telepathy-glib/telepathy-glib.h>
 
+#include "idle-isupport.h"
 #include "idle-parser.h"
+#include "idle-room-directory.h"
 
 #define IRC_MSG_MAXLEN 510
 
@@ -33,22 +35,33 @@ G_BEGIN_DECLS
 typedef struct _IdleConnection IdleConnection;
 typedef struct _IdleConnectionClass IdleConnectionClass;
 typedef struct _IdleConnectionPrivate IdleConnectionPrivate;
+/* defined in idle-presence.c */
+typedef struct _IdlePresenceState IdlePresenceState;
 
 struct _IdleConnectionClass {
 	TpBaseConnectionClass parent_class;
 	TpContactsMixinClass contacts;
+	TpPresenceMixinClass presence;
 };
 
 struct _IdleConnection {
 	TpBaseConnection parent;
 	TpContactsMixin contacts;
+	TpPresenceMixin presence;
 	IdleParser *parser;
 	GQueue *contact_info_requests;
+	GHashTable *contact_info_cache;
+	IdlePresenceState *presence_state;
+	/* messages queued by idle_text_send() and not yet reported as sent */
+	GQueue *pending_sends;
 	IdleConnectionPrivate *priv;
 };
 
 GType idle_connection_get_type(void);
 
+/* @queued_at is the monotonic time at which the message was queued */
+typedef void (*IdleConnectionSentFunc)(IdleConnection *conn, gint64 queued_at, gboolean sent, gpointer user_data);
+
 /* TYPE MACROS */
 #define IDLE_TYPE_CONNECTION \
 	(idle_connection_get_type())
@@ -64,8 +77,21 @@ GType idle_connection_get_type(void);
 	(G_TYPE_INSTANCE_GET_CLASS((obj), IDLE_TYPE_CONNECTION, IdleConnectionClass))
 
 void idle_connection_canon_nick_receive(IdleConnection *conn, TpHandle handle, const gchar *canon_nick);
-void idle_connection_emit_queued_aliases_changed(IdleConnection *conn);
+void idle_connection_userhost_receive(IdleConnection *conn, TpHandle handle, const gchar *userhost);
+gboolean idle_connection_has_cap(IdleConnection *conn, const gchar *cap);
+gboolean idle_connection_get_multiline_limits(IdleConnection *conn, guint *max_bytes, guint *max_lines);
+IdleISupport *idle_connection_get_isupport(IdleConnection *conn);
+guint idle_connection_get_whois_pipeline_depth(IdleConnection *conn);
+guint idle_connection_get_contact_info_ttl(IdleConnection *conn);
+gboolean idle_connection_get_who_on_join(IdleConnection *conn);
+guint idle_connection_get_room_list_ttl(IdleConnection *conn);
+guint idle_connection_get_members_flush_interval(IdleConnection *conn);
+IdleRoomDirectory *idle_connection_get_room_directory(IdleConnection *conn);
 void idle_connection_send(IdleConnection *conn, const gchar *msg);
+void idle_connection_send_background(IdleConnection *conn, const gchar *msg);
+void idle_connection_send_with_callback(IdleConnection *conn, const gchar *msg, IdleConnectionSentFunc callback, gpointer user_data);
+void idle_connection_send_batch_with_callback(IdleConnection *conn, const gchar * const *msgs, IdleConnectionSentFunc callback, gpointer user_data);
+gboolean idle_connection_is_writing(IdleConnection *conn, gpointer user_data);
 gsize idle_connection_get_max_message_length(IdleConnection *conn);
 const gchar * const *idle_connection_get_implemented_interfaces (void);
 
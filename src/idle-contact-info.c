@@ -20,11 +20,13 @@
 #include "config.h"
 #include "idle-contact-info.h"
 
+#include <string.h>
+
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
 #define IDLE_DEBUG_FLAG IDLE_DEBUG_CONNECTION
 #include "idle-debug.h"
-#include "idle-muc-channel.h"
+#include "idle-isupport.h"
 #include "idle-parser.h"
 
 typedef struct _ContactInfoRequest ContactInfoRequest;
@@ -32,6 +34,8 @@ typedef struct _ContactInfoRequest ContactInfoRequest;
 struct _ContactInfoRequest {
 	guint handle;
 	const gchar *nick;
+	/* TRUE once our WHOIS has been sent and until its reply is complete */
+	gboolean in_flight;
 	gboolean is_away;
 	gboolean is_operator;
 	gboolean is_reg_nick;
@@ -40,6 +44,19 @@ struct _ContactInfoRequest {
 	DBusGMethodInvocation *context;
 };
 
+typedef struct _CachedContactInfo CachedContactInfo;
+
+struct _CachedContactInfo {
+	GPtrArray *contact_info;
+	/* in g_get_monotonic_time() terms */
+	gint64 expires;
+	/* FALSE if we only know what a WHO reply told us, rather than WHOIS */
+	gboolean complete;
+};
+
+/* identifies replies to our own WHOX queries */
+#define WHOX_TOKEN "152"
+
 /*
  * _insert_contact_field:
  * @contact_info: an array of Contact_Info_Field structures
@@ -57,15 +74,27 @@ static void _insert_contact_field(GPtrArray *contact_info, const gchar *field_na
 		G_TYPE_INVALID));
 }
 
+/* Several WHOIS may be outstanding at once, but never two for the same
+ * contact, so the nick in each reply tells us which request it belongs to. */
+static ContactInfoRequest *_find_in_flight_request(IdleConnection *conn, TpHandle handle) {
+	GList *l;
+
+	for (l = conn->contact_info_requests->head; l != NULL; l = l->next) {
+		ContactInfoRequest *request = l->data;
+
+		if (request->in_flight && request->handle == handle)
+			return request;
+	}
+
+	return NULL;
+}
+
 static ContactInfoRequest * _get_matching_request(IdleConnection *conn, GValueArray *args) {
 	ContactInfoRequest *request;
 	TpHandle handle = g_value_get_uint(g_value_array_get_nth(args, 0));
 
-	if (g_queue_is_empty(conn->contact_info_requests))
-		return NULL;
-
-	request = g_queue_peek_head(conn->contact_info_requests);
-	if (request->handle != handle)
+	request = _find_in_flight_request(conn, handle);
+	if (request == NULL)
 		return NULL;
 
 	if (request->contact_info == NULL)
@@ -74,6 +103,65 @@ static ContactInfoRequest * _get_matching_request(IdleConnection *conn, GValueAr
 	return request;
 }
 
+static void _cached_contact_info_free(gpointer data) {
+	CachedContactInfo *cached = data;
+
+	g_boxed_free(TP_ARRAY_TYPE_CONTACT_INFO_FIELD_LIST, cached->contact_info);
+	g_slice_free(CachedContactInfo, cached);
+}
+
+static gboolean _cached_contact_info_expired(gpointer key, gpointer value, gpointer user_data) {
+	CachedContactInfo *cached = value;
+	gint64 now = *(gint64 *) user_data;
+
+	return cached->expires <= now;
+}
+
+static GPtrArray *_lookup_cached_contact_info(IdleConnection *conn, TpHandle handle, gboolean complete_only) {
+	CachedContactInfo *cached = g_hash_table_lookup(conn->contact_info_cache, GUINT_TO_POINTER(handle));
+
+	if (cached == NULL || (complete_only && !cached->complete))
+		return NULL;
+
+	if (cached->expires <= g_get_monotonic_time()) {
+		g_hash_table_remove(conn->contact_info_cache, GUINT_TO_POINTER(handle));
+		return NULL;
+	}
+
+	return cached->contact_info;
+}
+
+/* takes ownership of contact_info */
+static void _cache_contact_info(IdleConnection *conn, TpHandle handle, GPtrArray *contact_info, gboolean complete) {
+	guint ttl = idle_connection_get_contact_info_ttl(conn);
+	gint64 now = g_get_monotonic_time();
+	CachedContactInfo *cached;
+
+	if (ttl == 0) {
+		g_boxed_free(TP_ARRAY_TYPE_CONTACT_INFO_FIELD_LIST, contact_info);
+		return;
+	}
+
+	cached = g_slice_new(CachedContactInfo);
+	cached->contact_info = contact_info;
+	cached->expires = now + (gint64) ttl * G_USEC_PER_SEC;
+	cached->complete = complete;
+	g_hash_table_insert(conn->contact_info_cache, GUINT_TO_POINTER(handle), cached);
+}
+
+/* Nobody may ever ask about them again, so don't wait for a lookup to drop
+ * stale entries. This is a walk over the whole cache, so it is done once per
+ * WHOIS or WHO rather than once per entry. */
+static void _expire_cached_contact_info(IdleConnection *conn) {
+	gint64 now = g_get_monotonic_time();
+
+	g_hash_table_foreach_remove(conn->contact_info_cache, _cached_contact_info_expired, &now);
+}
+
+void idle_contact_info_invalidate(IdleConnection *conn, TpHandle handle) {
+	g_hash_table_remove(conn->contact_info_cache, GUINT_TO_POINTER(handle));
+}
+
 static void _send_request_contact_info(IdleConnection *conn, ContactInfoRequest *request) {
 	gchar cmd[IRC_MSG_MAXLEN + 1];
 
@@ -81,19 +169,41 @@ static void _send_request_contact_info(IdleConnection *conn, ContactInfoRequest
 	idle_connection_send(conn, cmd);
 }
 
-static void _dequeue_request_contact_info(IdleConnection *conn) {
-	ContactInfoRequest *request = g_queue_pop_head(conn->contact_info_requests);
+static void _send_pending_requests(IdleConnection *conn) {
+	guint depth = idle_connection_get_whois_pipeline_depth(conn);
+	guint in_flight = 0;
+	GList *l;
+
+	for (l = conn->contact_info_requests->head; l != NULL; l = l->next) {
+		ContactInfoRequest *request = l->data;
+
+		if (request->in_flight)
+			in_flight++;
+	}
+
+	for (l = conn->contact_info_requests->head; l != NULL && in_flight < depth; l = l->next) {
+		ContactInfoRequest *request = l->data;
+
+		/* a second request for the same contact waits for the first one's
+		 * reply, otherwise we couldn't tell the two apart */
+		if (request->in_flight || _find_in_flight_request(conn, request->handle) != NULL)
+			continue;
+
+		request->in_flight = TRUE;
+		in_flight++;
+		_send_request_contact_info(conn, request);
+	}
+}
+
+static void _dequeue_request_contact_info(IdleConnection *conn, ContactInfoRequest *request) {
+	g_queue_remove(conn->contact_info_requests, request);
 
 	if (request->contact_info != NULL)
 		g_boxed_free(TP_ARRAY_TYPE_CONTACT_INFO_FIELD_LIST, request->contact_info);
 
 	g_slice_free(ContactInfoRequest, request);
 
-	if (g_queue_is_empty(conn->contact_info_requests))
-		return;
-
-	request = g_queue_peek_head(conn->contact_info_requests);
-	_send_request_contact_info(conn, request);
+	_send_pending_requests(conn);
 }
 
 static void _queue_request_contact_info(IdleConnection *conn, guint handle, const gchar *nick, DBusGMethodInvocation *context) {
@@ -102,6 +212,7 @@ static void _queue_request_contact_info(IdleConnection *conn, guint handle, cons
 	request = g_slice_new0(ContactInfoRequest);
 	request->handle = handle;
 	request->nick = nick;
+	request->in_flight = FALSE;
 	request->is_away = FALSE;
 	request->is_operator = FALSE;
 	request->is_reg_nick = FALSE;
@@ -109,18 +220,19 @@ static void _queue_request_contact_info(IdleConnection *conn, guint handle, cons
 	request->contact_info = NULL;
 	request->context = context;
 
-	if (g_queue_is_empty(conn->contact_info_requests))
-		_send_request_contact_info(conn, request);
-
 	g_queue_push_tail(conn->contact_info_requests, request);
+	_send_pending_requests(conn);
 }
 
-static void _return_from_request_contact_info(IdleConnection *conn) {
-	ContactInfoRequest *request = g_queue_peek_head(conn->contact_info_requests);
-
+static void _return_from_request_contact_info(IdleConnection *conn, ContactInfoRequest *request) {
 	tp_svc_connection_interface_contact_info_return_from_request_contact_info(request->context, request->contact_info);
 	tp_svc_connection_interface_contact_info_emit_contact_info_changed(conn, request->handle, request->contact_info);
-	_dequeue_request_contact_info(conn);
+
+	_expire_cached_contact_info(conn);
+	_cache_contact_info(conn, request->handle, request->contact_info, TRUE);
+	request->contact_info = NULL;
+
+	_dequeue_request_contact_info(conn, request);
 }
 
 static void idle_connection_request_contact_info(TpSvcConnectionInterfaceContactInfo *iface, guint contact, DBusGMethodInvocation *context) {
@@ -128,6 +240,7 @@ static void idle_connection_request_contact_info(TpSvcConnectionInterfaceContact
 	TpBaseConnection *base = TP_BASE_CONNECTION(self);
 	TpHandleRepoIface *contact_handles = tp_base_connection_get_handles(base, TP_HANDLE_TYPE_CONTACT);
 	const gchar *nick;
+	GPtrArray *contact_info;
 	GError *error = NULL;
 
 	TP_BASE_CONNECTION_ERROR_IF_NOT_CONNECTED(base, context);
@@ -138,12 +251,214 @@ static void idle_connection_request_contact_info(TpSvcConnectionInterfaceContact
 		return;
 	}
 
+	/* what WHO told us doesn't include channels, server or idle time */
+	contact_info = _lookup_cached_contact_info(self, contact, TRUE);
+	if (contact_info != NULL) {
+		tp_svc_connection_interface_contact_info_return_from_request_contact_info(context, contact_info);
+		return;
+	}
+
 	nick = tp_handle_inspect(contact_handles, contact);
 
 	IDLE_DEBUG ("Queued contact info request for handle: %u (%s)", contact, nick);
 	_queue_request_contact_info(self, contact, nick, context);
 }
 
+static void idle_connection_get_contact_info(TpSvcConnectionInterfaceContactInfo *iface, const GArray *contacts, DBusGMethodInvocation *context) {
+	IdleConnection *self = IDLE_CONNECTION(iface);
+	TpBaseConnection *base = TP_BASE_CONNECTION(self);
+	TpHandleRepoIface *contact_handles = tp_base_connection_get_handles(base, TP_HANDLE_TYPE_CONTACT);
+	GHashTable *ret;
+	GError *error = NULL;
+	guint i;
+
+	TP_BASE_CONNECTION_ERROR_IF_NOT_CONNECTED(base, context);
+
+	if (!tp_handles_are_valid(contact_handles, contacts, FALSE, &error)) {
+		dbus_g_method_return_error(context, error);
+		g_error_free(error);
+		return;
+	}
+
+	/* only what we already know: this never goes to the server */
+	ret = g_hash_table_new(NULL, NULL);
+
+	for (i = 0; i < contacts->len; i++) {
+		TpHandle contact = g_array_index(contacts, TpHandle, i);
+		GPtrArray *contact_info = _lookup_cached_contact_info(self, contact, FALSE);
+
+		if (contact_info != NULL)
+			g_hash_table_insert(ret, GUINT_TO_POINTER(contact), contact_info);
+	}
+
+	tp_svc_connection_interface_contact_info_return_from_get_contact_info(context, ret);
+	g_hash_table_unref(ret);
+}
+
+static IdleParserHandlerResult _nick_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+
+	/* the new nick's entry, if any, described whoever had it before */
+	idle_contact_info_invalidate(conn, g_value_get_uint(g_value_array_get_nth(args, 0)));
+	idle_contact_info_invalidate(conn, g_value_get_uint(g_value_array_get_nth(args, 1)));
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
+static IdleParserHandlerResult _quit_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+
+	idle_contact_info_invalidate(conn, g_value_get_uint(g_value_array_get_nth(args, 0)));
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
+static IdleParserHandlerResult _join_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	TpBaseConnection *base = TP_BASE_CONNECTION(conn);
+	TpHandleRepoIface *room_handles = tp_base_connection_get_handles(base, TP_HANDLE_TYPE_ROOM);
+	TpHandle joiner_handle = g_value_get_uint(g_value_array_get_nth(args, 0));
+	TpHandle room_handle = g_value_get_uint(g_value_array_get_nth(args, 1));
+	gchar cmd[IRC_MSG_MAXLEN + 1];
+
+	if (joiner_handle != tp_base_connection_get_self_handle(base) || !idle_connection_get_who_on_join(conn))
+		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+
+	/* one streamed reply for the whole channel, rather than a WHOIS for each
+	 * member whose info is asked for */
+	if (idle_isupport_has_whox(idle_connection_get_isupport(conn)))
+		g_snprintf(cmd, IRC_MSG_MAXLEN + 1, "WHO %s %%tcuhnfar," WHOX_TOKEN, tp_handle_inspect(room_handles, room_handle));
+	else
+		g_snprintf(cmd, IRC_MSG_MAXLEN + 1, "WHO %s", tp_handle_inspect(room_handles, room_handle));
+
+	/* nice to have, so it doesn't hold up anything the user is doing */
+	idle_connection_send_background(conn, cmd);
+	_expire_cached_contact_info(conn);
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
+/* account is NULL if unknown or not logged in; user, host and flags are NULL
+ * if all we have is an extended JOIN */
+static void _cache_who_reply(IdleConnection *conn, TpHandle handle, const gchar *user, const gchar *host, const gchar *flags, const gchar *account, const gchar *realname) {
+	GPtrArray *contact_info;
+	gchar *userhost;
+	const gchar *field_values[2] = {NULL, NULL};
+	gboolean is_away = (flags != NULL && strchr(flags, 'G') != NULL);
+
+	/* don't replace the fuller picture a WHOIS gave us */
+	if (_lookup_cached_contact_info(conn, handle, TRUE) != NULL)
+		return;
+
+	contact_info = dbus_g_type_specialized_construct(TP_ARRAY_TYPE_CONTACT_INFO_FIELD_LIST);
+
+	field_values[0] = realname;
+	_insert_contact_field(contact_info, "fn", NULL, field_values);
+
+	if (user != NULL && host != NULL) {
+		userhost = g_strdup_printf("%s@%s", user, host);
+		field_values[0] = userhost;
+		_insert_contact_field(contact_info, "x-host", NULL, field_values);
+		g_free(userhost);
+	}
+
+	if (account != NULL) {
+		field_values[0] = account;
+		_insert_contact_field(contact_info, "nickname", NULL, field_values);
+	}
+
+	field_values[0] = (account != NULL) ? "true" : "false";
+	_insert_contact_field(contact_info, "x-irc-registered-nick", NULL, field_values);
+
+	if (flags != NULL) {
+		field_values[0] = g_strdup_printf("%d", is_away ? TP_CONNECTION_PRESENCE_TYPE_AWAY : TP_CONNECTION_PRESENCE_TYPE_AVAILABLE);
+		_insert_contact_field(contact_info, "x-presence-type", NULL, field_values);
+		g_free((gpointer) field_values[0]);
+
+		field_values[0] = is_away ? "away" : "available";
+		_insert_contact_field(contact_info, "x-presence-status-identifier", NULL, field_values);
+
+		field_values[0] = (strchr(flags, '*') != NULL) ? "true" : "false";
+		_insert_contact_field(contact_info, "x-irc-operator", NULL, field_values);
+	}
+
+	/* Nobody asked for this, so it isn't announced: a WHO for a big channel
+	 * would otherwise be a signal per member. GetContactInfo and the contact
+	 * attributes pick it up. */
+	_cache_contact_info(conn, handle, contact_info, FALSE);
+}
+
+static IdleParserHandlerResult _who_reply_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	const gchar *user = g_value_get_string(g_value_array_get_nth(args, 0));
+	const gchar *host = g_value_get_string(g_value_array_get_nth(args, 1));
+	TpHandle handle = g_value_get_uint(g_value_array_get_nth(args, 2));
+	const gchar *flags = g_value_get_string(g_value_array_get_nth(args, 3));
+	const gchar *realname = g_value_get_string(g_value_array_get_nth(args, 4));
+	const gchar *space;
+
+	/* ":<hopcount> <real name>" */
+	space = strchr(realname, ' ');
+	realname = (space != NULL) ? space + 1 : "";
+
+	_cache_who_reply(conn, handle, user, host, flags, NULL, realname);
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
+static IdleParserHandlerResult _whox_reply_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	const gchar *token = g_value_get_string(g_value_array_get_nth(args, 0));
+	const gchar *user = g_value_get_string(g_value_array_get_nth(args, 1));
+	const gchar *host = g_value_get_string(g_value_array_get_nth(args, 2));
+	TpHandle handle = g_value_get_uint(g_value_array_get_nth(args, 3));
+	const gchar *flags = g_value_get_string(g_value_array_get_nth(args, 4));
+	const gchar *account = g_value_get_string(g_value_array_get_nth(args, 5));
+	const gchar *realname = g_value_get_string(g_value_array_get_nth(args, 6));
+
+	if (strcmp(token, WHOX_TOKEN))
+		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+
+	/* "0" means not logged in */
+	if (!strcmp(account, "0"))
+		account = NULL;
+
+	_cache_who_reply(conn, handle, user, host, flags, account, realname);
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+/* With away-notify, account-notify and chghost enabled the server pushes
+ * these for everyone we share a channel with. Each one makes part of a cached
+ * entry wrong, and the next request refetches it. */
+static IdleParserHandlerResult _invalidate_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+
+	idle_contact_info_invalidate(conn, g_value_get_uint(g_value_array_get_nth(args, 0)));
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
+static IdleParserHandlerResult _extended_join_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	TpHandle handle = g_value_get_uint(g_value_array_get_nth(args, 0));
+	const gchar *account = g_value_get_string(g_value_array_get_nth(args, 2));
+	const gchar *realname = g_value_get_string(g_value_array_get_nth(args, 3));
+
+	/* a WHO reply tells us more; and with account-notify on, an entry we
+	 * already have is still accurate */
+	if (handle == tp_base_connection_get_self_handle(TP_BASE_CONNECTION(conn)) || _lookup_cached_contact_info(conn, handle, FALSE) != NULL)
+		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+
+	/* "*" means not logged in */
+	if (!strcmp(account, "*"))
+		account = NULL;
+
+	_cache_who_reply(conn, handle, NULL, NULL, NULL, account, realname);
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
 static IdleParserHandlerResult _away_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
 	IdleConnection *conn = IDLE_CONNECTION(user_data);
 	ContactInfoRequest *request = _get_matching_request(conn, args);
@@ -198,7 +513,7 @@ static IdleParserHandlerResult _end_of_whois_handler(IdleParser *parser, IdlePar
 	field_values[0] = (request->is_secure) ? "true" : "false";
 	_insert_contact_field(request->contact_info, "x-irc-secure-connection", NULL, field_values);
 
-	_return_from_request_contact_info(conn);
+	_return_from_request_contact_info(conn, request);
 	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 }
 
@@ -237,7 +552,7 @@ static IdleParserHandlerResult _no_such_server_handler(IdleParser *parser, IdleP
 	dbus_g_method_return_error(request->context, error);
 	g_error_free(error);
 
-	_dequeue_request_contact_info(conn);
+	_dequeue_request_contact_info(conn, request);
 
 cleanup:
 	g_value_array_free(norm_args);
@@ -246,24 +561,28 @@ cleanup:
 
 static IdleParserHandlerResult _try_again_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
 	IdleConnection *conn = IDLE_CONNECTION(user_data);
-	ContactInfoRequest *request;
+	ContactInfoRequest *request = NULL;
 	const gchar *command;
 	const gchar *msg;
 	GError *error = NULL;
+	GList *l;
 
 	/* The RPL_TRYAGAIN message does not contain the nick for which the request was issued, but only the type of the message, which in this case is
-	 * WHOIS. So we assume that the last WHOIS request that we had issued has resulted in this RPL_TRYAGAIN. This is fine as long nobody else is
-	 * issuing a WHOIS because we issue a new request only after the earlier one was successfully completed or resulted in an error.
+	 * WHOIS. Replies come back in the order the commands were sent, and every request sent before the oldest one still outstanding has already
+	 * been answered, so we blame that one. This is fine as long as nobody else is issuing a WHOIS.
 	 */
 
-	if (g_queue_is_empty(conn->contact_info_requests))
-		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
-
 	command = g_value_get_string(g_value_array_get_nth(args, 0));
 	if (g_ascii_strcasecmp(command, "WHOIS"))
 		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 
-	request = g_queue_peek_head(conn->contact_info_requests);
+	for (l = conn->contact_info_requests->head; l != NULL && request == NULL; l = l->next) {
+		if (((ContactInfoRequest *) l->data)->in_flight)
+			request = l->data;
+	}
+
+	if (request == NULL)
+		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 
 	msg = g_value_get_string(g_value_array_get_nth(args, 1));
 
@@ -271,7 +590,7 @@ static IdleParserHandlerResult _try_again_handler(IdleParser *parser, IdleParser
 	dbus_g_method_return_error(request->context, error);
 	g_error_free(error);
 
-	_dequeue_request_contact_info(conn);
+	_dequeue_request_contact_info(conn, request);
 
 	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 }
@@ -282,6 +601,7 @@ static IdleParserHandlerResult _whois_channels_handler(IdleParser *parser, IdleP
 	gchar *channels;
 	gchar **channelsv;
 	const gchar *field_values[2] = {NULL, NULL};
+	const IdleISupport *isupport = idle_connection_get_isupport(conn);
 	guint i;
 
 	if (request == NULL)
@@ -297,10 +617,19 @@ static IdleParserHandlerResult _whois_channels_handler(IdleParser *parser, IdleP
 	for (i = 0; channelsv[i] != NULL; i++) {
 		const gchar *channel = channelsv[i];
 		gchar *field_params[2] = {NULL, NULL};
+		gsize n_prefixes = 0;
+
+		/* with multi-prefix there may be several, highest-ranked first */
+		while (idle_isupport_is_prefix_char(isupport, channel[n_prefixes]))
+			n_prefixes++;
+
+		/* '&' can be both a prefix and a channel type */
+		while (n_prefixes > 0 && !idle_isupport_is_chantype(isupport, channel[n_prefixes]))
+			n_prefixes--;
 
-		if (idle_muc_channel_is_modechar(channel[0]) && idle_muc_channel_is_typechar(channel[1])) {
+		if (n_prefixes > 0) {
 			field_params[0] = g_strdup_printf("role=%c", channel[0]);
-			channel++;
+			channel += n_prefixes;
 		}
 
 		field_values[0] = channel;
@@ -475,6 +804,7 @@ void idle_contact_info_finalize (GObject *object) {
 
 	g_queue_foreach(conn->contact_info_requests, _contact_info_requests_foreach_free, NULL);
 	g_queue_free(conn->contact_info_requests);
+	g_hash_table_destroy(conn->contact_info_cache);
 }
 
 void idle_contact_info_class_init (IdleConnectionClass *klass) {
@@ -499,18 +829,41 @@ idle_contact_info_fill_contact_attributes (
     const GArray *contacts,
     GHashTable *attributes_hash)
 {
-  /* We don't cache contact info, so we just never put /info into the
-   * attributes hash. This is spec-compliant: we don't implement
-   * GetContactInfo, and the spec says the attribute should be the same as the
-   * value returned by that method (or omitted if unknown). This function
-   * exists at all to make ContactInfo show up in ContactAttributeInterfaces
-   * (otherwise tp-glib might be justified in falling back to
-   * GetContactInfo(), which we know will fail).
+  /* Like GetContactInfo, we only report what we have cached from an earlier
+   * RequestContactInfo, and omit /info for everyone else rather than sending
+   * a WHOIS.
    */
+  IdleConnection *self = IDLE_CONNECTION (obj);
+  guint i;
+
+  for (i = 0; i < contacts->len; i++)
+    {
+      TpHandle handle = g_array_index (contacts, TpHandle, i);
+      GPtrArray *contact_info = _lookup_cached_contact_info (self, handle,
+          FALSE);
+
+      if (contact_info != NULL)
+        tp_contacts_mixin_set_contact_attribute (attributes_hash, handle,
+            TP_IFACE_CONNECTION_INTERFACE_CONTACT_INFO"/info",
+            tp_g_value_slice_new_boxed (TP_ARRAY_TYPE_CONTACT_INFO_FIELD_LIST,
+                contact_info));
+    }
 }
 
 void idle_contact_info_init (IdleConnection *conn) {
 	conn->contact_info_requests = g_queue_new();
+	conn->contact_info_cache = g_hash_table_new_full(NULL, NULL, NULL, _cached_contact_info_free);
+
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_NICK, _nick_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_QUIT, _quit_handler, conn);
+	/* the MUC manager's JOIN handler claims the message, so ours goes first */
+	idle_parser_add_handler_with_priority(conn->parser, IDLE_PARSER_PREFIXCMD_JOIN, _join_handler, conn, IDLE_PARSER_HANDLER_PRIORITY_FIRST);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_JOIN_EXTENDED, _extended_join_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_AWAY, _invalidate_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_ACCOUNT, _invalidate_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_CHGHOST, _invalidate_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_WHOREPLY, _who_reply_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_WHOSPCRPL, _whox_reply_handler, conn);
 
 	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_WHOISUSER, _whois_user_handler, conn);
 	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_WHOISCHANNELS, _whois_channels_handler, conn);
@@ -537,6 +890,7 @@ void idle_contact_info_iface_init(gpointer g_iface, gpointer iface_data) {
 
 #define IMPLEMENT(x) tp_svc_connection_interface_contact_info_implement_##x (\
 		klass, idle_connection_##x)
+	IMPLEMENT(get_contact_info);
 	IMPLEMENT(request_contact_info);
 #undef IMPLEMENT
 }
@@ -84,16 +84,49 @@ const gchar *idle_ctcp_notice(const gchar *target, const gchar *ctcp, IdleConnec
 	return _ctcp_send("NOTICE", target, ctcp, conn);
 }
 
+/* Returns the offset of the first byte in @s[0, @len) below 0x20, or @len if
+ * there's none. All the formatting codes are down there, and most messages
+ * have no such byte at all, so this checks a word at a time. */
+static gsize _find_control(const gchar *s, gsize len) {
+	const guint64 ones = G_GUINT64_CONSTANT(0x0101010101010101);
+	const guint64 high_bits = ones * 0x80;
+	gsize i = 0;
+
+	for (; i + sizeof(guint64) <= len; i += sizeof(guint64)) {
+		guint64 word;
+
+		memcpy(&word, s + i, sizeof(word));
+
+		/* non-zero if and only if some byte in the word is below 0x20 */
+		if ((word - ones * 0x20) & ~word & high_bits)
+			break;
+	}
+
+	for (; i < len; i++) {
+		if ((guchar) s[i] < 0x20)
+			return i;
+	}
+
+	return len;
+}
+
 gchar *idle_ctcp_kill_blingbling(const gchar *msg) {
 	gchar *killed, *killed_iter;
+	const gchar *iter, *end;
+	gsize len, plain;
 
 	if (msg == NULL)
 		return NULL;
 
-	killed = g_malloc0(strlen(msg) + 1);
-	killed_iter = killed;
+	len = strlen(msg);
+	end = msg + len;
+	plain = _find_control(msg, len);
+
+	killed = g_malloc(len + 1);
+	memcpy(killed, msg, plain);
+	killed_iter = killed + plain;
 
-	for (const gchar *iter = msg; *iter != '\0';) {
+	for (iter = msg + plain; iter < end;) {
 		switch (*iter) {
 			case '\x03': /* ^C */
 				iter++;
@@ -125,10 +158,16 @@ gchar *idle_ctcp_kill_blingbling(const gchar *msg) {
 				break;
 
 			default:
-				*killed_iter++ = *iter++;
+				/* copy up to the next control character in one go */
+				plain = 1 + _find_control(iter + 1, end - (iter + 1));
+				memcpy(killed_iter, iter, plain);
+				killed_iter += plain;
+				iter += plain;
 		}
 	}
 
+	*killed_iter = '\0';
+
 	return killed;
 }
 
@@ -29,7 +29,6 @@
 
 #define IDLE_DEBUG_FLAG IDLE_DEBUG_PARSER
 #include "idle-debug.h"
-#include "idle-muc-channel.h"
 
 /* When strict_mode is true, we validate the nick strictly against the IRC
  * RFCs (e.g. only ascii characters, no leading '-'.  When strict_mode is
@@ -90,16 +89,16 @@ gboolean idle_nickname_is_valid(const gchar *nickname, gboolean strict_mode) {
 	return TRUE;
 }
 
-static gboolean _channelname_is_valid(const gchar *channel) {
+static gboolean _channelname_is_valid(const gchar *channel, const IdleISupport *isupport) {
 	static const gchar not_allowed_chars[] = {' ', '\007', ',', '\r', '\n', ':', '\0'};
 	gsize len;
 	const gchar *tmp;
 
-	if (!idle_muc_channel_is_typechar(channel[0]))
+	if (!idle_isupport_is_chantype(isupport, channel[0]))
 		return FALSE;
 
 	len = strlen(channel);
-	if ((len < 2) || (len > 50))
+	if ((len < 2) || (len > idle_isupport_get_channellen(isupport)))
 		return FALSE;
 
 	if (channel[0] == '!') {
@@ -143,36 +142,78 @@ gchar *idle_normalize_nickname (const gchar *id, GError **error) {
 	return normalized;
 }
 
+static gchar *_casemap_fold(IdleCaseMapping mapping, const gchar *id) {
+	gsize len;
+	gchar *normalized;
+
+	if (mapping == IDLE_CASEMAPPING_OTHER)
+		return g_utf8_strdown(id, -1);
+
+	len = strlen(id);
+	normalized = g_malloc(len + 1);
+	idle_casemap_fold(mapping, id, normalized, len);
+	normalized[len] = '\0';
+
+	return normalized;
+}
+
+/* Protocol.NormalizeContact has no server to ask, so it folds @id the same
+ * way a connection does until it learns otherwise: by rfc1459. */
+gchar *idle_normalize_contact_id (const gchar *id, GError **error) {
+	if (!idle_nickname_is_valid(id, FALSE)) {
+		g_set_error(error, TP_ERROR, TP_ERROR_INVALID_HANDLE, "invalid nickname");
+		return NULL;
+	}
+
+	return _casemap_fold(IDLE_CASEMAPPING_RFC1459, id);
+}
+
+/* Folds @id by the server's CASEMAPPING. Handles created before RPL_ISUPPORT
+ * arrives (our own, mostly) use the rfc1459 default, which is what nearly
+ * every server advertises anyway. */
+static gchar *_casemap_normalize(const IdleISupport *isupport, const gchar *id) {
+	return _casemap_fold(idle_isupport_get_casemapping(isupport), id);
+}
+
 static gchar *_nick_normalize_func(TpHandleRepoIface *repo, const gchar *id, gpointer ctx, GError **error) {
-	return idle_normalize_nickname (id, error);
+	if (!idle_nickname_is_valid(id, FALSE)) {
+		g_set_error(error, TP_ERROR, TP_ERROR_INVALID_HANDLE, "invalid nickname");
+		return NULL;
+	}
+
+	return _casemap_normalize(ctx, id);
 }
 
 static gchar *_channel_normalize_func(TpHandleRepoIface *repo, const gchar *id, gpointer ctx, GError **error) {
-	gchar *normalized;
-
-	if (!_channelname_is_valid(id)) {
+	if (!_channelname_is_valid(id, ctx)) {
 		g_set_error(error, TP_ERROR, TP_ERROR_INVALID_HANDLE, "invalid channel ID");
 		return NULL;
 	}
 
-	normalized = g_utf8_strdown(id, -1);
+	return _casemap_normalize(ctx, id);
+}
 
-	return normalized;
+/* What the room handle for @id would be called, without creating it */
+gchar *idle_normalize_channel_name (IdleISupport *isupport, const gchar *id, GError **error) {
+	return _channel_normalize_func(NULL, id, isupport, error);
 }
 
-void idle_handle_repos_init(TpHandleRepoIface **handles) {
+/* The normalize functions are handed @isupport as their context, so it must
+ * outlive the repos. */
+void idle_handle_repos_init(TpHandleRepoIface **handles, IdleISupport *isupport) {
 	g_assert(handles != NULL);
+	g_assert(isupport != NULL);
 
 	handles[TP_HANDLE_TYPE_CONTACT] = (TpHandleRepoIface *) g_object_new(TP_TYPE_DYNAMIC_HANDLE_REPO,
 			"handle-type", TP_HANDLE_TYPE_CONTACT,
 			"normalize-function", _nick_normalize_func,
-			"default-normalize-context", NULL,
+			"default-normalize-context", isupport,
 			NULL);
 
 	handles[TP_HANDLE_TYPE_ROOM] = (TpHandleRepoIface *) g_object_new(TP_TYPE_DYNAMIC_HANDLE_REPO,
 			"handle-type", TP_HANDLE_TYPE_ROOM,
 			"normalize-function", _channel_normalize_func,
-			"default-normalize-context", NULL,
+			"default-normalize-context", isupport,
 			NULL);
 }
 
@@ -24,12 +24,16 @@
 #include <glib.h>
 #include <telepathy-glib/telepathy-glib.h>
 
+#include "idle-isupport.h"
+
 G_BEGIN_DECLS
 
-void idle_handle_repos_init(TpHandleRepoIface **handles);
+void idle_handle_repos_init(TpHandleRepoIface **handles, IdleISupport *isupport);
 gboolean idle_nickname_is_valid(const gchar *nickname, gboolean strict_mode);
 
 gchar *idle_normalize_nickname (const gchar *nickname, GError **error);
+gchar *idle_normalize_contact_id (const gchar *id, GError **error);
+gchar *idle_normalize_channel_name (IdleISupport *isupport, const gchar *id, GError **error);
 
 G_END_DECLS
 
@@ -47,9 +47,13 @@ G_DEFINE_TYPE_WITH_CODE(IdleIMChannel, idle_im_channel, TP_TYPE_BASE_CHANNEL,
 typedef struct _IdleIMChannelPrivate IdleIMChannelPrivate;
 
 struct _IdleIMChannelPrivate {
-  gpointer unused;
+  IdleTextTarget *text_target;
 };
 
+#define IDLE_IM_CHANNEL_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), IDLE_TYPE_IM_CHANNEL, \
+      IdleIMChannelPrivate))
+
 static void
 idle_im_channel_init (IdleIMChannel *obj)
 {
@@ -58,6 +62,9 @@ idle_im_channel_init (IdleIMChannel *obj)
 static void
 idle_im_channel_constructed (GObject *obj)
 {
+  IdleIMChannelPrivate *priv = IDLE_IM_CHANNEL_GET_PRIVATE (obj);
+  TpBaseChannel *base = TP_BASE_CHANNEL (obj);
+  TpBaseConnection *conn = tp_base_channel_get_connection (base);
   TpChannelTextMessageType types[] = {
       TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL,
       TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION,
@@ -70,12 +77,17 @@ idle_im_channel_constructed (GObject *obj)
 
   G_OBJECT_CLASS (idle_im_channel_parent_class)->constructed (obj);
 
+  priv->text_target = idle_text_target_new (tp_handle_inspect (
+      tp_base_connection_get_handles (conn, TP_HANDLE_TYPE_CONTACT),
+      tp_base_channel_get_target_handle (base)));
+
   /* initialize message mixin */
   tp_message_mixin_init (obj, G_STRUCT_OFFSET (IdleIMChannel, message_mixin),
       tp_base_channel_get_connection (TP_BASE_CHANNEL (obj)));
   tp_message_mixin_implement_sending (obj, idle_im_channel_send,
       G_N_ELEMENTS (types), types, 0,
-      TP_DELIVERY_REPORTING_SUPPORT_FLAG_RECEIVE_FAILURES,
+      TP_DELIVERY_REPORTING_SUPPORT_FLAG_RECEIVE_FAILURES |
+      TP_DELIVERY_REPORTING_SUPPORT_FLAG_RECEIVE_SUCCESSES,
       supported_content_types);
 }
 
@@ -128,6 +140,9 @@ idle_im_channel_class_init (IdleIMChannelClass *idle_im_channel_class)
 static void
 idle_im_channel_finalize (GObject *object)
 {
+  IdleIMChannelPrivate *priv = IDLE_IM_CHANNEL_GET_PRIVATE (object);
+
+  idle_text_target_free (priv->text_target);
   tp_message_mixin_finalize (object);
 
   G_OBJECT_CLASS(idle_im_channel_parent_class)->finalize (object);
@@ -193,13 +208,10 @@ idle_im_channel_send (
     TpMessage *message,
     TpMessageSendingFlags flags)
 {
-  TpBaseChannel *base = TP_BASE_CHANNEL (obj);
-  TpBaseConnection *conn = tp_base_channel_get_connection (base);
-  const gchar *recipient = tp_handle_inspect (
-      tp_base_connection_get_handles (conn, TP_HANDLE_TYPE_CONTACT),
-      tp_base_channel_get_target_handle (base));
+  TpBaseConnection *conn = tp_base_channel_get_connection (TP_BASE_CHANNEL (obj));
 
-  idle_text_send (obj, message, flags, recipient, IDLE_CONNECTION (conn));
+  idle_text_send (obj, message, flags,
+      IDLE_IM_CHANNEL_GET_PRIVATE (obj)->text_target, IDLE_CONNECTION (conn));
 }
 
 static void
@@ -31,6 +31,7 @@
 #include "idle-debug.h"
 #include "idle-im-channel.h"
 #include "idle-parser.h"
+#include "idle-presence.h"
 #include "idle-text.h"
 
 static void _im_manager_iface_init(gpointer g_iface, gpointer iface_data);
@@ -158,7 +159,9 @@ _im_manager_constructed (GObject *obj)
 static IdleParserHandlerResult _notice_privmsg_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
 	IdleIMManager *manager = IDLE_IM_MANAGER(user_data);
 	IdleIMManagerPrivate *priv = IDLE_IM_MANAGER_GET_PRIVATE(manager);
-	TpHandle handle = (TpHandle) g_value_get_uint(g_value_array_get_nth(args, 0));
+	TpHandle sender = (TpHandle) g_value_get_uint(g_value_array_get_nth(args, 0));
+	TpHandle target = (TpHandle) g_value_get_uint(g_value_array_get_nth(args, 1));
+	TpHandle handle = sender;
 	IdleIMChannel *chan;
 	TpChannelTextMessageType type;
 	gchar *body;
@@ -172,17 +175,21 @@ static IdleParserHandlerResult _notice_privmsg_handler(IdleParser *parser, IdleP
 			return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 	}
 
-	idle_connection_emit_queued_aliases_changed(priv->conn);
-
 	if (!priv->channels) {
 		IDLE_DEBUG("Channels hash table missing, ignoring...");
 		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 	}
 
+	/* with echo-message, something we said to @target from elsewhere (a raw
+	 * command, or another client on a bouncer) belongs with the conversation
+	 * with them */
+	if (sender == tp_base_connection_get_self_handle(TP_BASE_CONNECTION(priv->conn)))
+		handle = target;
+
 	if (!(chan = g_hash_table_lookup(priv->channels, GUINT_TO_POINTER(handle))))
 		chan = _im_manager_new_channel(manager, handle, handle, NULL);
 
-	idle_im_channel_receive(chan, type, handle, body);
+	idle_im_channel_receive(chan, type, sender, body);
 
 	g_free(body);
 
@@ -401,6 +408,7 @@ _im_channel_closed_cb (IdleIMChannel *chan,
 		{
 			IDLE_DEBUG ("removing channel with handle %u", handle);
 			g_hash_table_remove (priv->channels, GUINT_TO_POINTER (handle));
+			idle_presence_unwatch (priv->conn, handle);
 		} else {
 			IDLE_DEBUG ("reopening channel with handle %u due to pending messages",
 				handle);
@@ -439,6 +447,7 @@ _im_manager_new_channel (IdleIMManager *mgr,
 						 NULL);
 	tp_base_channel_register (TP_BASE_CHANNEL (chan));
 	g_hash_table_insert (priv->channels, GUINT_TO_POINTER (handle), chan);
+	idle_presence_watch (priv->conn, handle);
 
 	if (request != NULL)
 		requests = g_slist_prepend (requests, request);
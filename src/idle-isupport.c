@@ -0,0 +1,500 @@
+/*
+ * This file is part of telepathy-idle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "idle-isupport.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define IDLE_DEBUG_FLAG IDLE_DEBUG_CONNECTION
+#include "idle-debug.h"
+
+/* What we assume until the server tells us otherwise (RFC 2811/2812, plus
+ * the prefixes and chanmodes which were hardcoded before RPL_ISUPPORT was
+ * parsed). */
+#define DEFAULT_PREFIX "(qaohv)~&@%+"
+#define DEFAULT_CHANTYPES "#&+!"
+#define DEFAULT_CHANMODES "beI,k,l,imnprst"
+#define DEFAULT_CASEMAPPING IDLE_CASEMAPPING_RFC1459
+#define DEFAULT_CHANNELLEN 50
+#define DEFAULT_LINELEN 512
+#define DEFAULT_MODES 3
+
+#define MAX_PREFIXES 16
+
+enum {
+	CHAR_CHANTYPE = (1 << 0),
+	CHAR_PREFIX = (1 << 1)
+};
+
+struct _IdleISupport {
+	/* both indexed by ASCII character; anything above 0x7f is never special */
+	guint8 char_flags[128];
+	guint8 chanmodes[128];
+
+	/* PREFIX=(modes)chars, in order of decreasing rank */
+	gchar prefix_modes[MAX_PREFIXES + 1];
+	gchar prefix_chars[MAX_PREFIXES + 1];
+
+	IdleCaseMapping casemapping;
+	guint nicklen;
+	guint channellen;
+	guint linelen;
+	guint modes;
+	IdleEListFlags elist;
+	gboolean whox;
+	/* MONITOR list size; 0 if unsupported */
+	guint monitor;
+};
+
+static gboolean _char_index(gchar c, guint *index) {
+	guchar uc = (guchar) c;
+
+	if (uc == '\0' || uc >= 128)
+		return FALSE;
+
+	*index = uc;
+	return TRUE;
+}
+
+static void _set_chantypes(IdleISupport *isupport, const gchar *value) {
+	guint idx;
+
+	for (idx = 0; idx < 128; idx++)
+		isupport->char_flags[idx] &= ~CHAR_CHANTYPE;
+
+	for (; *value != '\0'; value++) {
+		if (_char_index(*value, &idx))
+			isupport->char_flags[idx] |= CHAR_CHANTYPE;
+	}
+}
+
+static gboolean _set_prefix(IdleISupport *isupport, const gchar *value) {
+	const gchar *modes, *chars;
+	gsize n_modes, i;
+	guint idx;
+
+	for (idx = 0; idx < 128; idx++) {
+		isupport->char_flags[idx] &= ~CHAR_PREFIX;
+
+		if (isupport->chanmodes[idx] == IDLE_CHANMODE_PREFIX)
+			isupport->chanmodes[idx] = IDLE_CHANMODE_UNKNOWN;
+	}
+
+	isupport->prefix_modes[0] = '\0';
+	isupport->prefix_chars[0] = '\0';
+
+	/* "PREFIX=" means the server has no membership prefixes at all */
+	if (*value == '\0')
+		return TRUE;
+
+	if (*value != '(')
+		return FALSE;
+
+	modes = value + 1;
+	chars = strchr(modes, ')');
+
+	if (chars == NULL)
+		return FALSE;
+
+	n_modes = chars - modes;
+	chars++;
+
+	if ((n_modes != strlen(chars)) || (n_modes > MAX_PREFIXES))
+		return FALSE;
+
+	for (i = 0; i < n_modes; i++) {
+		if (_char_index(modes[i], &idx))
+			isupport->chanmodes[idx] = IDLE_CHANMODE_PREFIX;
+
+		if (_char_index(chars[i], &idx))
+			isupport->char_flags[idx] |= CHAR_PREFIX;
+	}
+
+	memcpy(isupport->prefix_modes, modes, n_modes);
+	isupport->prefix_modes[n_modes] = '\0';
+	memcpy(isupport->prefix_chars, chars, n_modes);
+	isupport->prefix_chars[n_modes] = '\0';
+
+	return TRUE;
+}
+
+static void _set_chanmodes(IdleISupport *isupport, const gchar *value) {
+	IdleChanModeType type = IDLE_CHANMODE_LIST;
+	guint idx;
+
+	for (idx = 0; idx < 128; idx++) {
+		if (isupport->chanmodes[idx] != IDLE_CHANMODE_PREFIX)
+			isupport->chanmodes[idx] = IDLE_CHANMODE_UNKNOWN;
+	}
+
+	for (; *value != '\0'; value++) {
+		if (*value == ',') {
+			/* any groups past the fourth are unknown to us; per the spec we must
+			 * not try to guess how they take parameters */
+			if (type == IDLE_CHANMODE_FLAG)
+				break;
+
+			type++;
+			continue;
+		}
+
+		if (_char_index(*value, &idx) && (isupport->chanmodes[idx] != IDLE_CHANMODE_PREFIX))
+			isupport->chanmodes[idx] = type;
+	}
+}
+
+static void _set_casemapping(IdleISupport *isupport, const gchar *value) {
+	if (!g_ascii_strcasecmp(value, "rfc1459")) {
+		isupport->casemapping = IDLE_CASEMAPPING_RFC1459;
+	} else if (!g_ascii_strcasecmp(value, "strict-rfc1459")) {
+		isupport->casemapping = IDLE_CASEMAPPING_STRICT_RFC1459;
+	} else if (!g_ascii_strcasecmp(value, "ascii")) {
+		isupport->casemapping = IDLE_CASEMAPPING_ASCII;
+	} else {
+		IDLE_DEBUG("unknown CASEMAPPING \"%s\"", value);
+		isupport->casemapping = IDLE_CASEMAPPING_OTHER;
+	}
+}
+
+static void _set_elist(IdleISupport *isupport, const gchar *value) {
+	isupport->elist = 0;
+
+	for (; *value != '\0'; value++) {
+		switch (g_ascii_toupper(*value)) {
+			case 'C':
+				isupport->elist |= IDLE_ELIST_CREATION_TIME;
+				break;
+
+			case 'M':
+				isupport->elist |= IDLE_ELIST_MASK;
+				break;
+
+			case 'N':
+				isupport->elist |= IDLE_ELIST_NEGATIVE_MASK;
+				break;
+
+			case 'T':
+				isupport->elist |= IDLE_ELIST_TOPIC_TIME;
+				break;
+
+			case 'U':
+				isupport->elist |= IDLE_ELIST_USER_COUNT;
+				break;
+
+			default:
+				break;
+		}
+	}
+}
+
+static guint _parse_length(const gchar *value, guint fallback) {
+	gchar *endptr;
+	gulong parsed;
+
+	if (value == NULL || *value == '\0')
+		return fallback;
+
+	parsed = strtoul(value, &endptr, 10);
+
+	if (*endptr != '\0' || parsed == 0)
+		return fallback;
+
+	return MIN(parsed, G_MAXUINT);
+}
+
+/* Values may carry \xHH escapes for characters which are not allowed raw */
+static gchar *_unescape_value(const gchar *value) {
+	GString *str = g_string_sized_new(strlen(value));
+
+	while (*value != '\0') {
+		if (value[0] == '\\' && value[1] == 'x' && g_ascii_isxdigit(value[2]) && g_ascii_isxdigit(value[3])) {
+			g_string_append_c(str, (g_ascii_xdigit_value(value[2]) << 4) | g_ascii_xdigit_value(value[3]));
+			value += 4;
+		} else {
+			g_string_append_c(str, *value++);
+		}
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+static gboolean _key_is_valid(const gchar *key) {
+	if (*key == '\0')
+		return FALSE;
+
+	for (; *key != '\0'; key++) {
+		if (!g_ascii_isupper(*key) && !g_ascii_isdigit(*key))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* A NULL value means the parameter was negated ("-KEY") and should revert to
+ * whatever we assume when the server does not mention it. */
+static gboolean _apply(IdleISupport *isupport, const gchar *key, const gchar *value) {
+	if (!strcmp(key, "PREFIX")) {
+		if (!_set_prefix(isupport, value != NULL ? value : DEFAULT_PREFIX)) {
+			IDLE_DEBUG("malformed PREFIX \"%s\", using defaults", value);
+			_set_prefix(isupport, DEFAULT_PREFIX);
+		}
+	} else if (!strcmp(key, "CHANMODES")) {
+		_set_chanmodes(isupport, value != NULL ? value : DEFAULT_CHANMODES);
+	} else if (!strcmp(key, "CHANTYPES")) {
+		_set_chantypes(isupport, value != NULL ? value : DEFAULT_CHANTYPES);
+	} else if (!strcmp(key, "CASEMAPPING")) {
+		if (value != NULL)
+			_set_casemapping(isupport, value);
+		else
+			isupport->casemapping = DEFAULT_CASEMAPPING;
+	} else if (!strcmp(key, "NICKLEN")) {
+		isupport->nicklen = _parse_length(value, 0);
+	} else if (!strcmp(key, "CHANNELLEN")) {
+		/* "CHANNELLEN=" means there is no limit */
+		if (value != NULL && *value == '\0')
+			isupport->channellen = G_MAXUINT;
+		else
+			isupport->channellen = _parse_length(value, DEFAULT_CHANNELLEN);
+	} else if (!strcmp(key, "LINELEN")) {
+		isupport->linelen = CLAMP(_parse_length(value, DEFAULT_LINELEN), DEFAULT_LINELEN, IDLE_ISUPPORT_MAX_LINELEN);
+	} else if (!strcmp(key, "MODES")) {
+		/* "MODES" without a value means there is no limit */
+		if (value != NULL && *value == '\0')
+			isupport->modes = G_MAXUINT;
+		else
+			isupport->modes = _parse_length(value, DEFAULT_MODES);
+	} else if (!strcmp(key, "ELIST")) {
+		_set_elist(isupport, value != NULL ? value : "");
+	} else if (!strcmp(key, "MONITOR")) {
+		/* "MONITOR" without a value means there is no limit */
+		if (value != NULL && *value == '\0')
+			isupport->monitor = G_MAXUINT;
+		else
+			isupport->monitor = _parse_length(value, 0);
+	} else if (!strcmp(key, "WHOX")) {
+		isupport->whox = (value != NULL);
+	} else {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+IdleISupport *idle_isupport_new(void) {
+	IdleISupport *isupport = g_slice_new0(IdleISupport);
+
+	_set_prefix(isupport, DEFAULT_PREFIX);
+	_set_chanmodes(isupport, DEFAULT_CHANMODES);
+	_set_chantypes(isupport, DEFAULT_CHANTYPES);
+	isupport->casemapping = DEFAULT_CASEMAPPING;
+	isupport->nicklen = 0;
+	isupport->channellen = DEFAULT_CHANNELLEN;
+	isupport->linelen = DEFAULT_LINELEN;
+	isupport->modes = DEFAULT_MODES;
+	isupport->elist = 0;
+	isupport->whox = FALSE;
+	isupport->monitor = 0;
+
+	return isupport;
+}
+
+void idle_isupport_free(IdleISupport *isupport) {
+	if (isupport == NULL)
+		return;
+
+	g_slice_free(IdleISupport, isupport);
+}
+
+/**
+ * Update the table from one RPL_ISUPPORT parameter, "KEY", "KEY=value" or
+ * "-KEY". Returns FALSE for anything which is not a well-formed parameter
+ * (including the trailing human-readable text of the numeric), TRUE
+ * otherwise, whether or not we make any use of it.
+ */
+gboolean idle_isupport_parse_token(IdleISupport *isupport, const gchar *token) {
+	gboolean negated = FALSE;
+	const gchar *eq;
+	gchar *key;
+	gchar *value = NULL;
+
+	g_return_val_if_fail(isupport != NULL, FALSE);
+	g_return_val_if_fail(token != NULL, FALSE);
+
+	if (*token == '-') {
+		negated = TRUE;
+		token++;
+	}
+
+	eq = strchr(token, '=');
+	key = (eq != NULL) ? g_strndup(token, eq - token) : g_strdup(token);
+
+	if (!_key_is_valid(key) || (negated && eq != NULL)) {
+		g_free(key);
+		return FALSE;
+	}
+
+	if (!negated)
+		value = _unescape_value((eq != NULL) ? (eq + 1) : "");
+
+	if (_apply(isupport, key, value))
+		IDLE_DEBUG("%s%s%s%s", negated ? "-" : "", key, (value != NULL) ? "=" : "", (value != NULL) ? value : "");
+
+	g_free(value);
+	g_free(key);
+
+	return TRUE;
+}
+
+gboolean idle_isupport_is_chantype(const IdleISupport *isupport, gchar c) {
+	guint idx;
+
+	return _char_index(c, &idx) && (isupport->char_flags[idx] & CHAR_CHANTYPE);
+}
+
+gboolean idle_isupport_is_prefix_char(const IdleISupport *isupport, gchar c) {
+	guint idx;
+
+	return _char_index(c, &idx) && (isupport->char_flags[idx] & CHAR_PREFIX);
+}
+
+/**
+ * Map a membership prefix character as seen in NAMES and WHOIS replies (e.g.
+ * '@') to the channel mode letter which grants it (e.g. 'o'), or '\0' if the
+ * character is not a prefix on this server.
+ */
+gchar idle_isupport_prefix_char_to_mode(const IdleISupport *isupport, gchar c) {
+	const gchar *pos;
+
+	if (c == '\0' || !idle_isupport_is_prefix_char(isupport, c))
+		return '\0';
+
+	pos = strchr(isupport->prefix_chars, c);
+
+	return (pos != NULL) ? isupport->prefix_modes[pos - isupport->prefix_chars] : '\0';
+}
+
+IdleChanModeType idle_isupport_get_chanmode_type(const IdleISupport *isupport, gchar mode) {
+	guint idx;
+
+	if (!_char_index(mode, &idx))
+		return IDLE_CHANMODE_UNKNOWN;
+
+	return isupport->chanmodes[idx];
+}
+
+IdleCaseMapping idle_isupport_get_casemapping(const IdleISupport *isupport) {
+	return isupport->casemapping;
+}
+
+/* Lower-casing tables for the byte-wise mappings, indexed by IdleCaseMapping.
+ * rfc1459 also folds "[]\^" to "{}|~", strict-rfc1459 all of those but '^'. */
+static guchar casemap_tables[IDLE_CASEMAPPING_OTHER][256];
+static const guchar casemap_upper_bounds[IDLE_CASEMAPPING_OTHER] = {'^', ']', 'Z'};
+
+static void _casemap_tables_init(void) {
+	static gsize initialized = 0;
+
+	if (g_once_init_enter(&initialized)) {
+		for (guint mapping = 0; mapping < IDLE_CASEMAPPING_OTHER; mapping++) {
+			for (guint c = 0; c < 256; c++) {
+				if (c >= 'A' && c <= casemap_upper_bounds[mapping])
+					casemap_tables[mapping][c] = c + ('a' - 'A');
+				else
+					casemap_tables[mapping][c] = c;
+			}
+		}
+
+		g_once_init_leave(&initialized, 1);
+	}
+}
+
+#define ONES G_GUINT64_CONSTANT(0x0101010101010101)
+#define HIGH_BITS (ONES * 0x80)
+
+/**
+ * Fold @len bytes of @src into @dest (which may be the same buffer) by
+ * @mapping, which must not be IDLE_CASEMAPPING_OTHER. Bytes outside ASCII are
+ * copied unchanged, as no byte-wise mapping touches them.
+ *
+ * Nicknames are mostly plain ASCII, so those are done eight bytes at a time:
+ * adding (0x80 - lo) to a byte below 0x80 sets its top bit exactly when the
+ * byte is >= lo, without carrying into the next byte, so the bytes in
+ * ['A', upper] can be picked out and have 0x20 or'ed into them all at once.
+ */
+void idle_casemap_fold(IdleCaseMapping mapping, const gchar *src, gchar *dest, gsize len) {
+	const guchar *table;
+	guint64 ge_lower, gt_upper;
+
+	g_return_if_fail(mapping < IDLE_CASEMAPPING_OTHER);
+
+	_casemap_tables_init();
+	table = casemap_tables[mapping];
+	ge_lower = ONES * (0x80 - 'A');
+	gt_upper = ONES * (0x80 - (casemap_upper_bounds[mapping] + 1));
+
+	for (; len >= sizeof(guint64); len -= sizeof(guint64), src += sizeof(guint64), dest += sizeof(guint64)) {
+		guint64 word;
+
+		memcpy(&word, src, sizeof(word));
+
+		if (word & HIGH_BITS) {
+			for (guint i = 0; i < sizeof(guint64); i++)
+				dest[i] = table[(guchar) src[i]];
+		} else {
+			word |= (((word + ge_lower) & ~(word + gt_upper)) & HIGH_BITS) >> 2;
+			memcpy(dest, &word, sizeof(word));
+		}
+	}
+
+	for (; len > 0; len--)
+		*dest++ = table[(guchar) *src++];
+}
+
+/* 0 if the server did not say */
+guint idle_isupport_get_nicklen(const IdleISupport *isupport) {
+	return isupport->nicklen;
+}
+
+guint idle_isupport_get_channellen(const IdleISupport *isupport) {
+	return isupport->channellen;
+}
+
+/* including the trailing <CR><LF> */
+guint idle_isupport_get_linelen(const IdleISupport *isupport) {
+	return isupport->linelen;
+}
+
+/* maximum number of parameter-taking modes per MODE command */
+guint idle_isupport_get_modes(const IdleISupport *isupport) {
+	return isupport->modes;
+}
+
+IdleEListFlags idle_isupport_get_elist(const IdleISupport *isupport) {
+	return isupport->elist;
+}
+
+/* whether WHO accepts the %fields,token extension */
+gboolean idle_isupport_has_whox(const IdleISupport *isupport) {
+	return isupport->whox;
+}
+
+/* how many nicks we may MONITOR, or 0 if the server doesn't support it */
+guint idle_isupport_get_monitor(const IdleISupport *isupport) {
+	return isupport->monitor;
+}
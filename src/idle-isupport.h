@@ -0,0 +1,78 @@
+/*
+ * This file is part of telepathy-idle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __IDLE_ISUPPORT_H__
+#define __IDLE_ISUPPORT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* upper bound on LINELEN, however large a value the server advertises */
+#define IDLE_ISUPPORT_MAX_LINELEN 8192
+
+typedef struct _IdleISupport IdleISupport;
+
+typedef enum {
+	IDLE_CASEMAPPING_RFC1459 = 0,
+	IDLE_CASEMAPPING_STRICT_RFC1459,
+	IDLE_CASEMAPPING_ASCII,
+	/* anything we don't know how to fold byte-wise, e.g. rfc7613 */
+	IDLE_CASEMAPPING_OTHER
+} IdleCaseMapping;
+
+/* how a channel mode letter consumes parameters, per CHANMODES/PREFIX */
+typedef enum {
+	IDLE_CHANMODE_UNKNOWN = 0,
+	IDLE_CHANMODE_LIST, /* type A: always takes a parameter */
+	IDLE_CHANMODE_PARAM, /* type B: always takes a parameter */
+	IDLE_CHANMODE_PARAM_WHEN_SET, /* type C: takes a parameter when set */
+	IDLE_CHANMODE_FLAG, /* type D: never takes a parameter */
+	IDLE_CHANMODE_PREFIX /* membership prefix: takes a nickname */
+} IdleChanModeType;
+
+typedef enum {
+	IDLE_ELIST_CREATION_TIME = (1 << 0), /* C */
+	IDLE_ELIST_MASK = (1 << 1), /* M */
+	IDLE_ELIST_NEGATIVE_MASK = (1 << 2), /* N */
+	IDLE_ELIST_TOPIC_TIME = (1 << 3), /* T */
+	IDLE_ELIST_USER_COUNT = (1 << 4) /* U */
+} IdleEListFlags;
+
+IdleISupport *idle_isupport_new(void);
+void idle_isupport_free(IdleISupport *isupport);
+
+gboolean idle_isupport_parse_token(IdleISupport *isupport, const gchar *token);
+
+gboolean idle_isupport_is_chantype(const IdleISupport *isupport, gchar c);
+gboolean idle_isupport_is_prefix_char(const IdleISupport *isupport, gchar c);
+gchar idle_isupport_prefix_char_to_mode(const IdleISupport *isupport, gchar c);
+IdleChanModeType idle_isupport_get_chanmode_type(const IdleISupport *isupport, gchar mode);
+
+IdleCaseMapping idle_isupport_get_casemapping(const IdleISupport *isupport);
+void idle_casemap_fold(IdleCaseMapping mapping, const gchar *src, gchar *dest, gsize len);
+guint idle_isupport_get_nicklen(const IdleISupport *isupport);
+guint idle_isupport_get_channellen(const IdleISupport *isupport);
+guint idle_isupport_get_linelen(const IdleISupport *isupport);
+guint idle_isupport_get_modes(const IdleISupport *isupport);
+IdleEListFlags idle_isupport_get_elist(const IdleISupport *isupport);
+gboolean idle_isupport_has_whox(const IdleISupport *isupport);
+guint idle_isupport_get_monitor(const IdleISupport *isupport);
+
+G_END_DECLS
+
+#endif /* #ifndef __IDLE_ISUPPORT_H__ */
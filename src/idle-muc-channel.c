@@ -70,6 +70,11 @@ enum {
   PROP_SERVER,
 };
 
+/* Other people's JOINs and PARTs, and the members listed by NAMES replies, are
+ * merged into a single MembersChanged for the connection's
+ * members-flush-interval, or until this many changes have piled up. */
+#define MEMBERS_FLUSH_MAX_SIZE 256
+
 /* signal enum */
 enum {
 	JOIN_READY,
@@ -147,6 +152,7 @@ static guint signals[LAST_SIGNAL] = {0};
 /* private structure */
 struct _IdleMUCChannelPrivate {
 	const gchar *channel_name;
+	IdleTextTarget *text_target;
 
 	TpBaseRoomConfig *room_config;
 
@@ -159,8 +165,14 @@ struct _IdleMUCChannelPrivate {
 
 	DBusGMethodInvocation *passwd_ctx;
 
-	/* NAMEREPLY MembersChanged aggregation */
-	TpHandleSet *namereply_set;
+	/* JOIN/PART/NAMEREPLY MembersChanged aggregation; every change in the
+	 * batch shares the same reason and message */
+	TpIntset *pending_add;
+	TpIntset *pending_remove;
+	TpHandle pending_actor;
+	TpChannelGroupChangeReason pending_reason;
+	gchar *pending_message;
+	guint members_flush_id;
 
 	gboolean join_ready;
 
@@ -183,6 +195,9 @@ static void idle_muc_channel_init (IdleMUCChannel *obj) {
 	priv->dispose_has_run = FALSE;
 
 	priv->mode_state.topic_touched = G_MAXINT64;
+
+	priv->pending_add = tp_intset_new();
+	priv->pending_remove = tp_intset_new();
 }
 
 static void idle_muc_channel_dispose (GObject *object);
@@ -212,6 +227,7 @@ idle_muc_channel_constructed (GObject *obj)
 
 	priv->channel_name = tp_handle_inspect (room_handles, tp_base_channel_get_target_handle (base));
 	g_assert (priv->channel_name != NULL);
+	priv->text_target = idle_text_target_new (priv->channel_name);
 
 	tp_base_channel_register (base);
 
@@ -223,7 +239,8 @@ idle_muc_channel_constructed (GObject *obj)
 			conn);
 	tp_message_mixin_implement_sending (obj, idle_muc_channel_send,
 			G_N_ELEMENTS (types), types, 0,
-			TP_DELIVERY_REPORTING_SUPPORT_FLAG_RECEIVE_FAILURES,
+			TP_DELIVERY_REPORTING_SUPPORT_FLAG_RECEIVE_FAILURES |
+			TP_DELIVERY_REPORTING_SUPPORT_FLAG_RECEIVE_SUCCESSES,
 			supported_content_types);
 
 	if (tp_base_channel_is_requested (base)) {
@@ -422,6 +439,11 @@ void idle_muc_channel_dispose (GObject *object) {
 
 	priv->dispose_has_run = TRUE;
 
+	if (priv->members_flush_id) {
+		g_source_remove(priv->members_flush_id);
+		priv->members_flush_id = 0;
+	}
+
         tp_clear_object (&priv->room_config);
 
 	if (G_OBJECT_CLASS (idle_muc_channel_parent_class)->dispose)
@@ -438,8 +460,10 @@ void idle_muc_channel_finalize (GObject *object) {
 	if (priv->mode_state.key)
 		g_free(priv->mode_state.key);
 
-	if (priv->namereply_set)
-		tp_handle_set_destroy(priv->namereply_set);
+	tp_intset_destroy(priv->pending_add);
+	tp_intset_destroy(priv->pending_remove);
+	g_free(priv->pending_message);
+	idle_text_target_free(priv->text_target);
 
 	tp_group_mixin_finalize(object);
 	tp_message_mixin_finalize (object);
@@ -699,9 +723,80 @@ static void change_password_flags(IdleMUCChannel *obj, guint flag, gboolean stat
 	}
 }
 
+static void flush_pending_members(IdleMUCChannel *chan) {
+	IdleMUCChannelPrivate *priv = chan->priv;
+
+	if (priv->members_flush_id) {
+		g_source_remove(priv->members_flush_id);
+		priv->members_flush_id = 0;
+	}
+
+	if (tp_intset_is_empty(priv->pending_add) && tp_intset_is_empty(priv->pending_remove))
+		return;
+
+	tp_group_mixin_change_members((GObject *) chan, priv->pending_message, priv->pending_add, priv->pending_remove, NULL, NULL, priv->pending_actor, priv->pending_reason);
+
+	tp_intset_clear(priv->pending_add);
+	tp_intset_clear(priv->pending_remove);
+	tp_clear_pointer(&priv->pending_message, g_free);
+}
+
+static gboolean _flush_pending_members_cb(gpointer user_data) {
+	IdleMUCChannel *chan = IDLE_MUC_CHANNEL(user_data);
+
+	chan->priv->members_flush_id = 0;
+	flush_pending_members(chan);
+
+	return FALSE;
+}
+
+/* Queues a change to another contact's membership, merging it with any other
+ * pending changes sharing the same reason and message. A contact who joins
+ * and leaves again (or vice versa) within one batch cancels out. */
+static void queue_member_change(IdleMUCChannel *chan, TpHandle handle, gboolean joined, TpHandle actor, const gchar *message, TpChannelGroupChangeReason reason) {
+	IdleMUCChannelPrivate *priv = chan->priv;
+	TpBaseConnection *base_conn = tp_base_channel_get_connection(TP_BASE_CHANNEL(chan));
+	guint interval = idle_connection_get_members_flush_interval(IDLE_CONNECTION(base_conn));
+	guint pending;
+
+	if (message != NULL && message[0] == '\0')
+		message = NULL;
+
+	pending = tp_intset_size(priv->pending_add) + tp_intset_size(priv->pending_remove);
+
+	if (pending > 0 && (priv->pending_reason != reason || tp_strdiff(priv->pending_message, message)))
+		flush_pending_members(chan);
+
+	if (tp_intset_is_empty(priv->pending_add) && tp_intset_is_empty(priv->pending_remove)) {
+		priv->pending_actor = actor;
+		priv->pending_reason = reason;
+		priv->pending_message = g_strdup(message);
+	} else if (priv->pending_actor != actor) {
+		priv->pending_actor = 0;
+	}
+
+	if (joined) {
+		if (!tp_intset_remove(priv->pending_remove, handle))
+			tp_intset_add(priv->pending_add, handle);
+	} else {
+		if (!tp_intset_remove(priv->pending_add, handle))
+			tp_intset_add(priv->pending_remove, handle);
+	}
+
+	pending = tp_intset_size(priv->pending_add) + tp_intset_size(priv->pending_remove);
+
+	if (interval == 0 || pending >= MEMBERS_FLUSH_MAX_SIZE)
+		flush_pending_members(chan);
+	else if (!priv->members_flush_id && pending > 0)
+		priv->members_flush_id = g_timeout_add(interval, _flush_pending_members_cb, chan);
+}
+
 gboolean idle_muc_channel_receive(IdleMUCChannel *chan, TpChannelTextMessageType type, TpHandle sender, const gchar *text) {
 	TpBaseConnection *base_conn = tp_base_channel_get_connection (TP_BASE_CHANNEL (chan));
 
+	/* Messages must not overtake the joins and parts that came before them */
+	flush_pending_members(chan);
+
 	return idle_text_received (G_OBJECT (chan), base_conn, type, text, sender);
 }
 
@@ -734,13 +829,12 @@ void idle_muc_channel_join(IdleMUCChannel *chan, TpHandle joiner) {
 	IdleMUCChannelPrivate *priv = chan->priv;
 	TpBaseConnection *base_conn = tp_base_channel_get_connection (
 		TP_BASE_CHANNEL (chan));
-	TpIntset *set;
-
-	set = tp_intset_new();
-	tp_intset_add(set, joiner);
 
 	if (joiner == tp_base_connection_get_self_handle (base_conn)) {
+		TpIntset *set = tp_intset_new_containing(joiner);
+
 		/* woot we managed to get into a channel, great */
+		flush_pending_members(chan);
 		change_state(chan, MUC_STATE_JOINED);
 		tp_group_mixin_change_members((GObject *)(chan), NULL, set, NULL, NULL, NULL, joiner, TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
 		tp_group_mixin_change_flags((GObject *)(chan),
@@ -753,21 +847,29 @@ void idle_muc_channel_join(IdleMUCChannel *chan, TpHandle joiner) {
 		if (priv->channel_name[0] == '+')
 			/* according to IRC specs, PLUS channels do not support channel modes and alway have only +t set, so we work with that. */
 			change_mode_state(chan, MODE_FLAG_TOPIC_ONLY_SETTABLE_BY_OPS, 0);
+
+		tp_intset_destroy(set);
 	} else {
-		tp_group_mixin_change_members((GObject *)(chan), NULL, set, NULL, NULL, NULL, joiner, TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
+		queue_member_change(chan, joiner, TRUE, joiner, NULL, TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
 	}
 
 	IDLE_DEBUG("member joined with handle %u", joiner);
-
-	tp_intset_destroy(set);
 }
 
 static void _network_member_left(IdleMUCChannel *chan, TpHandle leaver, TpHandle actor, const gchar *message, TpChannelGroupChangeReason reason) {
 	TpBaseChannel *base = TP_BASE_CHANNEL (chan);
 	TpBaseConnection *base_conn = tp_base_channel_get_connection (base);
-	TpIntset *set = tp_intset_new();
+	TpIntset *set;
+
+	/* Kicks are worth hearing about straight away */
+	if (leaver != tp_base_connection_get_self_handle (base_conn) && reason != TP_CHANNEL_GROUP_CHANGE_REASON_KICKED) {
+		queue_member_change(chan, leaver, FALSE, actor, message, reason);
+		return;
+	}
 
-	tp_intset_add(set, leaver);
+	flush_pending_members(chan);
+
+	set = tp_intset_new_containing(leaver);
 	tp_group_mixin_change_members((GObject *) chan, message, NULL, set, NULL, NULL, actor, reason);
 
 	if (leaver == tp_base_connection_get_self_handle (base_conn)) {
@@ -799,6 +901,8 @@ void idle_muc_channel_invited(IdleMUCChannel *chan, TpHandle inviter) {
 	TpIntset *add = tp_intset_new();
 	TpIntset *local = tp_intset_new();
 
+	flush_pending_members(chan);
+
 	tp_intset_add(add, inviter);
 	tp_intset_add(local, tp_base_connection_get_self_handle (base_conn));
 
@@ -808,75 +912,69 @@ void idle_muc_channel_invited(IdleMUCChannel *chan, TpHandle inviter) {
 	tp_intset_destroy(local);
 }
 
+/* Maps the mode letter behind a membership prefix to our privilege flags;
+ * owners ('q') and admins ('a') rank above ops, so count as ops too. */
+static guint _modechar_to_modeflag(gchar modechar) {
+	switch (modechar) {
+		case 'q':
+		case 'a':
+		case 'o':
+			return MODE_FLAG_OPERATOR_PRIVILEGE;
+		case 'h':
+			return MODE_FLAG_HALFOP_PRIVILEGE;
+		case 'v':
+			return MODE_FLAG_VOICE_PRIVILEGE;
+		default:
+			return 0;
+	}
+}
+
+/* NAMES replies for big channels run to thousands of lines, so rather than
+ * holding the whole list back until RPL_ENDOFNAMES the members are streamed
+ * through the usual MembersChanged aggregation in bounded chunks. */
 void idle_muc_channel_namereply(IdleMUCChannel *chan, GValueArray *args) {
-	IdleMUCChannelPrivate *priv = chan->priv;
 	TpBaseChannel *base = TP_BASE_CHANNEL (chan);
 	TpBaseConnection *base_conn = tp_base_channel_get_connection (base);
-
-	if (!priv->namereply_set)
-		priv->namereply_set = tp_handle_set_new(tp_base_connection_get_handles(base_conn, TP_HANDLE_TYPE_CONTACT));
+	const IdleISupport *isupport = idle_connection_get_isupport(IDLE_CONNECTION(base_conn));
 
 	for (guint i = 1; (i + 1) < args->n_values; i += 2) {
 		TpHandle handle = g_value_get_uint(g_value_array_get_nth(args, i));
-		gchar modechar = g_value_get_schar(g_value_array_get_nth(args, i + 1));
+		const gchar *modechars = g_value_get_string(g_value_array_get_nth(args, i + 1));
 
 		if (handle == tp_base_connection_get_self_handle (base_conn)) {
 			guint remove = MODE_FLAG_OPERATOR_PRIVILEGE | MODE_FLAG_VOICE_PRIVILEGE | MODE_FLAG_HALFOP_PRIVILEGE;
 			guint add = 0;
 
-			switch (modechar) {
-				case '@':
-					add |= MODE_FLAG_OPERATOR_PRIVILEGE;
-					break;
-
-				case '&':
-					add |= MODE_FLAG_OPERATOR_PRIVILEGE;
-					break;
-
-				case '+':
-					add |= MODE_FLAG_VOICE_PRIVILEGE;
-					break;
-
-				default:
-					break;
-			}
+			/* with multi-prefix we get all of them, not just the highest */
+			for (; *modechars != '\0'; modechars++)
+				add |= _modechar_to_modeflag(idle_isupport_prefix_char_to_mode(isupport, *modechars));
 
 			remove &= ~add;
 			change_mode_state(chan, add, remove);
 		}
 
-		tp_handle_set_add(priv->namereply_set, handle);
+		queue_member_change(chan, handle, TRUE, 0, NULL, TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
 	}
 }
 
 void idle_muc_channel_namereply_end(IdleMUCChannel *chan) {
-	IdleMUCChannelPrivate *priv = chan->priv;
-	TpBaseChannel *base = TP_BASE_CHANNEL (chan);
-	TpBaseConnection *base_conn = tp_base_channel_get_connection (base);
-
-	if (!priv->namereply_set) {
-		IDLE_DEBUG("no NAMEREPLY received before NAMEREPLY_END");
-		return;
-	}
-
-	idle_connection_emit_queued_aliases_changed(IDLE_CONNECTION (base_conn));
+	flush_pending_members(chan);
+}
 
-	tp_group_mixin_change_members((GObject *) chan, NULL, tp_handle_set_peek(priv->namereply_set), NULL, NULL, NULL, 0, TP_CHANNEL_GROUP_CHANGE_REASON_NONE);
+/* Whether a mode letter consumes the next MODE parameter when set ('+') or
+ * unset ('-'); letters the server didn't tell us about never do. */
+static gboolean _mode_takes_param(IdleChanModeType type, gchar operation) {
+	switch (type) {
+		case IDLE_CHANMODE_LIST:
+		case IDLE_CHANMODE_PARAM:
+		case IDLE_CHANMODE_PREFIX:
+			return TRUE;
 
-	tp_handle_set_destroy(priv->namereply_set);
-	priv->namereply_set = NULL;
-}
+		case IDLE_CHANMODE_PARAM_WHEN_SET:
+			return (operation == '+');
 
-static guint _modechar_to_modeflag(gchar modechar) {
-	switch (modechar) {
-		case 'o':
-			return MODE_FLAG_OPERATOR_PRIVILEGE;
-		case 'h':
-			return MODE_FLAG_HALFOP_PRIVILEGE;
-		case 'v':
-			return MODE_FLAG_VOICE_PRIVILEGE;
 		default:
-			return 0;
+			return FALSE;
 	}
 }
 
@@ -885,6 +983,7 @@ void idle_muc_channel_mode(IdleMUCChannel *chan, GValueArray *args) {
 	TpBaseChannel *base = TP_BASE_CHANNEL (chan);
 	TpBaseConnection *base_conn = tp_base_channel_get_connection (base);
 	TpHandleRepoIface *handles = tp_base_connection_get_handles(base_conn, TP_HANDLE_TYPE_CONTACT);
+	const IdleISupport *isupport = idle_connection_get_isupport(IDLE_CONNECTION(base_conn));
 
         tp_base_room_config_set_retrieved (priv->room_config);
 
@@ -899,41 +998,42 @@ void idle_muc_channel_mode(IdleMUCChannel *chan, GValueArray *args) {
 			continue;
 
 		for (; *modes != '\0'; modes++) {
-			switch (*modes) {
-				case 'o':
-				case 'h':
-				case 'v':
-					if ((i + 1) < args->n_values) {
-						TpHandle handle = tp_handle_ensure(handles, g_value_get_string(g_value_array_get_nth(args, ++i)), NULL, NULL);
-
-						if (handle == tp_base_connection_get_self_handle (base_conn)) {
-							IDLE_DEBUG("got MODE '%c' concerning us", *modes);
-							mode_accum |= _modechar_to_modeflag(*modes);
-						}
+			IdleChanModeType type = idle_isupport_get_chanmode_type(isupport, *modes);
+			const gchar *param = NULL;
+
+			if (_mode_takes_param(type, operation) && ((i + 1) < args->n_values))
+				param = g_value_get_string(g_value_array_get_nth(args, ++i));
+
+			if (type == IDLE_CHANMODE_PREFIX) {
+				if (param != NULL) {
+					TpHandle handle = tp_handle_ensure(handles, param, NULL, NULL);
+
+					if (handle == tp_base_connection_get_self_handle (base_conn)) {
+						IDLE_DEBUG("got MODE '%c' concerning us", *modes);
+						mode_accum |= _modechar_to_modeflag(*modes);
 					}
-					break;
+				}
 
+				continue;
+			}
+
+			switch (*modes) {
 				case 'l':
-					if (operation == '+') {
-						if ((i + 1) < args->n_values) {
-							const gchar *limit_str = g_value_get_string(g_value_array_get_nth(args, ++i));
-							gchar *endptr;
-							guint maybe_limit = strtol(limit_str, &endptr, 10);
-
-							if (endptr != limit_str)
-								limit = maybe_limit;
-						}
+					if ((operation == '+') && (param != NULL)) {
+						gchar *endptr;
+						guint maybe_limit = strtol(param, &endptr, 10);
+
+						if (endptr != param)
+							limit = maybe_limit;
 					}
 
 					mode_accum |= MODE_FLAG_USER_LIMIT;
 					break;
 
 				case 'k':
-					if (operation == '+') {
-						if ((i + 1) < args->n_values) {
-							g_free(key);
-							key = g_strdup(g_value_get_string(g_value_array_get_nth(args, ++i)));
-						}
+					if ((operation == '+') && (param != NULL)) {
+						g_free(key);
+						key = g_strdup(param);
 					}
 
 					mode_accum |= MODE_FLAG_KEY;
@@ -981,6 +1081,7 @@ void idle_muc_channel_mode(IdleMUCChannel *chan, GValueArray *args) {
 						if (mode_accum & MODE_FLAG_KEY) {
 							g_free(priv->mode_state.key);
 							priv->mode_state.key = key;
+							key = NULL;
 						}
 
 						if (mode_accum & MODE_FLAG_USER_LIMIT)
@@ -998,7 +1099,8 @@ void idle_muc_channel_mode(IdleMUCChannel *chan, GValueArray *args) {
 					break;
 
 				default:
-					IDLE_DEBUG("did not understand mode identifier %c", *modes);
+					if (type == IDLE_CHANMODE_UNKNOWN)
+						IDLE_DEBUG("did not understand mode identifier %c", *modes);
 					break;
 			}
 		}
@@ -1122,6 +1224,8 @@ void idle_muc_channel_rename(IdleMUCChannel *chan, TpHandle old_handle, TpHandle
 	TpIntset *local = tp_intset_new();
 	TpIntset *remote = tp_intset_new();
 
+	flush_pending_members(chan);
+
 	if (old_handle == chan->group.self_handle)
 		tp_group_mixin_change_self_handle((GObject *) chan, new_handle);
 
@@ -1234,6 +1338,8 @@ static gboolean add_member(GObject *gobj, TpHandle handle, const gchar *message,
 	TpBaseConnection *base_conn = tp_base_channel_get_connection (base);
 	TpHandle self_handle = tp_base_connection_get_self_handle (base_conn);
 
+	flush_pending_members(obj);
+
 	if (handle == self_handle) {
 		if (tp_handle_set_is_member(obj->group.members, handle) || tp_handle_set_is_member(obj->group.remote_pending, handle)) {
 			GError *e = g_error_new (TP_ERROR, TP_ERROR_NOT_AVAILABLE,
@@ -1309,6 +1415,8 @@ static gboolean remove_member(GObject *gobj, TpHandle handle, const gchar *messa
 		return TRUE;
 	}
 
+	flush_pending_members(obj);
+
 	if (!tp_handle_set_is_member(obj->group.members, handle)) {
 		IDLE_DEBUG("handle %u not a current member!", handle);
 
@@ -1426,7 +1534,7 @@ idle_muc_channel_send (GObject *obj, TpMessage *message, TpMessageSendingFlags f
 		return;
 	}
 
-	idle_text_send(obj, message, flags, priv->channel_name, IDLE_CONNECTION (base_conn));
+	idle_text_send(obj, message, flags, priv->text_target, IDLE_CONNECTION (base_conn));
 }
 
 static void
@@ -1464,52 +1572,6 @@ idle_muc_channel_set_subject (
     }
 }
 
-gboolean idle_muc_channel_is_modechar(char c) {
-	switch (c) {
-		/* founder */
-		case '*':
-		case '~':
-
-		/* admin */
-		case '!':
-		case '&':
-
-		/* chanop */
-		case '@':
-
-		/* halfop */
-		case '%':
-
-		/* voice */
-		case '+':
-			return TRUE;
-
-		default:
-			return FALSE;
-	}
-}
-
-gboolean idle_muc_channel_is_typechar(gchar c)
-{
-	switch (c) {
-		/* standard channel */
-		case '#':
-
-		/* local to a server */
-		case '&':
-
-		/* no support for modes */
-		case '+':
-
-		/* safe channel */
-		case '!':
-			return TRUE;
-
-		default:
-			return FALSE;
-	}
-}
-
 static void _password_iface_init(gpointer g_iface, gpointer iface_data) {
 	TpSvcChannelInterfacePasswordClass *klass = (TpSvcChannelInterfacePasswordClass *)(g_iface);
 
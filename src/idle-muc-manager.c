@@ -52,6 +52,11 @@ struct _IdleMUCManagerPrivate {
 	IdleConnection *conn;
 	GHashTable *channels;
 
+	/* Map from contact TpHandle to a set (GHashTable) of the room TpHandles of
+	 * channels in which that contact is known to be a member, so that QUIT and
+	 * NICK only have to visit the channels actually concerned. */
+	GHashTable *contact_rooms;
+
 	/* Map from IdleMUCChannel * (borrowed from channels) to a GSList * of
 	 * request tokens. */
 	GHashTable *queued_requests;
@@ -136,6 +141,93 @@ static void idle_muc_manager_init(IdleMUCManager *obj) {
 
 	priv->channels = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
 	priv->queued_requests = g_hash_table_new(NULL, NULL);
+	priv->contact_rooms = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_hash_table_unref);
+}
+
+static void _contact_rooms_add(IdleMUCManagerPrivate *priv, TpHandle contact, TpHandle room) {
+	GHashTable *rooms;
+
+	if (!priv->contact_rooms)
+		return;
+
+	rooms = g_hash_table_lookup(priv->contact_rooms, GUINT_TO_POINTER(contact));
+
+	if (!rooms) {
+		rooms = g_hash_table_new(g_direct_hash, g_direct_equal);
+		g_hash_table_insert(priv->contact_rooms, GUINT_TO_POINTER(contact), rooms);
+	}
+
+	g_hash_table_add(rooms, GUINT_TO_POINTER(room));
+}
+
+static void _contact_rooms_remove(IdleMUCManagerPrivate *priv, TpHandle contact, TpHandle room) {
+	GHashTable *rooms;
+
+	if (!priv->contact_rooms)
+		return;
+
+	rooms = g_hash_table_lookup(priv->contact_rooms, GUINT_TO_POINTER(contact));
+
+	if (!rooms)
+		return;
+
+	g_hash_table_remove(rooms, GUINT_TO_POINTER(room));
+
+	if (g_hash_table_size(rooms) == 0)
+		g_hash_table_remove(priv->contact_rooms, GUINT_TO_POINTER(contact));
+}
+
+static gboolean _contact_rooms_forget_room_foreach(gpointer key, gpointer value, gpointer user_data) {
+	GHashTable *rooms = value;
+
+	g_hash_table_remove(rooms, user_data);
+
+	return (g_hash_table_size(rooms) == 0);
+}
+
+static void _contact_rooms_forget_room(IdleMUCManagerPrivate *priv, TpHandle room) {
+	if (!priv->contact_rooms)
+		return;
+
+	g_hash_table_foreach_remove(priv->contact_rooms, _contact_rooms_forget_room_foreach, GUINT_TO_POINTER(room));
+}
+
+/* Once we've left a room, whether or not its channel stays open, we hear
+ * nothing more about who's in it, so nobody is indexed as being there. */
+static void _contact_rooms_leave(IdleMUCManagerPrivate *priv, TpHandle contact, TpHandle room) {
+	if (contact == tp_base_connection_get_self_handle(TP_BASE_CONNECTION(priv->conn)))
+		_contact_rooms_forget_room(priv, room);
+	else
+		_contact_rooms_remove(priv, contact, room);
+}
+
+/* Removes the contact from the index, returning a list of new references to
+ * the channels it was a member of. */
+static GSList *_contact_rooms_take_channels(IdleMUCManagerPrivate *priv, TpHandle contact) {
+	GHashTable *rooms;
+	GHashTableIter iter;
+	gpointer room;
+	GSList *chans = NULL;
+
+	if (!priv->contact_rooms || !priv->channels)
+		return NULL;
+
+	rooms = g_hash_table_lookup(priv->contact_rooms, GUINT_TO_POINTER(contact));
+
+	if (!rooms)
+		return NULL;
+
+	g_hash_table_iter_init(&iter, rooms);
+	while (g_hash_table_iter_next(&iter, &room, NULL)) {
+		IdleMUCChannel *chan = g_hash_table_lookup(priv->channels, room);
+
+		if (chan)
+			chans = g_slist_prepend(chans, g_object_ref(chan));
+	}
+
+	g_hash_table_remove(priv->contact_rooms, GUINT_TO_POINTER(contact));
+
+	return chans;
 }
 
 static void idle_muc_manager_get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec) {
@@ -255,8 +347,6 @@ static IdleParserHandlerResult _numeric_topic_stamp_handler(IdleParser *parser,
 
 	chan = g_hash_table_lookup(priv->channels, GUINT_TO_POINTER(room_handle));
 
-	idle_connection_emit_queued_aliases_changed(priv->conn);
-
 	if (chan)
 		idle_muc_channel_topic_touch(chan, toucher_handle, touched);
 
@@ -281,8 +371,6 @@ static IdleParserHandlerResult _invite_handler(IdleParser *parser, IdleParserMes
 
 	chan = g_hash_table_lookup(priv->channels, GUINT_TO_POINTER(room_handle));
 
-	idle_connection_emit_queued_aliases_changed(priv->conn);
-
 	if (!chan) {
 		chan = _muc_manager_new_channel(manager, room_handle, inviter_handle, FALSE);
 		tp_channel_manager_emit_new_channel(TP_CHANNEL_MANAGER(user_data), (TpExportableChannel *) chan, NULL);
@@ -299,8 +387,6 @@ static IdleParserHandlerResult _join_handler(IdleParser *parser, IdleParserMessa
 	TpHandle room_handle = g_value_get_uint(g_value_array_get_nth(args, 1));
 	IdleMUCChannel *chan;
 
-	idle_connection_emit_queued_aliases_changed(priv->conn);
-
 	if (!priv->channels) {
 		IDLE_DEBUG("Channels hash table missing, ignoring...");
 		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
@@ -315,6 +401,7 @@ static IdleParserHandlerResult _join_handler(IdleParser *parser, IdleParserMessa
 	}
 
 	idle_muc_channel_join(chan, joiner_handle);
+	_contact_rooms_add(priv, joiner_handle, room_handle);
 
 	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
 }
@@ -334,8 +421,10 @@ static IdleParserHandlerResult _kick_handler(IdleParser *parser, IdleParserMessa
 
 	chan = g_hash_table_lookup(priv->channels, GUINT_TO_POINTER(room_handle));
 
-	if (chan)
+	if (chan) {
+		_contact_rooms_leave(priv, kicked_handle, room_handle);
 		idle_muc_channel_kick(chan, kicked_handle, kicker_handle, message);
+	}
 
 	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
 }
@@ -352,8 +441,12 @@ static IdleParserHandlerResult _numeric_namereply_handler(IdleParser *parser, Id
 
 	chan = g_hash_table_lookup(priv->channels, GUINT_TO_POINTER(room_handle));
 
-	if (chan)
+	if (chan) {
+		for (guint i = 1; (i + 1) < args->n_values; i += 2)
+			_contact_rooms_add(priv, g_value_get_uint(g_value_array_get_nth(args, i)), room_handle);
+
 		idle_muc_channel_namereply(chan, args);
+	}
 
 	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
 }
@@ -408,14 +501,34 @@ static void _channel_rename_foreach(TpExportableChannel *channel, gpointer user_
 
 static IdleParserHandlerResult _nick_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
 	TpChannelManager *mgr = TP_CHANNEL_MANAGER(user_data);
+	IdleMUCManagerPrivate *priv = IDLE_MUC_MANAGER_GET_PRIVATE(user_data);
 	TpHandle old_handle = g_value_get_uint(g_value_array_get_nth(args, 0));
 	TpHandle new_handle = g_value_get_uint(g_value_array_get_nth(args, 1));
 	ChannelRenameForeachData data = {old_handle, new_handle};
+	GSList *chans;
 
 	if (old_handle == new_handle)
 		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 
-	tp_channel_manager_foreach_channel(mgr, _channel_rename_foreach, &data);
+	chans = _contact_rooms_take_channels(priv, old_handle);
+
+	/* We are the self handle of channels we haven't joined (yet) too, so they
+	 * all need to hear about our own renames. */
+	if (old_handle == tp_base_connection_get_self_handle(TP_BASE_CONNECTION(priv->conn))) {
+		tp_channel_manager_foreach_channel(mgr, _channel_rename_foreach, &data);
+	} else {
+		for (GSList *l = chans; l != NULL; l = l->next)
+			idle_muc_channel_rename(l->data, old_handle, new_handle);
+	}
+
+	for (GSList *l = chans; l != NULL; l = l->next) {
+		TpHandle room_handle = tp_base_channel_get_target_handle(l->data);
+
+		if (!tp_base_channel_is_destroyed(l->data))
+			_contact_rooms_add(priv, new_handle, room_handle);
+	}
+
+	g_slist_free_full(chans, g_object_unref);
 
 	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 }
@@ -473,32 +586,24 @@ static IdleParserHandlerResult _part_handler(IdleParser *parser, IdleParserMessa
 
 	chan = g_hash_table_lookup(priv->channels, GUINT_TO_POINTER(room_handle));
 
-	if (chan)
+	if (chan) {
+		_contact_rooms_leave(priv, leaver_handle, room_handle);
 		idle_muc_channel_part(chan, leaver_handle, message);
+	}
 
 	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
 }
 
-typedef struct _ChannelQuitForeachData ChannelQuitForeachData;
-struct _ChannelQuitForeachData {
-	TpHandle handle;
-	const gchar *message;
-};
-
-static void _channel_quit_foreach(TpExportableChannel *channel, gpointer user_data) {
-	IdleMUCChannel *muc_chan = IDLE_MUC_CHANNEL(channel);
-	ChannelQuitForeachData *data = user_data;
-
-	idle_muc_channel_quit(muc_chan, data->handle, data->message);
-}
-
 static IdleParserHandlerResult _quit_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
-	TpChannelManager *manager = TP_CHANNEL_MANAGER(user_data);
+	IdleMUCManagerPrivate *priv = IDLE_MUC_MANAGER_GET_PRIVATE(user_data);
 	TpHandle leaver_handle = g_value_get_uint(g_value_array_get_nth(args, 0));
 	const gchar *message = (args->n_values == 2) ? g_value_get_string(g_value_array_get_nth(args, 1)) : NULL;
-	ChannelQuitForeachData data = {leaver_handle, message};
+	GSList *chans = _contact_rooms_take_channels(priv, leaver_handle);
+
+	for (GSList *l = chans; l != NULL; l = l->next)
+		idle_muc_channel_quit(l->data, leaver_handle, message);
 
-	tp_channel_manager_foreach_channel(manager, _channel_quit_foreach, &data);
+	g_slist_free_full(chans, g_object_unref);
 
 	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 }
@@ -542,6 +647,7 @@ static void _muc_manager_close_all(IdleMUCManager *manager)
 		return;
 	}
 
+	tp_clear_pointer (&priv->contact_rooms, g_hash_table_destroy);
 	tp_clear_pointer (&priv->channels, g_hash_table_destroy);
 }
 
@@ -695,9 +801,10 @@ static void _channel_closed_cb(IdleMUCChannel *chan, gpointer user_data) {
 	if (priv->channels) {
 		TpHandle handle = tp_base_channel_get_target_handle (base);
 
-		if (tp_base_channel_is_destroyed (base))
+		if (tp_base_channel_is_destroyed (base)) {
+			_contact_rooms_forget_room(priv, handle);
 			g_hash_table_remove(priv->channels, GUINT_TO_POINTER(handle));
-		else
+		} else
 			tp_channel_manager_emit_new_channel (manager, TP_EXPORTABLE_CHANNEL (chan),
 				NULL);
 	}
@@ -744,6 +851,8 @@ static void _channel_join_ready_cb(IdleMUCChannel *chan, guint err, gpointer use
 		tp_channel_manager_emit_request_failed(manager, l->data, TP_ERROR, err_code, err_msg);
 	}
 
+	_contact_rooms_forget_room(priv, handle);
+
 	if (priv->channels)
 		g_hash_table_remove(priv->channels, GUINT_TO_POINTER(handle));
 
@@ -18,13 +18,11 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
-/* For strnlen(), which is a GNU extension. */
-#define  _GNU_SOURCE
-
 #include "config.h"
 #include "idle-parser.h"
 
 #include "idle-connection.h"
+#include "idle-isupport.h"
 #include "idle-muc-channel.h"
 
 #include <glib.h>
@@ -65,7 +63,9 @@ struct _MessageSpec {
  * 'I' - ignore token
  * 'r' - token is a room name
  * 'c' - token is a contact (nick)
- * 'C' - token is a contact (nick) with mode characters
+ * 'C' - token is a contact (nick) with any number of mode characters (as
+ *         sent with multi-prefix); yields the handle followed by the string
+ *         of mode characters, which may be empty
  * 'v' - following token is repeated multiple times
  * 's' - token is a string
  * ':' - Consume all remaining tokens as a single string prefixed by ':'
@@ -75,6 +75,7 @@ struct _MessageSpec {
 static const MessageSpec message_specs[] = {
 	{"ERROR", "I:", IDLE_PARSER_CMD_ERROR},
 	{"PING", "Is", IDLE_PARSER_CMD_PING},
+	{"AUTHENTICATE", "Is", IDLE_PARSER_CMD_AUTHENTICATE},
 
 	{"INVITE", "cIcr", IDLE_PARSER_PREFIXCMD_INVITE},
 	{"JOIN", "cIr", IDLE_PARSER_PREFIXCMD_JOIN},
@@ -90,6 +91,15 @@ static const MessageSpec message_specs[] = {
 	{"PRIVMSG", "cIc:", IDLE_PARSER_PREFIXCMD_PRIVMSG_USER},
 	{"QUIT", "cI.", IDLE_PARSER_PREFIXCMD_QUIT},
 	{"TOPIC", "cIr.", IDLE_PARSER_PREFIXCMD_TOPIC},
+	{"CAP", "IIIsvs", IDLE_PARSER_PREFIXCMD_CAP},
+	/* sent when away-notify, account-notify, extended-join and chghost are
+	 * enabled; JOIN's basic spec above matches the extended form, too */
+	{"AWAY", "cI.", IDLE_PARSER_PREFIXCMD_AWAY},
+	{"ACCOUNT", "cIs", IDLE_PARSER_PREFIXCMD_ACCOUNT},
+	{"CHGHOST", "cIss", IDLE_PARSER_PREFIXCMD_CHGHOST},
+	{"JOIN", "cIrs:", IDLE_PARSER_PREFIXCMD_JOIN_EXTENDED},
+	/* some servers send AUTHENTICATE with their name as a prefix */
+	{"AUTHENTICATE", "IIs", IDLE_PARSER_PREFIXCMD_AUTHENTICATE},
 
 	{"301", "IIIc:", IDLE_PARSER_NUMERIC_AWAY},
 	{"475", "IIIr", IDLE_PARSER_NUMERIC_BADCHANNELKEY},
@@ -120,9 +130,23 @@ static const MessageSpec message_specs[] = {
 	{"312", "IIIcs:", IDLE_PARSER_NUMERIC_WHOISSERVER},
 	{"311", "IIIcssI:", IDLE_PARSER_NUMERIC_WHOISUSER},
 	{"317", "IIIcd", IDLE_PARSER_NUMERIC_WHOISIDLE},
-	{"322", "IIIrd.", IDLE_PARSER_NUMERIC_LIST},
+	{"322", "IIIsd.", IDLE_PARSER_NUMERIC_LIST},
 	{"323", "I", IDLE_PARSER_NUMERIC_LISTEND},
+	{"416", "IIIs:", IDLE_PARSER_NUMERIC_QUERYTOOLONG},
 	{"421", "IIIs:", IDLE_PARSER_NUMERIC_UNKNOWNCOMMAND},
+	{"005", "IIIvs", IDLE_PARSER_NUMERIC_ISUPPORT},
+	{"352", "IIIIssIcs:", IDLE_PARSER_NUMERIC_WHOREPLY},
+	/* as requested by WHO <channel> %tcuhnfar,<token> */
+	{"354", "IIIsIsscss:", IDLE_PARSER_NUMERIC_WHOSPCRPL},
+	{"303", "III.", IDLE_PARSER_NUMERIC_ISON},
+	{"730", "III:", IDLE_PARSER_NUMERIC_MONONLINE},
+	{"731", "III:", IDLE_PARSER_NUMERIC_MONOFFLINE},
+	{"734", "IIIIs.", IDLE_PARSER_NUMERIC_MONLISTFULL},
+	{"903", "I", IDLE_PARSER_NUMERIC_SASLSUCCESS},
+	{"904", "I", IDLE_PARSER_NUMERIC_SASLFAIL},
+	{"905", "I", IDLE_PARSER_NUMERIC_SASLTOOLONG},
+	{"906", "I", IDLE_PARSER_NUMERIC_SASLABORTED},
+	{"907", "I", IDLE_PARSER_NUMERIC_SASLALREADY},
 
 	{NULL, NULL, IDLE_PARSER_LAST_MESSAGE_CODE}
 };
@@ -144,20 +168,159 @@ static MessageHandlerClosure *_message_handler_closure_new(IdleParserMessageHand
 	return closure;
 }
 
+/* including the leading '@' and the trailing space */
+#define MAX_TAGS_LEN 8191
+
+/* Raw contact and room tokens, exactly as the server sent them (for contacts
+ * usually the whole nick!user@host prefix), mapped to the handles they
+ * resolved to, so that the same sender in a busy channel doesn't have to be
+ * validated and normalized over and over again. Entries age out in two
+ * generations: once the current one fills up it replaces the previous one,
+ * and hits in the previous one are moved back into the current one. */
+#define HANDLE_CACHE_GENERATION_SIZE 1024
+
+/* Each generation also indexes its tokens by handle, so that forgetting a
+ * contact who changed nick or quit only touches their own tokens. */
+typedef struct _HandleCacheGeneration HandleCacheGeneration;
+struct _HandleCacheGeneration {
+	/* token -> TpHandle; owns the tokens */
+	GHashTable *handles;
+	/* TpHandle -> GSList of the tokens above which map to it */
+	GHashTable *tokens;
+};
+
+typedef struct _HandleCache HandleCache;
+struct _HandleCache {
+	HandleCacheGeneration current;
+	HandleCacheGeneration previous;
+};
+
+static void _handle_cache_generation_init(HandleCacheGeneration *gen) {
+	gen->handles = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	gen->tokens = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) g_slist_free);
+}
+
+static void _handle_cache_generation_destroy(HandleCacheGeneration *gen) {
+	/* the token lists point into handles, so go first */
+	tp_clear_pointer(&gen->tokens, g_hash_table_unref);
+	tp_clear_pointer(&gen->handles, g_hash_table_unref);
+}
+
+/* @key mustn't be in @gen already */
+static void _handle_cache_generation_add(HandleCacheGeneration *gen, const gchar *key, TpHandle handle) {
+	gchar *token = g_strdup(key);
+	GSList *list = g_hash_table_lookup(gen->tokens, GUINT_TO_POINTER(handle));
+
+	g_hash_table_insert(gen->handles, token, GUINT_TO_POINTER(handle));
+
+	g_hash_table_steal(gen->tokens, GUINT_TO_POINTER(handle));
+	g_hash_table_insert(gen->tokens, GUINT_TO_POINTER(handle), g_slist_prepend(list, token));
+}
+
+static void _handle_cache_generation_remove(HandleCacheGeneration *gen, const gchar *key, TpHandle handle) {
+	gpointer token;
+	GSList *list;
+
+	if (!g_hash_table_lookup_extended(gen->handles, key, &token, NULL))
+		return;
+
+	list = g_hash_table_lookup(gen->tokens, GUINT_TO_POINTER(handle));
+	g_hash_table_steal(gen->tokens, GUINT_TO_POINTER(handle));
+	list = g_slist_remove(list, token);
+
+	if (list != NULL)
+		g_hash_table_insert(gen->tokens, GUINT_TO_POINTER(handle), list);
+
+	g_hash_table_remove(gen->handles, token);
+}
+
+static void _handle_cache_generation_forget_handle(HandleCacheGeneration *gen, TpHandle handle) {
+	GSList *list = g_hash_table_lookup(gen->tokens, GUINT_TO_POINTER(handle));
+
+	g_hash_table_steal(gen->tokens, GUINT_TO_POINTER(handle));
+
+	for (GSList *l = list; l != NULL; l = l->next)
+		g_hash_table_remove(gen->handles, l->data);
+
+	g_slist_free(list);
+}
+
+static void _handle_cache_generation_clear(HandleCacheGeneration *gen) {
+	g_hash_table_remove_all(gen->tokens);
+	g_hash_table_remove_all(gen->handles);
+}
+
+static void _handle_cache_init(HandleCache *cache) {
+	_handle_cache_generation_init(&cache->current);
+	_handle_cache_generation_init(&cache->previous);
+}
+
+static void _handle_cache_destroy(HandleCache *cache) {
+	_handle_cache_generation_destroy(&cache->current);
+	_handle_cache_generation_destroy(&cache->previous);
+}
+
+static void _handle_cache_insert(HandleCache *cache, const gchar *key, TpHandle handle) {
+	if (g_hash_table_size(cache->current.handles) >= HANDLE_CACHE_GENERATION_SIZE) {
+		_handle_cache_generation_destroy(&cache->previous);
+		cache->previous = cache->current;
+		_handle_cache_generation_init(&cache->current);
+	}
+
+	_handle_cache_generation_add(&cache->current, key, handle);
+}
+
+static TpHandle _handle_cache_lookup(HandleCache *cache, const gchar *key) {
+	TpHandle handle = GPOINTER_TO_UINT(g_hash_table_lookup(cache->current.handles, key));
+
+	if (handle == 0) {
+		handle = GPOINTER_TO_UINT(g_hash_table_lookup(cache->previous.handles, key));
+
+		if (handle != 0) {
+			_handle_cache_generation_remove(&cache->previous, key, handle);
+			_handle_cache_insert(cache, key, handle);
+		}
+	}
+
+	return handle;
+}
+
+static void _handle_cache_forget_handle(HandleCache *cache, TpHandle handle) {
+	_handle_cache_generation_forget_handle(&cache->current, handle);
+	_handle_cache_generation_forget_handle(&cache->previous, handle);
+}
+
+static void _handle_cache_clear(HandleCache *cache) {
+	_handle_cache_generation_clear(&cache->current);
+	_handle_cache_generation_clear(&cache->previous);
+}
+
 typedef struct _IdleParserPrivate IdleParserPrivate;
 struct _IdleParserPrivate {
 	/* connection object (for handle repos) */
 	IdleConnection *conn;
 
-	/* continuation line buffer */
-	gchar split_buf[IRC_MSG_MAXLEN + 3];
-	guint split_buf_used;
+	/* continuation line buffer, bounded by the server's LINELEN */
+	GString *split_buf;
+	gboolean discarding;
+
+	/* raw token -> TpHandle */
+	HandleCache contact_cache;
+	HandleCache room_cache;
 
 	/* message handlers */
 	GSList *handlers[IDLE_PARSER_LAST_MESSAGE_CODE];
+
+	/* from the server-time tag of the message being handled, or 0 */
+	gint64 server_time;
 };
 
 static void idle_parser_init(IdleParser *obj) {
+	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(obj);
+
+	priv->split_buf = g_string_sized_new(IRC_MSG_MAXLEN + 3);
+	_handle_cache_init(&priv->contact_cache);
+	_handle_cache_init(&priv->room_cache);
 }
 
 static void idle_parser_set_property(GObject *obj, guint prop_id, const GValue *value, GParamSpec *pspec) {
@@ -192,6 +355,12 @@ static void idle_parser_finalize(GObject *obj) {
 
 		g_slist_free(priv->handlers[i]);
 	}
+
+	g_string_free(priv->split_buf, TRUE);
+	_handle_cache_destroy(&priv->contact_cache);
+	_handle_cache_destroy(&priv->room_cache);
+
+	G_OBJECT_CLASS(idle_parser_parent_class)->finalize(obj);
 }
 
 static void idle_parser_class_init(IdleParserClass *klass) {
@@ -213,77 +382,87 @@ static void _parse_message(IdleParser *parser, const gchar *split_msg);
 static void _parse_and_forward_one(IdleParser *parser, gchar **tokens, IdleParserMessageCode code, const gchar *format);
 static gboolean _parse_atom(IdleParser *parser, GValueArray *arr, char atom, const gchar *token, TpHandleSet *contact_reffed, TpHandleSet *room_reffed);
 
-#ifndef HAVE_STRNLEN
-static size_t
-strnlen(const char *msg, size_t maxlen)
-{
-	size_t i;
-
-	for (i=0; i<maxlen; i++)
-		if (msg[i] == '\0')
-			break;
+static void clear_split_buf(IdleParser *parser) {
+	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
 
-	return i;
+	g_string_truncate(priv->split_buf, 0);
 }
-#endif
 
-static void clear_split_buf(IdleParser *parser) {
+/* Append @len bytes of a line to the continuation buffer, unless that would
+ * take it past what the server may legitimately send us, in which case the
+ * rest of the line is dropped up to the next line end. */
+static void append_split_buf(IdleParser *parser, const gchar *msg, gsize len) {
 	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
+	gsize max_len = idle_isupport_get_linelen(idle_connection_get_isupport(priv->conn));
+
+	if (priv->discarding)
+		return;
+
+	/* IRCv3 message tags don't count towards LINELEN */
+	if ((priv->split_buf->len > 0) ? (priv->split_buf->str[0] == '@') : (len > 0 && msg[0] == '@'))
+		max_len += MAX_TAGS_LEN;
+
+	if (priv->split_buf->len + len > max_len) {
+		IDLE_DEBUG("Discarding content that exceeds maximum message length: \"%s%.*s\"", priv->split_buf->str, (int) len, msg);
+		clear_split_buf(parser);
+		priv->discarding = TRUE;
+		return;
+	}
 
-	memset(priv->split_buf, '\0', IRC_MSG_MAXLEN + 3);
-	priv->split_buf_used = 0;
+	g_string_append_len(priv->split_buf, msg, len);
 }
 
 void idle_parser_receive(IdleParser *parser, const gchar *msg) {
 	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
-	guint i;
-	guint lasti = 0;
-	gchar *tmp;
-	gboolean line_ends = FALSE;
-	guint len;
-	gchar concat_buf[2 * (IRC_MSG_MAXLEN + 3)] = {'\0'};
+	const gchar *line = msg;
+	const gchar *iter;
 
 	g_assert(msg != NULL);
 
-	len = strnlen(msg, IRC_MSG_MAXLEN + 3);
+	for (iter = msg; *iter != '\0'; iter++) {
+		if ((*iter != '\n') && (*iter != '\r'))
+			continue;
 
-	for (i = 0; i < len; i++) {
-		if ((msg[i] == '\n' || msg[i] == '\r')) {
-			if (i > lasti) {
-				if ((lasti == 0) && (priv->split_buf[0] != '\0')) {
-					g_strlcpy(g_stpcpy(concat_buf, priv->split_buf), msg, i + 1);
-					tmp = concat_buf;
-					clear_split_buf(parser);
-				} else {
-					tmp = g_strndup(msg + lasti, i - lasti);
-				}
-
-				g_signal_emit(parser, signals[SIGNAL_MSG_SPLIT], 0, tmp);
-				_parse_message(parser, tmp);
-
-				if (tmp != concat_buf)
-					g_free(tmp);
-			}
+		append_split_buf(parser, line, iter - line);
+		line = iter + 1;
 
-			lasti = i + 1;
-			line_ends = TRUE;
-		} else {
-			line_ends = FALSE;
+		if (!priv->discarding && (priv->split_buf->len > 0)) {
+			g_signal_emit(parser, signals[SIGNAL_MSG_SPLIT], 0, priv->split_buf->str);
+			_parse_message(parser, priv->split_buf->str);
 		}
-	}
 
-	if (!line_ends) {
-		len = strlen(msg + lasti);
-		if (len > (IRC_MSG_MAXLEN + 3) - priv->split_buf_used - 1) {
-			IDLE_DEBUG("Discarding content that exceeds maximum message length: \"%s\"", msg + lasti);
-			clear_split_buf(parser);
-		} else {
-			g_strlcpy(priv->split_buf + priv->split_buf_used, msg + lasti, (IRC_MSG_MAXLEN + 3) - priv->split_buf_used);
-			priv->split_buf_used += len;
-		}
-	} else {
 		clear_split_buf(parser);
+		priv->discarding = FALSE;
 	}
+
+	if (*line != '\0')
+		append_split_buf(parser, line, strlen(line));
+}
+
+/* The time the server says the message currently being handled was sent, in
+ * seconds since the Epoch, or 0 if it didn't say. Only meaningful while a
+ * handler is running. */
+gint64 idle_parser_get_server_time(IdleParser *parser) {
+	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
+
+	return priv->server_time;
+}
+
+/* Must be called whenever the way tokens map to handles may have changed,
+ * such as when the server announces a different CASEMAPPING. */
+void idle_parser_invalidate_handle_cache(IdleParser *parser) {
+	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
+
+	_handle_cache_clear(&priv->contact_cache);
+	_handle_cache_clear(&priv->room_cache);
+}
+
+/* Makes the next token resolving to @handle go through the slow path again,
+ * which tells the connection its nick; for when its alias has been evicted. */
+void idle_parser_forget_contact(IdleParser *parser, TpHandle handle) {
+	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
+
+	_handle_cache_forget_handle(&priv->contact_cache, handle);
 }
 
 void idle_parser_add_handler(IdleParser *parser, IdleParserMessageCode code, IdleParserMessageHandler handler, gpointer user_data) {
@@ -306,6 +485,23 @@ void idle_parser_add_handler_with_priority(IdleParser *parser, IdleParserMessage
 	priv->handlers[code] = g_slist_insert_sorted(priv->handlers[code], _message_handler_closure_new(handler, user_data, priority), _message_handler_closure_priority_compare);
 }
 
+void idle_parser_remove_handler(IdleParser *parser, IdleParserMessageCode code, IdleParserMessageHandler handler, gpointer user_data) {
+	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
+
+	if (code >= IDLE_PARSER_LAST_MESSAGE_CODE)
+		return;
+
+	for (GSList *link_ = priv->handlers[code]; link_ != NULL; link_ = link_->next) {
+		MessageHandlerClosure *closure = link_->data;
+
+		if (closure->handler == handler && closure->user_data == user_data) {
+			priv->handlers[code] = g_slist_delete_link(priv->handlers[code], link_);
+			g_slice_free(MessageHandlerClosure, closure);
+			return;
+		}
+	}
+}
+
 static gint _message_handler_closure_user_data_compare(gconstpointer a, gconstpointer b) {
 	const MessageHandlerClosure *_a = a, *_b = b;
 
@@ -363,8 +559,48 @@ static void _free_tokens(gchar **tokens) {
 	g_free(tokens);
 }
 
+/* Picks out the tags we care about from "@key=value;key;..." (without the
+ * leading '@'). Only server-time, so far, and its value never needs
+ * unescaping. */
+static void _parse_tags(IdleParser *parser, const gchar *tags, gsize len) {
+	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
+	gchar *copy = g_strndup(tags, len);
+	gchar **pairs = g_strsplit(copy, ";", -1);
+
+	for (guint i = 0; pairs[i] != NULL; i++) {
+		GTimeVal time_val;
+
+		if (g_str_has_prefix(pairs[i], "time=") && g_time_val_from_iso8601(pairs[i] + strlen("time="), &time_val))
+			priv->server_time = time_val.tv_sec;
+	}
+
+	g_strfreev(pairs);
+	g_free(copy);
+}
+
 static void _parse_message(IdleParser *parser, const gchar *split_msg) {
-	gchar **tokens = _tokenize(split_msg);
+	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
+	gchar **tokens;
+
+	priv->server_time = 0;
+
+	if (split_msg[0] == '@') {
+		const gchar *end = strchr(split_msg, ' ');
+
+		if (end == NULL)
+			return;
+
+		_parse_tags(parser, split_msg + 1, end - split_msg - 1);
+
+		split_msg = end;
+		while (*split_msg == ' ')
+			split_msg++;
+
+		if (*split_msg == '\0')
+			return;
+	}
+
+	tokens = _tokenize(split_msg);
 	IDLE_DEBUG("parsing \"%s\"", split_msg);
 
 	for (int i = 0; i < IDLE_PARSER_LAST_MESSAGE_CODE; i++) {
@@ -384,14 +620,24 @@ static void _parse_message(IdleParser *parser, const gchar *split_msg) {
 
 static void _parse_and_forward_one(IdleParser *parser, gchar **tokens, IdleParserMessageCode code, const gchar *format) {
 	IdleParserPrivate *priv = IDLE_PARSER_GET_PRIVATE(parser);
-	GValueArray *args = g_value_array_new(3);
+	GValueArray *args;
 	GSList *link_ = priv->handlers[code];
 	IdleParserHandlerResult result = IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
 	gboolean success = TRUE;
 	gchar **iter = tokens;
 	/* We keep a ref to each unique handle in a message so that we can unref them after calling all handlers */
-	TpHandleSet *contact_reffed = tp_handle_set_new(tp_base_connection_get_handles(TP_BASE_CONNECTION(priv->conn), TP_HANDLE_TYPE_CONTACT));
-	TpHandleSet *room_reffed = tp_handle_set_new(tp_base_connection_get_handles(TP_BASE_CONNECTION(priv->conn), TP_HANDLE_TYPE_ROOM));
+	TpHandleSet *contact_reffed;
+	TpHandleSet *room_reffed;
+
+	/* Nobody wants this message right now (such as the rest of a LIST reply
+	 * after StopListing), so don't bother turning every token into a handle.
+	 * NICK is the exception: the handle cache has to hear about it. */
+	if (link_ == NULL && code != IDLE_PARSER_PREFIXCMD_NICK)
+		return;
+
+	args = g_value_array_new(3);
+	contact_reffed = tp_handle_set_new(tp_base_connection_get_handles(TP_BASE_CONNECTION(priv->conn), TP_HANDLE_TYPE_CONTACT));
+	room_reffed = tp_handle_set_new(tp_base_connection_get_handles(TP_BASE_CONNECTION(priv->conn), TP_HANDLE_TYPE_ROOM));
 
 	IDLE_DEBUG("message code %u", code);
 
@@ -469,6 +715,20 @@ static void _parse_and_forward_one(IdleParser *parser, gchar **tokens, IdleParse
 
 	IDLE_DEBUG("successfully parsed");
 
+	/* Both the old and the new nickname may be cached under spellings which
+	 * no longer hold (different case, or someone else's nickname entirely);
+	 * dropping them before the handlers run means anything they parse
+	 * afterwards gets resolved afresh. */
+	if (code == IDLE_PARSER_PREFIXCMD_NICK) {
+		_handle_cache_forget_handle(&priv->contact_cache, g_value_get_uint(g_value_array_get_nth(args, 0)));
+		_handle_cache_forget_handle(&priv->contact_cache, g_value_get_uint(g_value_array_get_nth(args, 1)));
+	}
+
+	/* and whoever takes a nick someone has quit with may well spell it
+	 * differently, or come from a different host */
+	if (code == IDLE_PARSER_PREFIXCMD_QUIT)
+		_handle_cache_forget_handle(&priv->contact_cache, g_value_get_uint(g_value_array_get_nth(args, 0)));
+
 	while (link_) {
 		MessageHandlerClosure *closure = link_->data;
 		result = closure->handler(parser, code, args, closure->user_data);
@@ -516,7 +776,8 @@ static gboolean _parse_atom(IdleParser *parser, GValueArray *arr, char atom, con
 		case 'r':
 		case 'C': {
 			gchar *id, *bang = NULL;
-			gchar modechar = '\0';
+			const gchar *modechars = token;
+			gsize n_modechars = 0;
 
 			/* Channel names can start with a '!', so don't strip that
 			 * (https://tools.ietf.org/html/rfc2811#section-3.2), not
@@ -524,9 +785,21 @@ static gboolean _parse_atom(IdleParser *parser, GValueArray *arr, char atom, con
 			 * that ends up for example messing up PRIMSG handling and
 			 * showing the same message as both a channel and a private
 			 * message */
-			if (atom == 'C' && idle_muc_channel_is_modechar(token[0])) {
-				modechar = token[0];
-				token++;
+			if (atom == 'C') {
+				const IdleISupport *isupport = idle_connection_get_isupport(priv->conn);
+
+				while (idle_isupport_is_prefix_char(isupport, token[n_modechars]))
+					n_modechars++;
+
+				token += n_modechars;
+			}
+
+			handle = _handle_cache_lookup((atom == 'r') ? &priv->room_cache : &priv->contact_cache, token);
+
+			if (handle) {
+				IDLE_DEBUG("cached handle for \"%s\"", token);
+				tp_handle_set_add((atom == 'r') ? room_reffed : contact_reffed, handle);
+				goto have_handle;
 			}
 
 			id = g_strdup(token);
@@ -540,12 +813,19 @@ static gboolean _parse_atom(IdleParser *parser, GValueArray *arr, char atom, con
 			if (atom == 'r') {
 				if ((handle = tp_handle_ensure(room_repo, id, NULL, NULL))) {
 					tp_handle_set_add(room_reffed, handle);
+					_handle_cache_insert(&priv->room_cache, token, handle);
 				}
 			} else {
 				if ((handle = tp_handle_ensure(contact_repo, id, NULL, NULL))) {
 					tp_handle_set_add(contact_reffed, handle);
+					_handle_cache_insert(&priv->contact_cache, token, handle);
 
 					idle_connection_canon_nick_receive(priv->conn, handle, id);
+
+					/* nick!user@host, as found in message prefixes and
+					 * (with userhost-in-names) in NAMES replies */
+					if (bang)
+						idle_connection_userhost_receive(priv->conn, handle, bang + 1);
 				}
 			}
 
@@ -554,6 +834,7 @@ static gboolean _parse_atom(IdleParser *parser, GValueArray *arr, char atom, con
 			if (!handle)
 				return FALSE;
 
+have_handle:
 			g_value_init(&val, G_TYPE_UINT);
 			g_value_set_uint(&val, handle);
 			g_value_array_append(arr, &val);
@@ -562,12 +843,12 @@ static gboolean _parse_atom(IdleParser *parser, GValueArray *arr, char atom, con
 			IDLE_DEBUG("set handle %u", handle);
 
 			if (atom == 'C') {
-				g_value_init(&val, G_TYPE_CHAR);
-				g_value_set_schar(&val, modechar);
+				g_value_init(&val, G_TYPE_STRING);
+				g_value_take_string(&val, g_strndup(modechars, n_modechars));
 				g_value_array_append(arr, &val);
 				g_value_unset(&val);
 
-				IDLE_DEBUG("set modechar %c", modechar);
+				IDLE_DEBUG("set modechars \"%.*s\"", (int) n_modechars, modechars);
 			}
 
 			return TRUE;
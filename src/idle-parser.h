@@ -48,8 +48,9 @@ G_BEGIN_DECLS
 typedef enum {
 	IDLE_PARSER_CMD_ERROR = 0,
 	IDLE_PARSER_CMD_PING,
+	IDLE_PARSER_CMD_AUTHENTICATE,
 
-	IDLE_PARSER_LAST_NON_PREFIX_CMD = IDLE_PARSER_CMD_PING,
+	IDLE_PARSER_LAST_NON_PREFIX_CMD = IDLE_PARSER_CMD_AUTHENTICATE,
 
 	IDLE_PARSER_PREFIXCMD_INVITE,
 	IDLE_PARSER_PREFIXCMD_JOIN,
@@ -65,6 +66,12 @@ typedef enum {
 	IDLE_PARSER_PREFIXCMD_PRIVMSG_USER,
 	IDLE_PARSER_PREFIXCMD_QUIT,
 	IDLE_PARSER_PREFIXCMD_TOPIC,
+	IDLE_PARSER_PREFIXCMD_CAP,
+	IDLE_PARSER_PREFIXCMD_AWAY,
+	IDLE_PARSER_PREFIXCMD_ACCOUNT,
+	IDLE_PARSER_PREFIXCMD_CHGHOST,
+	IDLE_PARSER_PREFIXCMD_JOIN_EXTENDED,
+	IDLE_PARSER_PREFIXCMD_AUTHENTICATE,
 
 	IDLE_PARSER_NUMERIC_AWAY,
 	IDLE_PARSER_NUMERIC_BADCHANNELKEY,
@@ -97,7 +104,20 @@ typedef enum {
 	IDLE_PARSER_NUMERIC_WHOISIDLE,
 	IDLE_PARSER_NUMERIC_LIST,
 	IDLE_PARSER_NUMERIC_LISTEND,
+	IDLE_PARSER_NUMERIC_QUERYTOOLONG,
 	IDLE_PARSER_NUMERIC_UNKNOWNCOMMAND,
+	IDLE_PARSER_NUMERIC_ISUPPORT,
+	IDLE_PARSER_NUMERIC_WHOREPLY,
+	IDLE_PARSER_NUMERIC_WHOSPCRPL,
+	IDLE_PARSER_NUMERIC_ISON,
+	IDLE_PARSER_NUMERIC_MONONLINE,
+	IDLE_PARSER_NUMERIC_MONOFFLINE,
+	IDLE_PARSER_NUMERIC_MONLISTFULL,
+	IDLE_PARSER_NUMERIC_SASLSUCCESS,
+	IDLE_PARSER_NUMERIC_SASLFAIL,
+	IDLE_PARSER_NUMERIC_SASLTOOLONG,
+	IDLE_PARSER_NUMERIC_SASLABORTED,
+	IDLE_PARSER_NUMERIC_SASLALREADY,
 
 	IDLE_PARSER_LAST_MESSAGE_CODE
 } IdleParserMessageCode;
@@ -133,7 +153,11 @@ GType idle_parser_get_type(void);
 void idle_parser_receive(IdleParser *parser, const gchar *raw_msg);
 void idle_parser_add_handler(IdleParser *parser, IdleParserMessageCode code, IdleParserMessageHandler handler, gpointer user_data);
 void idle_parser_add_handler_with_priority(IdleParser *parser, IdleParserMessageCode code, IdleParserMessageHandler handler, gpointer user_data, IdleParserHandlerPriority priority);
+void idle_parser_remove_handler(IdleParser *parser, IdleParserMessageCode code, IdleParserMessageHandler handler, gpointer user_data);
 void idle_parser_remove_handlers_by_data(IdleParser *parser, gpointer user_data);
+void idle_parser_invalidate_handle_cache(IdleParser *parser);
+void idle_parser_forget_contact(IdleParser *parser, TpHandle handle);
+gint64 idle_parser_get_server_time(IdleParser *parser);
 
 G_END_DECLS
 
@@ -0,0 +1,582 @@
+/*
+ * This file is part of telepathy-idle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "idle-presence.h"
+
+#include <string.h>
+
+#define IDLE_DEBUG_FLAG IDLE_DEBUG_CONNECTION
+#include "idle-debug.h"
+#include "idle-isupport.h"
+#include "idle-parser.h"
+
+/* Contacts we have an IM channel with are watched: with MONITOR where the
+ * server offers it, otherwise by polling ISON with as many nicks per line as
+ * fit. The poll backs off while nothing changes. */
+
+/* give RPL_ISUPPORT time to tell us about MONITOR before the first poll */
+#define FIRST_POLL_DELAY 2 /* sec */
+#define MIN_POLL_INTERVAL 30 /* sec */
+#define MAX_POLL_INTERVAL 480 /* sec */
+
+/* keep a client with a great many IM channels from turning into a flood */
+#define MAX_WATCHED 1000
+
+/* indices into presence_statuses */
+typedef enum {
+	IDLE_PRESENCE_AVAILABLE,
+	IDLE_PRESENCE_AWAY,
+	IDLE_PRESENCE_OFFLINE,
+	IDLE_PRESENCE_UNKNOWN,
+	IDLE_PRESENCE_LAST
+} IdlePresenceIndex;
+
+static const TpPresenceStatusOptionalArgumentSpec message_args[] = {
+	{"message", "s"},
+	{NULL}
+};
+
+static const TpPresenceStatusSpec presence_statuses[] = {
+	{"available", TP_CONNECTION_PRESENCE_TYPE_AVAILABLE, TRUE, message_args},
+	{"away", TP_CONNECTION_PRESENCE_TYPE_AWAY, TRUE, message_args},
+	{"offline", TP_CONNECTION_PRESENCE_TYPE_OFFLINE, FALSE, NULL},
+	{"unknown", TP_CONNECTION_PRESENCE_TYPE_UNKNOWN, FALSE, NULL},
+	{NULL}
+};
+
+struct _IdlePresenceState {
+	/* watched TpHandle -> GUINT_TO_POINTER(IdlePresenceIndex) */
+	GHashTable *statuses;
+	/* TpHandle -> gchar *, for the watched contacts who are away with a
+	 * message, as told by away-notify */
+	GHashTable *away_messages;
+
+	IdlePresenceIndex self_status;
+	gchar *self_message;
+
+	/* TRUE once the first poll has decided between MONITOR and ISON */
+	gboolean started;
+	gboolean monitoring;
+
+	guint poll_id;
+	guint poll_interval;
+	/* GArrays of the TpHandles in each ISON we're awaiting a reply to */
+	GQueue *ison_batches;
+	/* whether anyone's status changed during the current ISON round */
+	gboolean round_changed;
+};
+
+static IdlePresenceState *_get_state(IdleConnection *conn) {
+	return conn->presence_state;
+}
+
+static TpPresenceStatus *_make_status(IdlePresenceIndex index, const gchar *message) {
+	TpPresenceStatus *status;
+	GHashTable *args = NULL;
+
+	if (message != NULL && *message != '\0')
+		args = tp_asv_new("message", G_TYPE_STRING, message, NULL);
+
+	status = tp_presence_status_new(index, args);
+
+	if (args != NULL)
+		g_hash_table_unref(args);
+
+	return status;
+}
+
+/* message is only kept for IDLE_PRESENCE_AWAY */
+static void _set_status(IdleConnection *conn, TpHandle handle, IdlePresenceIndex index, const gchar *message) {
+	IdlePresenceState *state = _get_state(conn);
+	gpointer old;
+	const gchar *old_message;
+	TpPresenceStatus *status;
+
+	if (!g_hash_table_lookup_extended(state->statuses, GUINT_TO_POINTER(handle), NULL, &old))
+		return;
+
+	if (index != IDLE_PRESENCE_AWAY)
+		message = NULL;
+
+	old_message = g_hash_table_lookup(state->away_messages, GUINT_TO_POINTER(handle));
+	if (GPOINTER_TO_UINT(old) == index && !tp_strdiff(old_message, message))
+		return;
+
+	g_hash_table_insert(state->statuses, GUINT_TO_POINTER(handle), GUINT_TO_POINTER(index));
+	if (message != NULL)
+		g_hash_table_insert(state->away_messages, GUINT_TO_POINTER(handle), g_strdup(message));
+	else
+		g_hash_table_remove(state->away_messages, GUINT_TO_POINTER(handle));
+
+	if (GPOINTER_TO_UINT(old) != index)
+		state->round_changed = TRUE;
+
+	status = _make_status(index, message);
+	tp_presence_mixin_emit_one_presence_update((GObject *) conn, handle, status);
+	tp_presence_status_free(status);
+}
+
+/* Sends "<command><nick><separator><nick>..." in as few lines as LINELEN
+ * allows. If batches is not NULL, the handles on each line are pushed onto it
+ * as a GArray. */
+static void _send_batched(IdleConnection *conn, const gchar *command, gchar separator, const GArray *handles, GQueue *batches) {
+	TpHandleRepoIface *contact_handles = tp_base_connection_get_handles(TP_BASE_CONNECTION(conn), TP_HANDLE_TYPE_CONTACT);
+	gsize max_len = idle_isupport_get_linelen(idle_connection_get_isupport(conn)) - 2;
+	gsize command_len = strlen(command);
+	GString *line = g_string_new(command);
+	GArray *batch = NULL;
+	guint i;
+
+	for (i = 0; i < handles->len; i++) {
+		TpHandle handle = g_array_index(handles, TpHandle, i);
+		const gchar *nick = tp_handle_inspect(contact_handles, handle);
+
+		if (line->len > command_len && line->len + 1 + strlen(nick) > max_len) {
+			idle_connection_send_background(conn, line->str);
+			g_string_truncate(line, command_len);
+
+			if (batches != NULL) {
+				g_queue_push_tail(batches, batch);
+				batch = NULL;
+			}
+		}
+
+		if (line->len > command_len)
+			g_string_append_c(line, separator);
+		g_string_append(line, nick);
+
+		if (batches != NULL) {
+			if (batch == NULL)
+				batch = g_array_new(FALSE, FALSE, sizeof(TpHandle));
+			g_array_append_val(batch, handle);
+		}
+	}
+
+	if (line->len > command_len) {
+		idle_connection_send_background(conn, line->str);
+
+		if (batches != NULL)
+			g_queue_push_tail(batches, batch);
+	}
+
+	g_string_free(line, TRUE);
+}
+
+static GArray *_watched_handles(IdlePresenceState *state) {
+	GArray *handles = g_array_sized_new(FALSE, FALSE, sizeof(TpHandle), g_hash_table_size(state->statuses));
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, state->statuses);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		TpHandle handle = GPOINTER_TO_UINT(key);
+		g_array_append_val(handles, handle);
+	}
+
+	return handles;
+}
+
+static gboolean _poll_cb(gpointer user_data);
+
+static void _schedule_poll(IdleConnection *conn, guint delay) {
+	IdlePresenceState *state = _get_state(conn);
+
+	if (state->poll_id == 0)
+		state->poll_id = g_timeout_add_seconds(delay, _poll_cb, conn);
+}
+
+static gboolean _poll_cb(gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	IdlePresenceState *state = _get_state(conn);
+	GArray *handles;
+
+	state->poll_id = 0;
+
+	if (!state->started) {
+		state->started = TRUE;
+		state->monitoring = (idle_isupport_get_monitor(idle_connection_get_isupport(conn)) > 0);
+		IDLE_DEBUG("tracking presence with %s", state->monitoring ? "MONITOR" : "ISON");
+	}
+
+	if (g_hash_table_size(state->statuses) == 0)
+		return FALSE;
+
+	handles = _watched_handles(state);
+
+	if (state->monitoring) {
+		/* from here on the server tells us about changes */
+		_send_batched(conn, "MONITOR + ", ',', handles, NULL);
+	} else if (g_queue_is_empty(state->ison_batches)) {
+		state->round_changed = FALSE;
+		_send_batched(conn, "ISON ", ' ', handles, state->ison_batches);
+	}
+
+	g_array_free(handles, TRUE);
+
+	return FALSE;
+}
+
+void idle_presence_watch(IdleConnection *conn, TpHandle handle) {
+	IdlePresenceState *state = _get_state(conn);
+	GArray *handles;
+
+	if (handle == tp_base_connection_get_self_handle(TP_BASE_CONNECTION(conn)))
+		return;
+
+	if (g_hash_table_lookup_extended(state->statuses, GUINT_TO_POINTER(handle), NULL, NULL))
+		return;
+
+	if (g_hash_table_size(state->statuses) >= MAX_WATCHED) {
+		IDLE_DEBUG("already watching %u contacts, not watching %u", MAX_WATCHED, handle);
+		return;
+	}
+
+	g_hash_table_insert(state->statuses, GUINT_TO_POINTER(handle), GUINT_TO_POINTER(IDLE_PRESENCE_UNKNOWN));
+
+	if (!state->started || tp_base_connection_get_status(TP_BASE_CONNECTION(conn)) != TP_CONNECTION_STATUS_CONNECTED)
+		return;
+
+	handles = g_array_sized_new(FALSE, FALSE, sizeof(TpHandle), 1);
+	g_array_append_val(handles, handle);
+
+	/* rather than leave them unknown until the next poll, ask now; and since
+	 * it's new, start backing off afresh */
+	if (state->monitoring) {
+		_send_batched(conn, "MONITOR + ", ',', handles, NULL);
+	} else {
+		_send_batched(conn, "ISON ", ' ', handles, state->ison_batches);
+		state->poll_interval = MIN_POLL_INTERVAL;
+	}
+
+	g_array_free(handles, TRUE);
+}
+
+void idle_presence_unwatch(IdleConnection *conn, TpHandle handle) {
+	IdlePresenceState *state = _get_state(conn);
+	GArray *handles;
+
+	if (!g_hash_table_remove(state->statuses, GUINT_TO_POINTER(handle)))
+		return;
+
+	g_hash_table_remove(state->away_messages, GUINT_TO_POINTER(handle));
+
+	if (!state->monitoring || tp_base_connection_get_status(TP_BASE_CONNECTION(conn)) != TP_CONNECTION_STATUS_CONNECTED)
+		return;
+
+	handles = g_array_sized_new(FALSE, FALSE, sizeof(TpHandle), 1);
+	g_array_append_val(handles, handle);
+	_send_batched(conn, "MONITOR - ", ',', handles, NULL);
+	g_array_free(handles, TRUE);
+}
+
+static TpHandleSet *_parse_nick_list(IdleConnection *conn, const gchar *list, const gchar *delimiters) {
+	TpHandleRepoIface *contact_handles = tp_base_connection_get_handles(TP_BASE_CONNECTION(conn), TP_HANDLE_TYPE_CONTACT);
+	TpHandleSet *handles = tp_handle_set_new(contact_handles);
+	gchar **nicks = g_strsplit_set(list, delimiters, -1);
+	guint i;
+
+	for (i = 0; nicks[i] != NULL; i++) {
+		gchar *bang = strchr(nicks[i], '!');
+		TpHandle handle;
+
+		/* MONITOR replies may carry nick!user@host */
+		if (bang != NULL)
+			*bang = '\0';
+
+		if (*nicks[i] == '\0')
+			continue;
+
+		handle = tp_handle_ensure(contact_handles, nicks[i], NULL, NULL);
+		if (handle != 0)
+			tp_handle_set_add(handles, handle);
+	}
+
+	g_strfreev(nicks);
+
+	return handles;
+}
+
+static void _online(IdleConnection *conn, TpHandle handle) {
+	IdlePresenceState *state = _get_state(conn);
+	gpointer old = g_hash_table_lookup(state->statuses, GUINT_TO_POINTER(handle));
+
+	/* ISON and MONITOR only tell us they're connected, not whether they are
+	 * away, so don't forget what we might have learned elsewhere */
+	if (GPOINTER_TO_UINT(old) != IDLE_PRESENCE_AWAY)
+		_set_status(conn, handle, IDLE_PRESENCE_AVAILABLE, NULL);
+}
+
+static IdleParserHandlerResult _ison_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	IdlePresenceState *state = _get_state(conn);
+	GArray *batch = g_queue_pop_head(state->ison_batches);
+	TpHandleSet *online;
+	guint i;
+
+	if (batch == NULL)
+		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+
+	/* nobody at all being online leaves the trailing parameter empty */
+	online = _parse_nick_list(conn, (args->n_values > 0) ? g_value_get_string(g_value_array_get_nth(args, 0)) : "", " ");
+
+	for (i = 0; i < batch->len; i++) {
+		TpHandle handle = g_array_index(batch, TpHandle, i);
+
+		if (tp_handle_set_is_member(online, handle))
+			_online(conn, handle);
+		else
+			_set_status(conn, handle, IDLE_PRESENCE_OFFLINE, NULL);
+	}
+
+	tp_handle_set_destroy(online);
+	g_array_free(batch, TRUE);
+
+	/* end of the round: poll again soon if things are moving, otherwise
+	 * less and less often */
+	if (g_queue_is_empty(state->ison_batches)) {
+		if (state->round_changed)
+			state->poll_interval = MIN_POLL_INTERVAL;
+		else
+			state->poll_interval = MIN(state->poll_interval * 2, MAX_POLL_INTERVAL);
+
+		_schedule_poll(conn, state->poll_interval);
+	}
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+static IdleParserHandlerResult _mon_online_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	TpHandleSet *online = _parse_nick_list(conn, g_value_get_string(g_value_array_get_nth(args, 0)), ",");
+	TpIntsetFastIter iter;
+	TpHandle handle;
+
+	tp_intset_fast_iter_init(&iter, tp_handle_set_peek(online));
+	while (tp_intset_fast_iter_next(&iter, &handle))
+		_online(conn, handle);
+
+	tp_handle_set_destroy(online);
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+static IdleParserHandlerResult _mon_offline_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	TpHandleSet *offline = _parse_nick_list(conn, g_value_get_string(g_value_array_get_nth(args, 0)), ",");
+	TpIntsetFastIter iter;
+	TpHandle handle;
+
+	tp_intset_fast_iter_init(&iter, tp_handle_set_peek(offline));
+	while (tp_intset_fast_iter_next(&iter, &handle))
+		_set_status(conn, handle, IDLE_PRESENCE_OFFLINE, NULL);
+
+	tp_handle_set_destroy(offline);
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+static IdleParserHandlerResult _mon_list_full_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	/* those contacts simply stay unknown */
+	IDLE_DEBUG("MONITOR list is full, not watching %s", g_value_get_string(g_value_array_get_nth(args, 0)));
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+static IdleParserHandlerResult _quit_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+
+	_set_status(conn, g_value_get_uint(g_value_array_get_nth(args, 0)), IDLE_PRESENCE_OFFLINE, NULL);
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
+/* with away-notify, the server tells us whenever someone we share a channel
+ * with goes away or comes back, so they need no polling to stay current */
+static IdleParserHandlerResult _away_notify_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	TpHandle handle = g_value_get_uint(g_value_array_get_nth(args, 0));
+
+	if (args->n_values > 1)
+		_set_status(conn, handle, IDLE_PRESENCE_AWAY, g_value_get_string(g_value_array_get_nth(args, 1)));
+	else
+		_set_status(conn, handle, IDLE_PRESENCE_AVAILABLE, NULL);
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
+static IdleParserHandlerResult _join_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+
+	_online(conn, g_value_get_uint(g_value_array_get_nth(args, 0)));
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
+static void _stop(IdleConnection *conn) {
+	IdlePresenceState *state = _get_state(conn);
+	GArray *batch;
+
+	if (state->poll_id != 0) {
+		g_source_remove(state->poll_id);
+		state->poll_id = 0;
+	}
+
+	while ((batch = g_queue_pop_head(state->ison_batches)) != NULL)
+		g_array_free(batch, TRUE);
+
+	state->started = FALSE;
+	state->monitoring = FALSE;
+}
+
+static void _status_changed_cb(IdleConnection *conn, guint status, guint reason, gpointer user_data) {
+	IdlePresenceState *state = _get_state(conn);
+
+	switch (status) {
+		case TP_CONNECTION_STATUS_CONNECTED:
+			state->poll_interval = MIN_POLL_INTERVAL;
+			_schedule_poll(conn, FIRST_POLL_DELAY);
+			break;
+
+		case TP_CONNECTION_STATUS_DISCONNECTED:
+			_stop(conn);
+			break;
+
+		default:
+			break;
+	}
+}
+
+static gboolean _status_available(GObject *object, guint index) {
+	return tp_base_connection_get_status(TP_BASE_CONNECTION(object)) == TP_CONNECTION_STATUS_CONNECTED;
+}
+
+static GHashTable *_get_contact_statuses(GObject *object, const GArray *contacts, GError **error) {
+	IdleConnection *conn = IDLE_CONNECTION(object);
+	IdlePresenceState *state = _get_state(conn);
+	TpHandle self_handle = tp_base_connection_get_self_handle(TP_BASE_CONNECTION(conn));
+	GHashTable *result = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) tp_presence_status_free);
+	guint i;
+
+	for (i = 0; i < contacts->len; i++) {
+		TpHandle handle = g_array_index(contacts, TpHandle, i);
+		TpPresenceStatus *status;
+
+		if (handle == self_handle) {
+			status = _make_status(state->self_status, state->self_message);
+		} else {
+			gpointer index;
+
+			if (!g_hash_table_lookup_extended(state->statuses, GUINT_TO_POINTER(handle), NULL, &index))
+				index = GUINT_TO_POINTER(IDLE_PRESENCE_UNKNOWN);
+
+			status = _make_status(GPOINTER_TO_UINT(index), g_hash_table_lookup(state->away_messages, GUINT_TO_POINTER(handle)));
+		}
+
+		g_hash_table_insert(result, GUINT_TO_POINTER(handle), status);
+	}
+
+	return result;
+}
+
+static gboolean _set_own_status(GObject *object, const TpPresenceStatus *status, GError **error) {
+	IdleConnection *conn = IDLE_CONNECTION(object);
+	IdlePresenceState *state = _get_state(conn);
+	IdlePresenceIndex index = IDLE_PRESENCE_AVAILABLE;
+	const gchar *message = NULL;
+	TpPresenceStatus *new_status;
+	gchar cmd[IRC_MSG_MAXLEN + 1];
+
+	if (status != NULL) {
+		index = status->index;
+
+		if (status->optional_arguments != NULL)
+			message = tp_asv_get_string(status->optional_arguments, "message");
+	}
+
+	if (index == IDLE_PRESENCE_AWAY) {
+		/* the server won't mark us away without a message */
+		if (message == NULL || *message == '\0')
+			message = "Away";
+
+		g_snprintf(cmd, IRC_MSG_MAXLEN + 1, "AWAY :%s", message);
+	} else {
+		g_strlcpy(cmd, "AWAY", IRC_MSG_MAXLEN + 1);
+	}
+
+	idle_connection_send(conn, cmd);
+
+	g_free(state->self_message);
+	state->self_message = g_strdup(message);
+	state->self_status = index;
+
+	new_status = _make_status(index, message);
+	tp_presence_mixin_emit_one_presence_update(object, tp_base_connection_get_self_handle(TP_BASE_CONNECTION(conn)), new_status);
+	tp_presence_status_free(new_status);
+
+	return TRUE;
+}
+
+void idle_presence_class_init(IdleConnectionClass *klass) {
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	tp_presence_mixin_class_init(object_class, G_STRUCT_OFFSET(IdleConnectionClass, presence),
+		_status_available, _get_contact_statuses, _set_own_status, presence_statuses);
+	tp_presence_mixin_simple_presence_init_dbus_properties(object_class);
+}
+
+void idle_presence_init(IdleConnection *conn) {
+	IdlePresenceState *state = g_slice_new0(IdlePresenceState);
+
+	state->statuses = g_hash_table_new(NULL, NULL);
+	state->away_messages = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+	state->self_status = IDLE_PRESENCE_AVAILABLE;
+	state->poll_interval = MIN_POLL_INTERVAL;
+	state->ison_batches = g_queue_new();
+	conn->presence_state = state;
+
+	tp_presence_mixin_init((GObject *) conn, G_STRUCT_OFFSET(IdleConnection, presence));
+	tp_presence_mixin_simple_presence_register_with_contacts_mixin((GObject *) conn);
+
+	g_signal_connect(conn, "status-changed", G_CALLBACK(_status_changed_cb), NULL);
+
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_ISON, _ison_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_MONONLINE, _mon_online_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_MONOFFLINE, _mon_offline_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_MONLISTFULL, _mon_list_full_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_QUIT, _quit_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_PREFIXCMD_AWAY, _away_notify_handler, conn);
+	/* the MUC manager's JOIN handler claims the message, so ours goes first */
+	idle_parser_add_handler_with_priority(conn->parser, IDLE_PARSER_PREFIXCMD_JOIN, _join_handler, conn, IDLE_PARSER_HANDLER_PRIORITY_FIRST);
+}
+
+void idle_presence_dispose(IdleConnection *conn) {
+	_stop(conn);
+}
+
+void idle_presence_finalize(GObject *object) {
+	IdleConnection *conn = IDLE_CONNECTION(object);
+	IdlePresenceState *state = _get_state(conn);
+
+	tp_presence_mixin_finalize(object);
+
+	g_hash_table_unref(state->statuses);
+	g_hash_table_unref(state->away_messages);
+	g_queue_free(state->ison_batches);
+	g_free(state->self_message);
+	g_slice_free(IdlePresenceState, state);
+}
@@ -0,0 +1,386 @@
+/*
+ * This file is part of telepathy-idle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "idle-room-directory.h"
+
+#include <string.h>
+
+typedef struct {
+	/* offsets into the directory's strings; the key is the name folded by
+	 * the server's CASEMAPPING, and is usually the name itself */
+	guint32 name;
+	guint32 key;
+	guint32 topic;
+	guint members;
+} RoomEntry;
+
+struct _IdleRoomDirectory {
+	/* every distinct name and topic, NUL-terminated, back to back; topics
+	 * repeat a lot ("", "Welcome!", ...) so this is much smaller than the
+	 * LIST reply it came from */
+	gchar *strings;
+	gsize strings_len;
+	gsize strings_size;
+	/* open-addressed set of (offset + 1) into strings; 0 is an empty slot */
+	guint32 *interned;
+	guint interned_size;
+	guint n_interned;
+
+	RoomEntry *rooms;
+	guint n_rooms;
+	guint rooms_size;
+	/* open-addressed map from key offset to (index + 1) into rooms; since
+	 * keys are interned, comparing offsets is comparing folded names */
+	guint32 *by_name;
+	guint by_name_size;
+	IdleCaseMapping casemapping;
+
+	gboolean complete;
+	gint64 completed_at;
+};
+
+/* both tables are powers of two, and kept at most half full */
+#define MIN_TABLE_SIZE 64
+#define NO_OFFSET G_MAXUINT32
+/* names shorter than this are folded without allocating */
+#define FOLD_BUFFER_SIZE 256
+
+static void _init(IdleRoomDirectory *dir) {
+	dir->interned_size = MIN_TABLE_SIZE;
+	dir->interned = g_new0(guint32, dir->interned_size);
+	dir->by_name_size = MIN_TABLE_SIZE;
+	dir->by_name = g_new0(guint32, dir->by_name_size);
+}
+
+static void _fini(IdleRoomDirectory *dir) {
+	IdleCaseMapping casemapping = dir->casemapping;
+
+	g_free(dir->strings);
+	g_free(dir->interned);
+	g_free(dir->rooms);
+	g_free(dir->by_name);
+	memset(dir, 0, sizeof(*dir));
+	dir->casemapping = casemapping;
+}
+
+IdleRoomDirectory *idle_room_directory_new(void) {
+	IdleRoomDirectory *dir = g_slice_new0(IdleRoomDirectory);
+
+	_init(dir);
+
+	return dir;
+}
+
+void idle_room_directory_free(IdleRoomDirectory *dir) {
+	if (dir == NULL)
+		return;
+
+	_fini(dir);
+	g_slice_free(IdleRoomDirectory, dir);
+}
+
+void idle_room_directory_clear(IdleRoomDirectory *dir) {
+	_fini(dir);
+	_init(dir);
+}
+
+/* Rooms are looked up the way the server compares their names. A listing
+ * keyed by another mapping is thrown away: the server sends CASEMAPPING
+ * straight after registering, long before anyone is likely to have asked
+ * for the list. */
+void idle_room_directory_set_casemapping(IdleRoomDirectory *dir, IdleCaseMapping mapping) {
+	if (dir->casemapping == mapping)
+		return;
+
+	idle_room_directory_clear(dir);
+	dir->casemapping = mapping;
+}
+
+/* folds @name into @buf if it fits, or into a new string which the caller
+ * frees */
+static gchar *_fold(const IdleRoomDirectory *dir, const gchar *name, gchar *buf) {
+	gsize len;
+	gchar *folded;
+
+	if (dir->casemapping == IDLE_CASEMAPPING_OTHER)
+		return g_utf8_strdown(name, -1);
+
+	len = strlen(name);
+	folded = (len < FOLD_BUFFER_SIZE) ? buf : g_malloc(len + 1);
+	idle_casemap_fold(dir->casemapping, name, folded, len);
+	folded[len] = '\0';
+
+	return folded;
+}
+
+static void _free_folded(gchar *folded, gchar *buf) {
+	if (folded != buf)
+		g_free(folded);
+}
+
+static guint _string_slot(const IdleRoomDirectory *dir, const gchar *str) {
+	guint mask = dir->interned_size - 1;
+	guint i = g_str_hash(str) & mask;
+
+	while (dir->interned[i] != 0 && strcmp(dir->strings + dir->interned[i] - 1, str))
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+static void _grow_interned(IdleRoomDirectory *dir) {
+	guint32 *old = dir->interned;
+	guint old_size = dir->interned_size;
+
+	dir->interned_size *= 2;
+	dir->interned = g_new0(guint32, dir->interned_size);
+
+	for (guint i = 0; i < old_size; i++) {
+		if (old[i] != 0)
+			dir->interned[_string_slot(dir, dir->strings + old[i] - 1)] = old[i];
+	}
+
+	g_free(old);
+}
+
+static guint32 _intern(IdleRoomDirectory *dir, const gchar *str) {
+	guint i = _string_slot(dir, str);
+	gsize len;
+	guint32 offset;
+
+	if (dir->interned[i] != 0)
+		return dir->interned[i] - 1;
+
+	len = strlen(str) + 1;
+	if (dir->strings_len + len >= NO_OFFSET)
+		return NO_OFFSET;
+
+	if (dir->strings_len + len > dir->strings_size) {
+		dir->strings_size = MAX(dir->strings_size * 2, dir->strings_len + len);
+		dir->strings = g_realloc(dir->strings, dir->strings_size);
+	}
+
+	offset = dir->strings_len;
+	memcpy(dir->strings + offset, str, len);
+	dir->strings_len += len;
+
+	dir->interned[i] = offset + 1;
+	if (++dir->n_interned * 2 > dir->interned_size)
+		_grow_interned(dir);
+
+	return offset;
+}
+
+static guint _room_slot(const IdleRoomDirectory *dir, guint32 key) {
+	guint mask = dir->by_name_size - 1;
+	guint i = ((key ^ (key >> 15)) * 2654435761u) & mask;
+
+	while (dir->by_name[i] != 0 && dir->rooms[dir->by_name[i] - 1].key != key)
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+static void _grow_by_name(IdleRoomDirectory *dir) {
+	g_free(dir->by_name);
+	dir->by_name_size *= 2;
+	dir->by_name = g_new0(guint32, dir->by_name_size);
+
+	for (guint i = 0; i < dir->n_rooms; i++)
+		dir->by_name[_room_slot(dir, dir->rooms[i].key)] = i + 1;
+}
+
+void idle_room_directory_add(IdleRoomDirectory *dir, const gchar *name, guint members, const gchar *topic) {
+	gchar buf[FOLD_BUFFER_SIZE];
+	gchar *folded = _fold(dir, name, buf);
+	guint32 name_offset = _intern(dir, name);
+	guint32 key_offset = _intern(dir, folded);
+	guint32 topic_offset = _intern(dir, (topic != NULL) ? topic : "");
+	RoomEntry *entry;
+	guint i;
+
+	_free_folded(folded, buf);
+
+	if (name_offset == NO_OFFSET || key_offset == NO_OFFSET || topic_offset == NO_OFFSET)
+		return;
+
+	i = _room_slot(dir, key_offset);
+
+	if (dir->by_name[i] != 0) {
+		entry = &dir->rooms[dir->by_name[i] - 1];
+	} else {
+		if (dir->n_rooms == dir->rooms_size) {
+			dir->rooms_size = MAX(dir->rooms_size * 2, MIN_TABLE_SIZE);
+			dir->rooms = g_renew(RoomEntry, dir->rooms, dir->rooms_size);
+		}
+
+		entry = &dir->rooms[dir->n_rooms++];
+		entry->key = key_offset;
+		dir->by_name[i] = dir->n_rooms;
+
+		if (dir->n_rooms * 2 > dir->by_name_size)
+			_grow_by_name(dir);
+	}
+
+	entry->name = name_offset;
+	entry->topic = topic_offset;
+	entry->members = members;
+}
+
+/* marks the directory as holding the whole list, as of @now (monotonic) */
+void idle_room_directory_set_complete(IdleRoomDirectory *dir, gint64 now) {
+	dir->complete = TRUE;
+	dir->completed_at = now;
+}
+
+gboolean idle_room_directory_is_fresh(const IdleRoomDirectory *dir, gint64 now, gint64 max_age) {
+	return dir->complete && (now - dir->completed_at) < max_age;
+}
+
+guint idle_room_directory_get_size(const IdleRoomDirectory *dir) {
+	return dir->n_rooms;
+}
+
+/* returns the index of the room called @name, in any case the server's
+ * CASEMAPPING considers the same, or -1 */
+gint idle_room_directory_lookup(const IdleRoomDirectory *dir, const gchar *name) {
+	gchar buf[FOLD_BUFFER_SIZE];
+	gchar *folded = _fold(dir, name, buf);
+	guint i = _string_slot(dir, folded);
+	guint j;
+
+	_free_folded(folded, buf);
+
+	if (dir->interned[i] == 0)
+		return -1;
+
+	j = _room_slot(dir, dir->interned[i] - 1);
+
+	return (gint) dir->by_name[j] - 1;
+}
+
+void idle_room_directory_get(const IdleRoomDirectory *dir, guint i, const gchar **name, guint *members, const gchar **topic) {
+	const RoomEntry *entry;
+
+	g_return_if_fail(i < dir->n_rooms);
+
+	entry = &dir->rooms[i];
+
+	if (name != NULL)
+		*name = dir->strings + entry->name;
+
+	if (members != NULL)
+		*members = entry->members;
+
+	if (topic != NULL)
+		*topic = dir->strings + entry->topic;
+}
+
+gsize idle_room_directory_get_bytes(const IdleRoomDirectory *dir) {
+	return sizeof(*dir) + dir->strings_size +
+		(dir->interned_size + dir->by_name_size) * sizeof(guint32) +
+		dir->rooms_size * sizeof(RoomEntry);
+}
+
+/* IRC-style glob: '*' matches any string and '?' any one character, ignoring
+ * (ASCII) case */
+gboolean idle_mask_match(const gchar *mask, const gchar *str) {
+	const gchar *star = NULL;
+	const gchar *resume = NULL;
+
+	while (*str != '\0') {
+		if (*mask == '*') {
+			star = mask++;
+			resume = str;
+		} else if (*mask == '?' || (*mask != '\0' && g_ascii_tolower(*mask) == g_ascii_tolower(*str))) {
+			mask++;
+			str++;
+		} else if (star != NULL) {
+			/* let the last '*' swallow one more character, and retry */
+			mask = star + 1;
+			str = ++resume;
+		} else {
+			return FALSE;
+		}
+	}
+
+	while (*mask == '*')
+		mask++;
+
+	return *mask == '\0';
+}
+
+static gboolean _mask_is_empty(const gchar *mask) {
+	return mask == NULL || *mask == '\0';
+}
+
+gboolean idle_room_filter_is_empty(const IdleRoomFilter *filter) {
+	return _mask_is_empty(filter->name_mask) && filter->min_members == 0 &&
+		filter->max_members == 0 && _mask_is_empty(filter->topic_mask);
+}
+
+gboolean idle_room_filter_matches(const IdleRoomFilter *filter, const gchar *name, guint members, const gchar *topic) {
+	if (members < filter->min_members)
+		return FALSE;
+
+	if (filter->max_members != 0 && members > filter->max_members)
+		return FALSE;
+
+	if (!_mask_is_empty(filter->name_mask) && !idle_mask_match(filter->name_mask, name))
+		return FALSE;
+
+	if (!_mask_is_empty(filter->topic_mask) && !idle_mask_match(filter->topic_mask, (topic != NULL) ? topic : ""))
+		return FALSE;
+
+	return TRUE;
+}
+
+/* Builds a LIST asking the server to do as much of @filter as @elist says it
+ * can. Whatever is left for us to check on each RPL_LIST is stored in
+ * @residual, which borrows @filter's strings. */
+gchar *idle_room_filter_to_list_command(const IdleRoomFilter *filter, IdleEListFlags elist, IdleRoomFilter *residual) {
+	GString *cmd = g_string_new("LIST");
+	gchar sep = ' ';
+
+	*residual = *filter;
+
+	if (elist & IDLE_ELIST_USER_COUNT) {
+		if (filter->min_members > 0) {
+			g_string_append_printf(cmd, "%c>%u", sep, filter->min_members - 1);
+			sep = ',';
+			residual->min_members = 0;
+		}
+
+		if (filter->max_members > 0 && filter->max_members < G_MAXUINT) {
+			g_string_append_printf(cmd, "%c<%u", sep, filter->max_members + 1);
+			sep = ',';
+			residual->max_members = 0;
+		}
+	}
+
+	/* any server takes a plain channel name; only ELIST=M ones take masks.
+	 * Topic masks have no ELIST token at all. */
+	if (!_mask_is_empty(filter->name_mask) && strpbrk(filter->name_mask, ", ") == NULL &&
+			((elist & IDLE_ELIST_MASK) || strpbrk(filter->name_mask, "*?") == NULL)) {
+		g_string_append_c(cmd, sep);
+		g_string_append(cmd, filter->name_mask);
+		residual->name_mask = NULL;
+	}
+
+	return g_string_free(cmd, FALSE);
+}
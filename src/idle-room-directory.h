@@ -0,0 +1,64 @@
+/*
+ * This file is part of telepathy-idle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __IDLE_ROOM_DIRECTORY_H__
+#define __IDLE_ROOM_DIRECTORY_H__
+
+#include <glib.h>
+
+#include "idle-isupport.h"
+
+G_BEGIN_DECLS
+
+/* The server's channel list as last returned by LIST: name, member count and
+ * topic of each room. Every distinct string is stored once, in a single
+ * buffer, and rooms can be looked up by name, folded by the server's
+ * CASEMAPPING. */
+typedef struct _IdleRoomDirectory IdleRoomDirectory;
+
+IdleRoomDirectory *idle_room_directory_new(void);
+void idle_room_directory_free(IdleRoomDirectory *dir);
+
+void idle_room_directory_clear(IdleRoomDirectory *dir);
+void idle_room_directory_set_casemapping(IdleRoomDirectory *dir, IdleCaseMapping mapping);
+void idle_room_directory_add(IdleRoomDirectory *dir, const gchar *name, guint members, const gchar *topic);
+void idle_room_directory_set_complete(IdleRoomDirectory *dir, gint64 now);
+gboolean idle_room_directory_is_fresh(const IdleRoomDirectory *dir, gint64 now, gint64 max_age);
+
+guint idle_room_directory_get_size(const IdleRoomDirectory *dir);
+gint idle_room_directory_lookup(const IdleRoomDirectory *dir, const gchar *name);
+void idle_room_directory_get(const IdleRoomDirectory *dir, guint i, const gchar **name, guint *members, const gchar **topic);
+gsize idle_room_directory_get_bytes(const IdleRoomDirectory *dir);
+
+/* Which rooms a listing should return. A NULL or empty mask, or a bound of
+ * 0, doesn't restrict anything. The strings are not owned by the filter. */
+typedef struct {
+	gchar *name_mask;
+	guint min_members;
+	guint max_members;
+	gchar *topic_mask;
+} IdleRoomFilter;
+
+gboolean idle_mask_match(const gchar *mask, const gchar *str);
+
+gboolean idle_room_filter_is_empty(const IdleRoomFilter *filter);
+gboolean idle_room_filter_matches(const IdleRoomFilter *filter, const gchar *name, guint members, const gchar *topic);
+gchar *idle_room_filter_to_list_command(const IdleRoomFilter *filter, IdleEListFlags elist, IdleRoomFilter *residual);
+
+G_END_DECLS
+
+#endif /* #ifndef __IDLE_ROOM_DIRECTORY_H__ */
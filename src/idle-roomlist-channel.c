@@ -23,6 +23,7 @@
 #include "config.h"
 #include "idle-roomlist-channel.h"
 
+#include <string.h>
 #include <time.h>
 
 #include <dbus/dbus-glib.h>
@@ -31,28 +32,69 @@
 #define IDLE_DEBUG_FLAG IDLE_DEBUG_ROOMLIST
 #include "idle-connection.h"
 #include "idle-debug.h"
+#include "idle-handles.h"
 #include "idle-text.h"
 
+#include "extensions/extensions.h"
+
 static void idle_roomlist_channel_close (TpBaseChannel *channel);
 static void _roomlist_iface_init (gpointer, gpointer);
 static void connection_status_changed_cb (IdleConnection* conn, guint status, guint reason, IdleRoomlistChannel *self);
 static IdleParserHandlerResult _rpl_list_handler (IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
 static IdleParserHandlerResult _rpl_listend_handler (IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
+static IdleParserHandlerResult _list_error_handler (IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data);
+static void list_cached_rooms (IdleRoomlistChannel *self, IdleRoomDirectory *dir, const IdleRoomFilter *filter);
+static void set_receiving (IdleRoomlistChannel *self, gboolean receiving);
+static void clear_pending_rooms (IdleRoomlistChannel *self);
+static void emit_room_signal (IdleRoomlistChannel *self);
+static gboolean _got_rooms_timeout_cb (gpointer user_data);
 
 G_DEFINE_TYPE_WITH_CODE (IdleRoomlistChannel, idle_roomlist_channel,
     TP_TYPE_BASE_CHANNEL,
     G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_CHANNEL_TYPE_ROOM_LIST, _roomlist_iface_init);
+    G_IMPLEMENT_INTERFACE (IDLE_TYPE_SVC_CHANNEL_INTERFACE_ROOM_LIST_FILTER1, NULL);
     )
 
+/* Rooms are passed on in GotRooms as they arrive rather than all at the end
+ * of the LIST: as soon as this many are waiting, or this long after the first
+ * of them came in, whichever is sooner. That gets the first results to the
+ * client quickly, and keeps each signal (and what we hold on to) small. */
+#define GOT_ROOMS_MAX_BATCH 100
+#define GOT_ROOMS_MAX_LATENCY_MS 100
+
+/* properties */
+enum {
+  PROP_NAME_MASK = 1,
+  PROP_MIN_MEMBERS,
+  PROP_MAX_MEMBERS,
+  PROP_TOPIC_MASK,
+  LAST_PROPERTY_ENUM
+};
+
 /* private structure */
 struct _IdleRoomlistChannelPrivate
 {
   IdleConnection *connection;
 
+  /* RoomInfo structs waiting to be sent in GotRooms */
   GPtrArray *rooms;
-  TpHandleSet *handles;
+  /* sends them once they've waited GOT_ROOMS_MAX_LATENCY_MS */
+  guint timer_source_id;
+
+  /* what the next ListRooms should return */
+  IdleRoomFilter filter;
 
   gboolean listing;
+  /* TRUE if the LIST we're waiting on will refill the room directory */
+  gboolean filling_directory;
+  /* the part of the filter the server isn't doing for us on this LIST; owns
+   * its strings */
+  IdleRoomFilter residual;
+  /* TRUE while we want RPL_LIST; the rest of the time the parser doesn't
+   * even look at them */
+  gboolean receiving;
+  /* how many LIST replies we've given up on, but are still coming in */
+  guint lists_to_drop;
   gboolean closed;
   int status_changed_id;
 
@@ -69,6 +111,26 @@ idle_roomlist_channel_init (IdleRoomlistChannel *self)
 static void idle_roomlist_channel_dispose (GObject *object);
 static void idle_roomlist_channel_finalize (GObject *object);
 
+/* takes copies of @residual's strings; NULL means no filtering */
+static void
+set_residual_filter (IdleRoomlistChannel *self,
+                     const IdleRoomFilter *residual)
+{
+  IdleRoomlistChannelPrivate *priv = self->priv;
+
+  g_free (priv->residual.name_mask);
+  g_free (priv->residual.topic_mask);
+  memset (&priv->residual, 0, sizeof (priv->residual));
+
+  if (residual == NULL)
+    return;
+
+  priv->residual.name_mask = g_strdup (residual->name_mask);
+  priv->residual.min_members = residual->min_members;
+  priv->residual.max_members = residual->max_members;
+  priv->residual.topic_mask = g_strdup (residual->topic_mask);
+}
+
 static void
 idle_roomlist_channel_constructed (GObject *obj)
 {
@@ -85,14 +147,84 @@ idle_roomlist_channel_constructed (GObject *obj)
   priv->status_changed_id = g_signal_connect (priv->connection,
       "status-changed", (GCallback) connection_status_changed_cb,
       obj);
-  idle_parser_add_handler (priv->connection->parser, IDLE_PARSER_NUMERIC_LIST,
-      _rpl_list_handler, obj);
   idle_parser_add_handler (priv->connection->parser,
       IDLE_PARSER_NUMERIC_LISTEND, _rpl_listend_handler, obj);
+  idle_parser_add_handler (priv->connection->parser,
+      IDLE_PARSER_NUMERIC_TRYAGAIN, _list_error_handler, obj);
+  idle_parser_add_handler (priv->connection->parser,
+      IDLE_PARSER_NUMERIC_QUERYTOOLONG, _list_error_handler, obj);
 
   priv->rooms = g_ptr_array_new ();
-  priv->handles = tp_handle_set_new(tp_base_connection_get_handles (
-     TP_BASE_CONNECTION(priv->connection), TP_HANDLE_TYPE_ROOM));
+}
+
+static void
+idle_roomlist_channel_get_property (GObject *object,
+                                    guint property_id,
+                                    GValue *value,
+                                    GParamSpec *pspec)
+{
+  IdleRoomlistChannel *self = IDLE_ROOMLIST_CHANNEL (object);
+  IdleRoomlistChannelPrivate *priv = self->priv;
+
+  switch (property_id)
+    {
+      case PROP_NAME_MASK:
+        g_value_set_string (value,
+            priv->filter.name_mask != NULL ? priv->filter.name_mask : "");
+        break;
+
+      case PROP_MIN_MEMBERS:
+        g_value_set_uint (value, priv->filter.min_members);
+        break;
+
+      case PROP_MAX_MEMBERS:
+        g_value_set_uint (value, priv->filter.max_members);
+        break;
+
+      case PROP_TOPIC_MASK:
+        g_value_set_string (value,
+            priv->filter.topic_mask != NULL ? priv->filter.topic_mask : "");
+        break;
+
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+idle_roomlist_channel_set_property (GObject *object,
+                                    guint property_id,
+                                    const GValue *value,
+                                    GParamSpec *pspec)
+{
+  IdleRoomlistChannel *self = IDLE_ROOMLIST_CHANNEL (object);
+  IdleRoomlistChannelPrivate *priv = self->priv;
+
+  switch (property_id)
+    {
+      case PROP_NAME_MASK:
+        g_free (priv->filter.name_mask);
+        priv->filter.name_mask = g_value_dup_string (value);
+        break;
+
+      case PROP_MIN_MEMBERS:
+        priv->filter.min_members = g_value_get_uint (value);
+        break;
+
+      case PROP_MAX_MEMBERS:
+        priv->filter.max_members = g_value_get_uint (value);
+        break;
+
+      case PROP_TOPIC_MASK:
+        g_free (priv->filter.topic_mask);
+        priv->filter.topic_mask = g_value_dup_string (value);
+        break;
+
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
 }
 
 static gchar *
@@ -131,20 +263,42 @@ idle_roomlist_channel_fill_properties (
       NULL);
 }
 
+static GPtrArray *
+idle_roomlist_channel_get_interfaces (TpBaseChannel *chan)
+{
+  GPtrArray *interfaces =
+    TP_BASE_CHANNEL_CLASS (idle_roomlist_channel_parent_class)->get_interfaces (
+        chan);
+
+  g_ptr_array_add (interfaces, IDLE_IFACE_CHANNEL_INTERFACE_ROOM_LIST_FILTER1);
+
+  return interfaces;
+}
+
 static void
 idle_roomlist_channel_class_init (IdleRoomlistChannelClass *idle_roomlist_channel_class)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (idle_roomlist_channel_class);
   TpBaseChannelClass *base_channel_class = TP_BASE_CHANNEL_CLASS (idle_roomlist_channel_class);
+  GParamSpec *param_spec;
   static TpDBusPropertiesMixinPropImpl roomlist_props[] = {
       { "Server", NULL, NULL },
       { NULL }
   };
+  static TpDBusPropertiesMixinPropImpl filter_props[] = {
+      { "NameMask", "name-mask", "name-mask" },
+      { "MinMembers", "min-members", "min-members" },
+      { "MaxMembers", "max-members", "max-members" },
+      { "TopicMask", "topic-mask", "topic-mask" },
+      { NULL }
+  };
 
 
   g_type_class_add_private (idle_roomlist_channel_class, sizeof (IdleRoomlistChannelPrivate));
 
   object_class->constructed = idle_roomlist_channel_constructed;
+  object_class->get_property = idle_roomlist_channel_get_property;
+  object_class->set_property = idle_roomlist_channel_set_property;
   object_class->dispose = idle_roomlist_channel_dispose;
   object_class->finalize = idle_roomlist_channel_finalize;
 
@@ -153,12 +307,38 @@ idle_roomlist_channel_class_init (IdleRoomlistChannelClass *idle_roomlist_channe
   base_channel_class->close = idle_roomlist_channel_close;
   base_channel_class->fill_immutable_properties = idle_roomlist_channel_fill_properties;
   base_channel_class->get_object_path_suffix = idle_roomlist_channel_get_path_suffix;
+  base_channel_class->get_interfaces = idle_roomlist_channel_get_interfaces;
+
+  param_spec = g_param_spec_string ("name-mask", "RoomListFilter1.NameMask",
+      "Only list rooms whose name matches this mask",
+      "", G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_NAME_MASK, param_spec);
+
+  param_spec = g_param_spec_uint ("min-members", "RoomListFilter1.MinMembers",
+      "Only list rooms with at least this many members",
+      0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_MIN_MEMBERS, param_spec);
+
+  param_spec = g_param_spec_uint ("max-members", "RoomListFilter1.MaxMembers",
+      "Only list rooms with at most this many members, or 0 for no limit",
+      0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_MAX_MEMBERS, param_spec);
+
+  param_spec = g_param_spec_string ("topic-mask", "RoomListFilter1.TopicMask",
+      "Only list rooms whose topic matches this mask",
+      "", G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_TOPIC_MASK, param_spec);
 
   tp_dbus_properties_mixin_implement_interface (object_class,
       TP_IFACE_QUARK_CHANNEL_TYPE_ROOM_LIST,
       idle_roomlist_channel_get_roomlist_property,
       NULL,
       roomlist_props);
+  tp_dbus_properties_mixin_implement_interface (object_class,
+      g_quark_from_static_string (IDLE_IFACE_CHANNEL_INTERFACE_ROOM_LIST_FILTER1),
+      tp_dbus_properties_mixin_getter_gobject_properties,
+      tp_dbus_properties_mixin_setter_gobject_properties,
+      filter_props);
 }
 
 
@@ -183,6 +363,7 @@ idle_roomlist_channel_dispose (GObject *object)
 
   if (priv->rooms)
     {
+      clear_pending_rooms (self);
       g_ptr_array_free (priv->rooms, TRUE);
       priv->rooms = NULL;
     }
@@ -198,10 +379,9 @@ idle_roomlist_channel_finalize (GObject *object)
   IdleRoomlistChannel *self = IDLE_ROOMLIST_CHANNEL (object);
   IdleRoomlistChannelPrivate *priv = self->priv;
 
-  if (priv->handles)
-    {
-      tp_handle_set_destroy (priv->handles);
-    }
+  g_free (priv->filter.name_mask);
+  g_free (priv->filter.topic_mask);
+  set_residual_filter (self, NULL);
 
   G_OBJECT_CLASS (idle_roomlist_channel_parent_class)->finalize (object);
 }
@@ -214,6 +394,8 @@ idle_roomlist_channel_close (TpBaseChannel *channel)
   IdleRoomlistChannelPrivate *priv = self->priv;
 
   idle_parser_remove_handlers_by_data (priv->connection->parser, channel);
+  priv->receiving = FALSE;
+  clear_pending_rooms (self);
   tp_base_channel_destroyed (channel);
 }
 
@@ -248,11 +430,56 @@ idle_roomlist_channel_list_rooms (TpSvcChannelTypeRoomList *iface,
 {
   IdleRoomlistChannel *self = IDLE_ROOMLIST_CHANNEL (iface);
   IdleRoomlistChannelPrivate *priv = self->priv;
+  IdleRoomDirectory *dir =
+    idle_connection_get_room_directory (priv->connection);
+  gint64 ttl = (gint64) idle_connection_get_room_list_ttl (priv->connection)
+    * G_USEC_PER_SEC;
+
+  if (priv->listing)
+    {
+      /* the rooms are already on their way */
+      tp_svc_channel_type_room_list_return_from_list_rooms (context);
+      return;
+    }
 
   priv->listing = TRUE;
   tp_svc_channel_type_room_list_emit_listing_rooms (iface, TRUE);
 
-  idle_connection_send(priv->connection, "LIST");
+  if (idle_room_directory_is_fresh (dir, g_get_monotonic_time (), ttl))
+    {
+      tp_svc_channel_type_room_list_return_from_list_rooms (context);
+      list_cached_rooms (self, dir, &priv->filter);
+      return;
+    }
+
+  if (idle_room_filter_is_empty (&priv->filter))
+    {
+      /* the whole list: worth keeping for next time */
+      set_residual_filter (self, NULL);
+      idle_room_directory_clear (dir);
+      priv->filling_directory = TRUE;
+
+      idle_connection_send(priv->connection, "LIST");
+    }
+  else
+    {
+      IdleRoomFilter residual;
+      gchar *cmd = idle_room_filter_to_list_command (&priv->filter,
+          idle_isupport_get_elist (
+              idle_connection_get_isupport (priv->connection)),
+          &residual);
+
+      set_residual_filter (self, &residual);
+      priv->filling_directory = FALSE;
+
+      idle_connection_send (priv->connection, cmd);
+      g_free (cmd);
+    }
+
+  /* if we're still throwing away the reply to a LIST we stopped, ours
+   * starts after its RPL_LISTEND */
+  if (priv->lists_to_drop == 0)
+    set_receiving (self, TRUE);
 
   tp_svc_channel_type_room_list_return_from_list_rooms (context);
 }
@@ -268,20 +495,26 @@ idle_roomlist_channel_stop_listing (TpSvcChannelTypeRoomList *iface,
                                     DBusGMethodInvocation *context)
 {
   IdleRoomlistChannel *self = IDLE_ROOMLIST_CHANNEL (iface);
-  GError error = { TP_ERROR, TP_ERROR_NOT_IMPLEMENTED, "Can't stop listing!" };
-
-  g_assert (IDLE_IS_ROOMLIST_CHANNEL (self));
-
-  dbus_g_method_return_error (context, &error);
-
-  /*
-  priv->listing = FALSE;
-  tp_svc_channel_type_room_list_emit_listing_rooms (iface, FALSE);
+  IdleRoomlistChannelPrivate *priv = self->priv;
 
-  stop_listing (self);
+  if (priv->listing)
+    {
+      /* there's no way to tell the server to stop, so the rest of the reply
+       * is dropped as it arrives */
+      IDLE_DEBUG ("dropping the rest of the LIST reply");
+      priv->lists_to_drop++;
+      set_receiving (self, FALSE);
+      clear_pending_rooms (self);
+
+      /* a partial list is no use to anyone */
+      priv->filling_directory = FALSE;
+      set_residual_filter (self, NULL);
+
+      priv->listing = FALSE;
+      tp_svc_channel_type_room_list_emit_listing_rooms (iface, FALSE);
+    }
 
   tp_svc_channel_type_room_list_return_from_stop_listing (context);
-  */
 }
 
 
@@ -301,32 +534,29 @@ _roomlist_iface_init (gpointer g_iface,
 }
 
 
-static IdleParserHandlerResult
-_rpl_list_handler (IdleParser *parser,
-                   IdleParserMessageCode code,
-                   GValueArray *args,
-                   gpointer user_data)
+/* Listed rooms don't get handles: a LIST can name tens of thousands of them,
+ * so the client gets each one's identifier, and only the rooms it goes on to
+ * request get a handle. */
+static void
+add_room (IdleRoomlistChannel *self,
+          const gchar *room_name,
+          guint num_users,
+          const gchar *topic)
 {
-  IdleRoomlistChannel* self = IDLE_ROOMLIST_CHANNEL (user_data);
   IdleRoomlistChannelPrivate *priv = self->priv;
   GValue room = {0,};
   GHashTable *keys;
+  gchar *handle_name = idle_normalize_channel_name (
+      idle_connection_get_isupport (priv->connection), room_name, NULL);
 
-  TpHandle room_handle = g_value_get_uint (g_value_array_get_nth (args, 0));
-  TpHandleRepoIface *handl_repo =
-    tp_base_connection_get_handles(TP_BASE_CONNECTION(priv->connection),
-        TP_HANDLE_TYPE_ROOM);
-  const gchar *room_name = tp_handle_inspect(handl_repo, room_handle);
-  guint num_users = g_value_get_uint (g_value_array_get_nth (args, 1));
-  /* topic is optional */
-  const gchar *topic = "";
-  if (args->n_values > 2)
+  if (handle_name == NULL)
     {
-      topic = g_value_get_string (g_value_array_get_nth (args, 2));
+      IDLE_DEBUG ("ignoring invalid room name \"%s\"", room_name);
+      return;
     }
 
   keys = tp_asv_new (
-      "handle-name", G_TYPE_STRING, room_name,
+      "handle-name", G_TYPE_STRING, handle_name,
       "name", G_TYPE_STRING, room_name,
       "members", G_TYPE_UINT, num_users,
       "subject", G_TYPE_STRING, topic,
@@ -337,43 +567,211 @@ _rpl_list_handler (IdleParser *parser,
       dbus_g_type_specialized_construct (TP_STRUCT_TYPE_ROOM_INFO));
 
   dbus_g_type_struct_set (&room,
-      0, room_handle,
+      0, 0,
       1, TP_IFACE_CHANNEL_TYPE_TEXT,
       2, keys,
       G_MAXUINT);
 
   IDLE_DEBUG ("adding new room signal data to pending: %s", room_name);
   g_ptr_array_add (priv->rooms, g_value_get_boxed (&room));
-  /* retain a ref to the room handle */
-  tp_handle_set_add (priv->handles, room_handle);
   g_hash_table_destroy (keys);
+  g_free (handle_name);
+
+  if (priv->rooms->len >= GOT_ROOMS_MAX_BATCH)
+    emit_room_signal (self);
+  else if (priv->timer_source_id == 0)
+    priv->timer_source_id = g_timeout_add (GOT_ROOMS_MAX_LATENCY_MS,
+        _got_rooms_timeout_cb, self);
+}
+
+
+static IdleParserHandlerResult
+_rpl_list_handler (IdleParser *parser,
+                   IdleParserMessageCode code,
+                   GValueArray *args,
+                   gpointer user_data)
+{
+  IdleRoomlistChannel* self = IDLE_ROOMLIST_CHANNEL (user_data);
+  IdleRoomlistChannelPrivate *priv = self->priv;
+
+  const gchar *room_name = g_value_get_string (g_value_array_get_nth (args, 0));
+  guint num_users = g_value_get_uint (g_value_array_get_nth (args, 1));
+  /* topic is optional */
+  const gchar *topic = "";
+  if (args->n_values > 2)
+    {
+      topic = g_value_get_string (g_value_array_get_nth (args, 2));
+    }
+
+  if (priv->filling_directory)
+    idle_room_directory_add (
+        idle_connection_get_room_directory (priv->connection),
+        room_name, num_users, topic);
+
+  if (idle_room_filter_matches (&priv->residual, room_name, num_users, topic))
+    add_room (self, room_name, num_users, topic);
 
   return IDLE_PARSER_HANDLER_RESULT_HANDLED;
 }
 
 
-static gboolean
+static void
+set_receiving (IdleRoomlistChannel *self,
+               gboolean receiving)
+{
+  IdleRoomlistChannelPrivate *priv = self->priv;
+
+  if (priv->receiving == receiving)
+    return;
+
+  priv->receiving = receiving;
+
+  if (receiving)
+    idle_parser_add_handler (priv->connection->parser,
+        IDLE_PARSER_NUMERIC_LIST, _rpl_list_handler, self);
+  else
+    idle_parser_remove_handler (priv->connection->parser,
+        IDLE_PARSER_NUMERIC_LIST, _rpl_list_handler, self);
+}
+
+static void
+clear_pending_rooms (IdleRoomlistChannel *self)
+{
+  IdleRoomlistChannelPrivate *priv = self->priv;
+
+  if (priv->timer_source_id != 0)
+    {
+      g_source_remove (priv->timer_source_id);
+      priv->timer_source_id = 0;
+    }
+
+  for (guint i = 0; i < priv->rooms->len; i++)
+    g_boxed_free (TP_STRUCT_TYPE_ROOM_INFO, g_ptr_array_index (priv->rooms, i));
+
+  g_ptr_array_set_size (priv->rooms, 0);
+}
+
+static void
 emit_room_signal (IdleRoomlistChannel *self)
 {
   IdleRoomlistChannelPrivate *priv = self->priv;
 
-  if (!priv->listing)
-      return FALSE;
+  if (priv->rooms->len > 0)
+    tp_svc_channel_type_room_list_emit_got_rooms (
+        (TpSvcChannelTypeRoomList *) self, priv->rooms);
+
+  clear_pending_rooms (self);
+}
+
+static gboolean
+_got_rooms_timeout_cb (gpointer user_data)
+{
+  IdleRoomlistChannel *self = IDLE_ROOMLIST_CHANNEL (user_data);
+
+  self->priv->timer_source_id = 0;
+  emit_room_signal (self);
+
+  return FALSE;
+}
+
+static void
+finish_listing (IdleRoomlistChannel *self)
+{
+  IdleRoomlistChannelPrivate *priv = self->priv;
 
-  if (priv->rooms->len == 0)
-      return TRUE;
+  emit_room_signal (self);
 
-  tp_svc_channel_type_room_list_emit_got_rooms (
-      (TpSvcChannelTypeRoomList *) self, priv->rooms);
+  priv->listing = FALSE;
+  tp_svc_channel_type_room_list_emit_listing_rooms (
+      (TpSvcChannelTypeRoomList *) self, FALSE);
+}
 
-  while (priv->rooms->len != 0)
+/* answers ListRooms from what the last LIST told us */
+static void
+list_cached_rooms (IdleRoomlistChannel *self,
+                   IdleRoomDirectory *dir,
+                   const IdleRoomFilter *filter)
+{
+  guint n_rooms = idle_room_directory_get_size (dir);
+
+  if (!tp_str_empty (filter->name_mask) &&
+      strpbrk (filter->name_mask, "*?") == NULL)
+    {
+      /* a single room, which the directory finds without looking at the
+       * others, and compares by CASEMAPPING rather than by ASCII */
+      IdleRoomFilter rest = *filter;
+      gint i = idle_room_directory_lookup (dir, filter->name_mask);
+
+      IDLE_DEBUG ("answering for %s from the cache", filter->name_mask);
+
+      rest.name_mask = NULL;
+
+      if (i >= 0)
+        {
+          const gchar *room_name, *topic;
+          guint num_users;
+
+          idle_room_directory_get (dir, i, &room_name, &num_users, &topic);
+
+          if (idle_room_filter_matches (&rest, room_name, num_users, topic))
+            add_room (self, room_name, num_users, topic);
+        }
+
+      finish_listing (self);
+      return;
+    }
+
+  IDLE_DEBUG ("answering from the %u cached rooms", n_rooms);
+
+  for (guint i = 0; i < n_rooms; i++)
     {
-      gpointer boxed = g_ptr_array_index (priv->rooms, 0);
-      g_boxed_free (TP_STRUCT_TYPE_ROOM_INFO, boxed);
-      g_ptr_array_remove_index_fast (priv->rooms, 0);
+      const gchar *room_name, *topic;
+      guint num_users;
+
+      idle_room_directory_get (dir, i, &room_name, &num_users, &topic);
+
+      if (!idle_room_filter_matches (filter, room_name, num_users, topic))
+        continue;
+
+      add_room (self, room_name, num_users, topic);
     }
 
-  return TRUE;
+  finish_listing (self);
+}
+
+/* the server has finished with a LIST; if it says the reply was cut short,
+ * the rooms we got aren't the whole directory */
+static void
+end_of_list (IdleRoomlistChannel *self,
+             gboolean complete)
+{
+  IdleRoomlistChannelPrivate *priv = self->priv;
+
+  if (priv->lists_to_drop > 0)
+    {
+      /* the end of a reply we'd stopped listening to */
+      priv->lists_to_drop--;
+
+      if (priv->lists_to_drop == 0 && priv->listing)
+        set_receiving (self, TRUE);
+
+      return;
+    }
+
+  if (!priv->listing)
+    return;
+
+  set_receiving (self, FALSE);
+
+  if (priv->filling_directory && complete)
+    {
+      idle_room_directory_set_complete (
+          idle_connection_get_room_directory (priv->connection),
+          g_get_monotonic_time ());
+    }
+
+  priv->filling_directory = FALSE;
+  finish_listing (self);
 }
 
 static IdleParserHandlerResult
@@ -382,18 +780,29 @@ _rpl_listend_handler (IdleParser *parser,
                       GValueArray *args,
                       gpointer user_data)
 {
-  IdleRoomlistChannel* self = IDLE_ROOMLIST_CHANNEL (user_data);
-  IdleRoomlistChannelPrivate *priv = self->priv;
-  emit_room_signal (self);
+  end_of_list (IDLE_ROOMLIST_CHANNEL (user_data), TRUE);
 
-  priv->listing = FALSE;
-  tp_svc_channel_type_room_list_emit_listing_rooms (
-      (TpSvcChannelTypeRoomList *) self, FALSE);
+  return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+/* RPL_TRYAGAIN and ERR_QUERYTOOLONG end a LIST without an RPL_LISTEND, so
+ * they have to be counted off too, or every later reply would be dropped */
+static IdleParserHandlerResult
+_list_error_handler (IdleParser *parser,
+                     IdleParserMessageCode code,
+                     GValueArray *args,
+                     gpointer user_data)
+{
+  IdleRoomlistChannel *self = IDLE_ROOMLIST_CHANNEL (user_data);
+  const gchar *command = g_value_get_string (g_value_array_get_nth (args, 0));
+
+  if (g_ascii_strcasecmp (command, "LIST"))
+    return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+
+  IDLE_DEBUG ("LIST failed: %s",
+      g_value_get_string (g_value_array_get_nth (args, 1)));
 
-  /*
-  g_source_remove (priv->timer_source_id);
-  priv->timer_source_id = 0;
-  */
+  end_of_list (self, FALSE);
 
   return IDLE_PARSER_HANDLER_RESULT_HANDLED;
 }
@@ -410,6 +819,7 @@ connection_status_changed_cb (IdleConnection* conn,
   if (status == TP_CONNECTION_STATUS_DISCONNECTED)
     {
       idle_parser_remove_handlers_by_data (conn->parser, self);
+      priv->receiving = FALSE;
       if (priv->status_changed_id != 0)
         {
           g_signal_handler_disconnect (conn, priv->status_changed_id);
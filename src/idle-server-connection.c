@@ -63,7 +63,8 @@ struct _IdleServerConnectionPrivate {
 	guint16 port;
 
 	gchar input_buffer[IRC_MSG_MAXLEN + 3];
-	gchar output_buffer[IRC_MSG_MAXLEN + 2]; /* No need for a trailing '\0' */
+	/* what's being written, which may be several lines */
+	GBytes *output_bytes;
 	gsize count;
 	gsize nwritten;
 
@@ -77,6 +78,8 @@ struct _IdleServerConnectionPrivate {
 	IdleServerConnectionState state;
 	IdleServerTLSManager *tls_manager;
 	GAsyncQueue *certificate_queue;
+	/* presented to the server during the TLS handshake, if not NULL */
+	GTlsCertificate *client_certificate;
 };
 
 static GObject *idle_server_connection_constructor(GType type, guint n_props, GObjectConstructParam *props);
@@ -111,6 +114,7 @@ static void idle_server_connection_dispose(GObject *obj) {
         g_clear_object (&priv->io_stream);
         g_clear_object (&priv->tls_manager);
         g_clear_object (&priv->read_cancellable);
+        g_clear_object (&priv->client_certificate);
 }
 
 static void idle_server_connection_finalize(GObject *obj) {
@@ -119,6 +123,9 @@ static void idle_server_connection_finalize(GObject *obj) {
 
 	g_async_queue_unref (priv->certificate_queue);
 	g_free(priv->host);
+
+	if (priv->output_bytes != NULL)
+		g_bytes_unref(priv->output_bytes);
 }
 
 static void idle_server_connection_get_property(GObject 	*obj, guint prop_id, GValue *value, GParamSpec *pspec) {
@@ -378,9 +385,14 @@ static gboolean _accept_certificate_request (GTlsConnection *tls_connection, GTl
 
 static void _connect_event_cb (GSocketClient *client, GSocketClientEvent event, GSocketConnectable *connectable, GIOStream *connection, gpointer user_data)
 {
+	IdleServerConnectionPrivate *priv = IDLE_SERVER_CONNECTION_GET_PRIVATE(user_data);
+
 	if (event != G_SOCKET_CLIENT_TLS_HANDSHAKING)
 		return;
 
+	if (priv->client_certificate != NULL)
+		g_tls_connection_set_certificate(G_TLS_CONNECTION(connection), priv->client_certificate);
+
 	g_signal_connect (connection, "accept-certificate", G_CALLBACK (_accept_certificate_request), user_data);
 }
 
@@ -553,7 +565,7 @@ static void _write_ready(GObject *source_object, GAsyncResult *res, gpointer use
 
 	priv->nwritten += nwrite;
 	if (priv->nwritten < priv->count) {
-		g_output_stream_write_async(output_stream, priv->output_buffer + priv->nwritten, priv->count - priv->nwritten, G_PRIORITY_DEFAULT, priv->cancellable, _write_ready, result);
+		g_output_stream_write_async(output_stream, (const gchar *) g_bytes_get_data(priv->output_bytes, NULL) + priv->nwritten, priv->count - priv->nwritten, G_PRIORITY_DEFAULT, priv->cancellable, _write_ready, result);
 		return;
 	}
 
@@ -562,15 +574,19 @@ cleanup:
 		g_object_unref(priv->cancellable);
 		priv->cancellable = NULL;
 	}
+	if (priv->output_bytes != NULL) {
+		g_bytes_unref(priv->output_bytes);
+		priv->output_bytes = NULL;
+	}
 	g_simple_async_result_complete(result);
 	g_object_unref(result);
 }
 
-void idle_server_connection_send_async(IdleServerConnection *conn, const gchar *cmd, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data) {
+/* @data is written out as it is, without being copied */
+void idle_server_connection_send_async(IdleServerConnection *conn, GBytes *data, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data) {
 	IdleServerConnectionPrivate *priv = IDLE_SERVER_CONNECTION_GET_PRIVATE(conn);
 	GOutputStream *output_stream;
 	GSimpleAsyncResult *result;
-	gsize output_buffer_size = sizeof(priv->output_buffer);
 
 	if (priv->state != SERVER_CONNECTION_STATE_CONNECTED
             || priv->io_stream == NULL) {
@@ -582,19 +598,11 @@ void idle_server_connection_send_async(IdleServerConnection *conn, const gchar *
 		return;
 	}
 
-	priv->count = strlen(cmd);
-	if (priv->count > output_buffer_size)
-		priv->count = output_buffer_size;
-
-	/* We only need to copy priv->count bytes, but padding the rest
-         * with null bytes gives us cleaner debug messages, without
-         * affecting the readability of the code.
-         */
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wstringop-truncation"
-	strncpy(priv->output_buffer, cmd, output_buffer_size);
-#pragma GCC diagnostic pop
+	if (priv->output_bytes != NULL)
+		g_bytes_unref(priv->output_bytes);
 
+	priv->output_bytes = g_bytes_ref(data);
+	priv->count = g_bytes_get_size(data);
 	priv->nwritten = 0;
 
 	if (cancellable != NULL) {
@@ -604,9 +612,9 @@ void idle_server_connection_send_async(IdleServerConnection *conn, const gchar *
 
 	output_stream = g_io_stream_get_output_stream(priv->io_stream);
 	result = g_simple_async_result_new(G_OBJECT(conn), callback, user_data, idle_server_connection_send_async);
-	g_output_stream_write_async(output_stream, priv->output_buffer, priv->count, G_PRIORITY_DEFAULT, cancellable, _write_ready, result);
+	g_output_stream_write_async(output_stream, g_bytes_get_data(data, NULL), priv->count, G_PRIORITY_DEFAULT, cancellable, _write_ready, result);
 
-	IDLE_DEBUG("sending \"%s\" to OutputStream %p", priv->output_buffer, output_stream);
+	IDLE_DEBUG("sending \"%.*s\" to OutputStream %p", (int) priv->count, (const gchar *) g_bytes_get_data(data, NULL), output_stream);
 }
 
 gboolean idle_server_connection_send_finish(IdleServerConnection *conn, GAsyncResult *result, GError **error) {
@@ -626,3 +634,10 @@ void idle_server_connection_set_tls(IdleServerConnection *conn, gboolean tls) {
 	IdleServerConnectionPrivate *priv = IDLE_SERVER_CONNECTION_GET_PRIVATE(conn);
 	g_socket_client_set_tls(priv->socket_client, tls);
 }
+
+void idle_server_connection_set_client_certificate(IdleServerConnection *conn, GTlsCertificate *certificate) {
+	IdleServerConnectionPrivate *priv = IDLE_SERVER_CONNECTION_GET_PRIVATE(conn);
+
+	g_clear_object(&priv->client_certificate);
+	priv->client_certificate = g_object_ref(certificate);
+}
@@ -27,6 +27,42 @@
 #define IDLE_DEBUG_FLAG IDLE_DEBUG_TEXT
 #include "idle-ctcp.h"
 #include "idle-debug.h"
+#include "idle-parser.h"
+
+/* how long to wait for echo-message to echo a message we sent, once it has
+ * been written out, before assuming the server isn't going to */
+#define ECHO_TIMEOUT 30 /* sec */
+
+/* A message which has been queued but not yet reported as sent. It is
+ * referenced by conn->pending_sends until it is reported, and by each of its
+ * lines until the flood queue is done with them. */
+typedef struct _IdlePendingSend IdlePendingSend;
+struct _IdlePendingSend {
+	guint refcount;
+	IdleConnection *conn;
+
+	/* NULL once reported */
+	GObject *channel;
+	TpMessage *message;
+	TpMessageSendingFlags flags;
+	gchar *token;
+
+	TpHandle target;
+	TpHandleType target_type;
+	/* the trailing parameter of each line, as we sent it */
+	GStrv lines;
+	/* how many times it was queued: once per line, or per multiline batch */
+	guint n_sends;
+	/* how many of @lines each of those carries */
+	guint *send_lengths;
+	guint n_written;
+	guint n_lines_written;
+	guint n_echoed;
+
+	gboolean echo;
+	gint64 queued_at;
+	guint echo_timeout_id;
+};
 
 gboolean idle_text_decode(const gchar *text, TpChannelTextMessageType *type, gchar **body) {
 	gchar *tmp = NULL;
@@ -50,6 +86,274 @@ gboolean idle_text_decode(const gchar *text, TpChannelTextMessageType *type, gch
 	return TRUE;
 }
 
+/* the types idle_text_send() can send: normal, action and notice */
+#define N_SENDABLE_TYPES (TP_CHANNEL_TEXT_MESSAGE_TYPE_NOTICE + 1)
+
+#define ZERO_WIDTH_JOINER 0x200D
+
+static gboolean _is_regional_indicator(gunichar c) {
+	return c >= 0x1F1E6 && c <= 0x1F1FF;
+}
+
+typedef enum {
+	HANGUL_NONE,
+	HANGUL_L,
+	HANGUL_V,
+	HANGUL_T,
+	HANGUL_LV,
+	HANGUL_LVT
+} HangulType;
+
+static HangulType _hangul_type(gunichar c) {
+	if (c >= 0x1100 && c <= 0x115F)
+		return HANGUL_L;
+	if (c >= 0x1160 && c <= 0x11A7)
+		return HANGUL_V;
+	if (c >= 0x11A8 && c <= 0x11FF)
+		return HANGUL_T;
+	if (c >= 0xAC00 && c <= 0xD7A3)
+		return ((c - 0xAC00) % 28 == 0) ? HANGUL_LV : HANGUL_LVT;
+
+	return HANGUL_NONE;
+}
+
+/* Whether a grapheme cluster ends between @prev and @c, @prev being the last
+ * of @n_regional_indicators regional indicators in a row. This is the gist of
+ * UAX #29, enough to keep accented letters, emoji sequences, flags and Hangul
+ * syllables in one piece; CR LF doesn't come up, since we split on LF. */
+static gboolean _is_grapheme_break(gunichar prev, gunichar c, guint n_regional_indicators) {
+	HangulType prev_hangul, hangul;
+
+	if (prev < 0x80 && c < 0x80)
+		return TRUE;
+
+	/* combining marks, variation selectors, skin tones and emoji tags */
+	if (g_unichar_ismark(c) || c == ZERO_WIDTH_JOINER ||
+			(c >= 0x1F3FB && c <= 0x1F3FF) || (c >= 0xE0020 && c <= 0xE007F))
+		return FALSE;
+
+	/* emoji ZWJ sequences */
+	if (prev == ZERO_WIDTH_JOINER)
+		return FALSE;
+
+	/* each flag is a pair of regional indicators */
+	if (_is_regional_indicator(prev) && _is_regional_indicator(c))
+		return n_regional_indicators % 2 == 0;
+
+	prev_hangul = _hangul_type(prev);
+	hangul = _hangul_type(c);
+
+	switch (prev_hangul) {
+		case HANGUL_L:
+			return hangul != HANGUL_L && hangul != HANGUL_V && hangul != HANGUL_LV && hangul != HANGUL_LVT;
+		case HANGUL_V:
+		case HANGUL_LV:
+			return hangul != HANGUL_V && hangul != HANGUL_T;
+		case HANGUL_T:
+		case HANGUL_LVT:
+			return hangul != HANGUL_T;
+		default:
+			return TRUE;
+	}
+}
+
+/* Where a channel's messages go, with the start of each kind of line to it
+ * worked out once rather than for every message. */
+struct _IdleTextTarget {
+	gchar *recipient;
+	/* "PRIVMSG <recipient> :" and the like, indexed by message type */
+	gchar *headers[N_SENDABLE_TYPES];
+	gsize header_lens[N_SENDABLE_TYPES];
+	/* how much text fits in a line of each type, as of the last time the
+	 * connection's maximum message length was @max_msg_len */
+	gsize max_msg_len;
+	gsize max_bytes[N_SENDABLE_TYPES];
+	/* each line is put together in here before being copied out */
+	GString *line;
+};
+
+static const gchar * const footers[N_SENDABLE_TYPES] = { "", "\001", "" };
+
+IdleTextTarget *idle_text_target_new(const gchar *recipient) {
+	IdleTextTarget *target = g_slice_new0(IdleTextTarget);
+
+	target->recipient = g_strdup(recipient);
+	target->headers[TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL] = g_strdup_printf("PRIVMSG %s :", recipient);
+	target->headers[TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION] = g_strdup_printf("PRIVMSG %s :\001ACTION ", recipient);
+	target->headers[TP_CHANNEL_TEXT_MESSAGE_TYPE_NOTICE] = g_strdup_printf("NOTICE %s :", recipient);
+
+	for (guint i = 0; i < N_SENDABLE_TYPES; i++)
+		target->header_lens[i] = strlen(target->headers[i]);
+
+	target->line = g_string_sized_new(IRC_MSG_MAXLEN + 1);
+
+	return target;
+}
+
+void idle_text_target_free(IdleTextTarget *target) {
+	if (target == NULL)
+		return;
+
+	g_free(target->recipient);
+
+	for (guint i = 0; i < N_SENDABLE_TYPES; i++)
+		g_free(target->headers[i]);
+
+	g_string_free(target->line, TRUE);
+	g_slice_free(IdleTextTarget, target);
+}
+
+static gsize _target_get_max_bytes(IdleTextTarget *target, TpChannelTextMessageType type, gsize max_msg_len) {
+	if (target->max_msg_len != max_msg_len) {
+		target->max_msg_len = max_msg_len;
+
+		for (guint i = 0; i < N_SENDABLE_TYPES; i++)
+			target->max_bytes[i] = max_msg_len - (target->header_lens[i] + strlen(footers[i]));
+	}
+
+	return target->max_bytes[type];
+}
+
+static void _add_part(GPtrArray *messages, GPtrArray *bodies, GArray *continued, IdleTextTarget *target, TpChannelTextMessageType type, const gchar *start, const gchar *end, gboolean continues) {
+	GString *line = target->line;
+	gsize len = end - start;
+
+	g_string_truncate(line, 0);
+	g_string_append_len(line, target->headers[type], target->header_lens[type]);
+	g_string_append_len(line, start, len);
+	g_string_append(line, footers[type]);
+
+	g_ptr_array_add(messages, g_strndup(line->str, line->len));
+	g_ptr_array_add(bodies, g_strndup(start, len));
+	g_array_append_val(continued, continues);
+}
+
+/* As idle_text_encode_and_split(), also saying in @continued_out which parts
+ * carry on the same line as the part before them, rather than starting a new
+ * one. */
+static GStrv
+_encode_and_split(IdleTextTarget *target,
+		TpChannelTextMessageType type,
+		const gchar *text,
+		gsize max_msg_len,
+		GStrv *bodies_out,
+		gboolean **continued_out,
+		GError **error) {
+	GPtrArray *messages;
+	GPtrArray *bodies;
+	GArray *continued;
+	/* TRUE once @line is what's left of a line we've had to break */
+	gboolean continuing = FALSE;
+	const gchar *line = text;
+	const gchar *p = text;
+	/* the last places at which @line could end: after whitespace, between
+	 * grapheme clusters, or at least between characters */
+	const gchar *space_break = NULL;
+	const gchar *cluster_break = NULL;
+	const gchar *char_break = NULL;
+	gunichar prev = 0;
+	guint n_regional_indicators = 0;
+	gsize max_bytes;
+
+	if (type >= N_SENDABLE_TYPES) {
+		IDLE_DEBUG("unsupported message type %u", type);
+		g_set_error(error, TP_ERROR, TP_ERROR_NOT_IMPLEMENTED, "unsupported message type %u", type);
+		return NULL;
+	}
+
+	messages = g_ptr_array_new();
+	bodies = g_ptr_array_new();
+	continued = g_array_new(FALSE, FALSE, sizeof(gboolean));
+	max_bytes = _target_get_max_bytes(target, type, max_msg_len);
+
+	while (*p != '\0') {
+		const gchar *next;
+		gunichar c;
+
+		if (*p == '\n') {
+			_add_part(messages, bodies, continued, target, type, line, p, continuing);
+			continuing = FALSE;
+			line = ++p;
+			space_break = cluster_break = char_break = NULL;
+			prev = 0;
+			n_regional_indicators = 0;
+			continue;
+		}
+
+		if ((guchar) *p < 0x80) {
+			c = *p;
+			next = p + 1;
+		} else {
+			c = g_utf8_get_char(p);
+			next = g_utf8_next_char(p);
+		}
+
+		if (p > line) {
+			char_break = p;
+
+			if (_is_grapheme_break(prev, c, n_regional_indicators)) {
+				cluster_break = p;
+
+				if (g_unichar_isspace(prev))
+					space_break = p;
+			}
+		}
+
+		while ((gsize) (next - line) > max_bytes) {
+			const gchar *end = space_break;
+
+			if (end == NULL)
+				end = cluster_break;
+			if (end == NULL)
+				end = char_break;
+			if (end == NULL) {
+				/* not even one character fits; send it anyway rather
+				 * than going round in circles */
+				end = next;
+			}
+
+			_add_part(messages, bodies, continued, target, type, line, end, continuing);
+			continuing = TRUE;
+			line = end;
+
+			/* whatever breaks we know of after @end are still good */
+			space_break = NULL;
+			if (cluster_break == end)
+				cluster_break = NULL;
+			if (char_break == end)
+				char_break = NULL;
+		}
+
+		if (_is_regional_indicator(c))
+			n_regional_indicators++;
+		else
+			n_regional_indicators = 0;
+
+		prev = c;
+		p = next;
+	}
+
+	if (p > line)
+		_add_part(messages, bodies, continued, target, type, line, p, continuing);
+
+	g_ptr_array_add(messages, NULL);
+	g_ptr_array_add(bodies, NULL);
+
+	if (bodies_out != NULL) {
+		*bodies_out = (GStrv) g_ptr_array_free(bodies, FALSE);
+	} else {
+		g_ptr_array_free(bodies, TRUE);
+	}
+
+	if (continued_out != NULL) {
+		*continued_out = (gboolean *) g_array_free(continued, FALSE);
+	} else {
+		g_array_free(continued, TRUE);
+	}
+
+	return (GStrv) g_ptr_array_free(messages, FALSE);
+}
+
 /**
  * idle_text_encode_and_split:
  * @type: The type of message as per Telepathy
@@ -62,7 +366,10 @@ gboolean idle_text_decode(const gchar *text, TpChannelTextMessageType *type, gch
  * @error: Location at which to store an error
  *
  * Splits @text as necessary to be able to send it over IRC. IRC messages
- * cannot contain newlines, and have a (server-determined) maximum length.
+ * cannot contain newlines, and have a (server-determined) maximum length,
+ * which has to hold the CTCP ACTION wrapping too. Lines which are too long
+ * are broken after whitespace where possible, and otherwise between grapheme
+ * clusters; @text is only walked through once.
  *
  * Returns: A list of IRC protocol commands representing @text as best possible.
  */
@@ -73,83 +380,274 @@ idle_text_encode_and_split(TpChannelTextMessageType type,
 		gsize max_msg_len,
 		GStrv *bodies_out,
 		GError **error) {
-	GPtrArray *messages;
-	GPtrArray *bodies;
-	const gchar *remaining_text = text;
-	const gchar * const text_end =  text + strlen(text);
-	gchar *header;
-	const gchar *footer = "";
-	gsize max_bytes;
+	IdleTextTarget *target = idle_text_target_new(recipient);
+	GStrv messages = _encode_and_split(target, type, text, max_msg_len, bodies_out, NULL, error);
 
-	switch (type) {
-		case TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL:
-			header = g_strdup_printf("PRIVMSG %s :", recipient);
-			break;
-		case TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION:
-			header = g_strdup_printf("PRIVMSG %s :\001ACTION ", recipient);
-			footer = "\001";
-			break;
-		case TP_CHANNEL_TEXT_MESSAGE_TYPE_NOTICE:
-			header = g_strdup_printf("NOTICE %s :", recipient);
-			break;
-		default:
-			IDLE_DEBUG("unsupported message type %u", type);
-			g_set_error(error, TP_ERROR, TP_ERROR_NOT_IMPLEMENTED, "unsupported message type %u", type);
-			return NULL;
+	idle_text_target_free(target);
+	return messages;
+}
+
+static void _pending_send_unref(IdlePendingSend *pending) {
+	if (--pending->refcount > 0)
+		return;
+
+	g_assert(pending->channel == NULL);
+
+	g_free(pending->token);
+	g_strfreev(pending->lines);
+	g_free(pending->send_lengths);
+	g_slice_free(IdlePendingSend, pending);
+}
+
+static void _emit_delivery_report(IdlePendingSend *pending, gint64 latency) {
+	TpBaseConnection *base_conn = TP_BASE_CONNECTION(pending->conn);
+	TpMessage *report = tp_cm_message_new(base_conn, 1);
+
+	tp_message_set_uint32(report, 0, "message-type", TP_CHANNEL_TEXT_MESSAGE_TYPE_DELIVERY_REPORT);
+	if (pending->target_type == TP_HANDLE_TYPE_CONTACT)
+		tp_message_set_handle(report, 0, "message-sender", TP_HANDLE_TYPE_CONTACT, pending->target);
+	tp_message_set_int64(report, 0, "message-received", time(NULL));
+	tp_message_set_uint32(report, 0, "delivery-status", TP_DELIVERY_STATUS_ACCEPTED);
+	tp_message_set_string(report, 0, "delivery-token", pending->token);
+	/* how long the message spent in our flood queue, and with echo-message
+	 * also the round trip to the server, in milliseconds */
+	tp_message_set_uint32(report, 0, "idle-queue-latency", (guint32) MIN(latency / 1000, G_MAXUINT32));
+
+	tp_message_mixin_take_received(pending->channel, report);
+}
+
+/* Reports the message as sent, or as failed if @error is set, and drops the
+ * list's reference to it. */
+static void _pending_send_report(IdlePendingSend *pending, gint64 server_time, const GError *error) {
+	if (pending->echo_timeout_id != 0) {
+		g_source_remove(pending->echo_timeout_id);
+		pending->echo_timeout_id = 0;
 	}
 
-	messages = g_ptr_array_new();
-	bodies = g_ptr_array_new();
-	max_bytes = max_msg_len - (strlen(header) + strlen(footer));
-
-	while (remaining_text < text_end) {
-		char *newline = strchr(remaining_text, '\n');
-		const char *end_iter;
-		char *message;
-		int len;
-
-		if (newline != NULL && ((unsigned) (newline - remaining_text)) < max_bytes) {
-			/* String up to the next newline is short enough. */
-			end_iter = newline;
-
-		} else if ((text_end - remaining_text) > (gint) max_bytes) {
-			/* Remaining string is too long; take as many bytes as possible */
-			end_iter = remaining_text + max_bytes;
-			/* make sure we don't break a UTF-8 code point in half */
-			end_iter = g_utf8_find_prev_char (remaining_text, end_iter);
+	g_queue_remove(pending->conn->pending_sends, pending);
+
+	if (error == NULL) {
+		if (server_time != 0)
+			tp_message_set_int64(pending->message, 0, "message-sent", server_time);
+
+		if (pending->flags & TP_MESSAGE_SENDING_FLAG_REPORT_DELIVERY)
+			_emit_delivery_report(pending, g_get_monotonic_time() - pending->queued_at);
+
+		tp_message_mixin_sent(pending->channel, pending->message, pending->flags, pending->token, NULL);
+	} else {
+		tp_message_mixin_sent(pending->channel, pending->message, 0, NULL, error);
+	}
+
+	g_object_unref(pending->channel);
+	pending->channel = NULL;
+	pending->message = NULL;
+
+	_pending_send_unref(pending);
+}
+
+static gboolean _echo_timeout_cb(gpointer user_data) {
+	IdlePendingSend *pending = user_data;
+
+	IDLE_DEBUG("no echo for message %s, assuming it was sent", pending->token);
+	pending->echo_timeout_id = 0;
+	_pending_send_report(pending, 0, NULL);
+
+	return FALSE;
+}
+
+static void _line_sent_cb(IdleConnection *conn, gint64 queued_at, gboolean sent, gpointer user_data) {
+	IdlePendingSend *pending = user_data;
+
+	if (pending->channel != NULL) {
+		if (!sent) {
+			GError error = {TP_ERROR, TP_ERROR_NETWORK_ERROR, "message could not be sent to the server"};
+
+			_pending_send_report(pending, 0, &error);
 		} else {
-			/* Just take it all. */
-			end_iter = text_end;
+			/* the flood queue writes things out in the order they were
+			 * queued */
+			pending->n_lines_written += pending->send_lengths[pending->n_written];
+
+			if (++pending->n_written == pending->n_sends) {
+				if (!pending->echo)
+					_pending_send_report(pending, 0, NULL);
+				else if (pending->n_echoed < pending->n_lines_written)
+					pending->echo_timeout_id = g_timeout_add_seconds(ECHO_TIMEOUT, _echo_timeout_cb, pending);
+			}
+		}
+	}
+
+	_pending_send_unref(pending);
+}
+
+/* Packs the parts of a message into draft/multiline batches of at most
+ * @max_lines lines (0 for no limit) and @max_bytes bytes of text, so that a
+ * paste takes up a place in the flood queue per batch rather than per line,
+ * and reaches other users in one piece. Returns a list of lines to send
+ * together for each batch. */
+static GPtrArray *_pack_multiline(const gchar *recipient, GStrv messages, GStrv bodies, const gboolean *continued, guint max_bytes, guint max_lines) {
+	GPtrArray *batches = g_ptr_array_new();
+	static guint last_batch = 0;
+	guint start, end;
+
+	for (start = 0; messages[start] != NULL; start = end) {
+		GPtrArray *lines = g_ptr_array_new();
+		gsize bytes = strlen(bodies[start]);
+
+		for (end = start + 1; messages[end] != NULL; end++) {
+			/* lines of the text are joined with a newline; the pieces of
+			 * a line we had to break are simply concatenated */
+			bytes += strlen(bodies[end]) + (continued[end] ? 0 : 1);
+
+			if ((max_lines != 0 && end - start >= max_lines) || bytes > max_bytes)
+				break;
 		}
 
-		len = (int)(end_iter - remaining_text);
-		message = g_strdup_printf("%s%.*s%s", header, len, remaining_text, footer);
-		g_ptr_array_add(messages, message);
-		g_ptr_array_add(bodies, g_strndup(remaining_text, len));
+		if (end - start == 1) {
+			g_ptr_array_add(lines, g_strdup(messages[start]));
+		} else {
+			gchar *ref = g_strdup_printf("idle%u", ++last_batch);
+
+			g_ptr_array_add(lines, g_strdup_printf("BATCH +%s draft/multiline %s", ref, recipient));
 
-		remaining_text = end_iter;
-		if (*end_iter == '\n') {
-				/* advance over a newline */
-				remaining_text++;
+			for (guint i = start; i < end; i++)
+				g_ptr_array_add(lines, g_strdup_printf("@batch=%s%s %s", ref,
+					(i > start && continued[i]) ? ";draft/multiline-concat" : "", messages[i]));
+
+			g_ptr_array_add(lines, g_strdup_printf("BATCH -%s", ref));
+			g_free(ref);
 		}
+
+		g_ptr_array_add(lines, NULL);
+		g_ptr_array_add(batches, g_ptr_array_free(lines, FALSE));
 	}
 
-	g_assert (remaining_text == text_end);
+	return batches;
+}
 
-	g_ptr_array_add(messages, NULL);
-	g_ptr_array_add(bodies, NULL);
+/* How many of @pending's lines the server could have seen by now. */
+static guint _lines_out(IdlePendingSend *pending) {
+	guint n = pending->n_lines_written;
 
-	if (bodies_out != NULL) {
-		*bodies_out = (GStrv) g_ptr_array_free(bodies, FALSE);
-	} else {
-		g_ptr_array_free(bodies, TRUE);
+	if (pending->n_written < pending->n_sends && idle_connection_is_writing(pending->conn, pending))
+		n += pending->send_lengths[pending->n_written];
+
+	return n;
+}
+
+/* Lines to the same target are echoed in the order we sent them, so an echo
+ * can only be of the oldest message to it, and only once some of that has gone
+ * out. The text needn't match: servers may strip colours (+c) or
+ * trailing spaces from what they pass on. */
+static IdlePendingSend *_find_pending_send(IdleConnection *conn, TpHandleType target_type, TpHandle target) {
+	GList *l;
+
+	for (l = conn->pending_sends->head; l != NULL; l = l->next) {
+		IdlePendingSend *pending = l->data;
+
+		if (!pending->echo || pending->target_type != target_type || pending->target != target)
+			continue;
+
+		if (pending->n_echoed < _lines_out(pending))
+			return pending;
+
+		return NULL;
 	}
 
-	g_free(header);
-	return (GStrv) g_ptr_array_free(messages, FALSE);
+	return NULL;
+}
+
+/* With echo-message, the server sends our own messages back to us once it has
+ * accepted them. Those confirming something we sent mustn't show up as
+ * received messages; anything else we said, with a raw command or from another
+ * client on the same bouncer, is let through to be shown like any other. */
+static IdleParserHandlerResult _echo_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	TpHandle sender = g_value_get_uint(g_value_array_get_nth(args, 0));
+	TpHandle target = g_value_get_uint(g_value_array_get_nth(args, 1));
+	const gchar *line = g_value_get_string(g_value_array_get_nth(args, 2));
+	TpHandleType target_type = TP_HANDLE_TYPE_CONTACT;
+	IdlePendingSend *pending;
+
+	if (sender != tp_base_connection_get_self_handle(TP_BASE_CONNECTION(conn)) || !idle_connection_has_cap(conn, "echo-message"))
+		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+
+	if (code == IDLE_PARSER_PREFIXCMD_PRIVMSG_CHANNEL || code == IDLE_PARSER_PREFIXCMD_NOTICE_CHANNEL)
+		target_type = TP_HANDLE_TYPE_ROOM;
+
+	pending = _find_pending_send(conn, target_type, target);
+	if (pending == NULL)
+		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+
+	if (strcmp(pending->lines[pending->n_echoed], line))
+		IDLE_DEBUG("the server passed on \"%s\" as \"%s\"", pending->lines[pending->n_echoed], line);
+
+	if (++pending->n_echoed == g_strv_length(pending->lines))
+		_pending_send_report(pending, idle_parser_get_server_time(parser), NULL);
+
+	/* a message to ourselves is also one we've received */
+	if (target_type == TP_HANDLE_TYPE_CONTACT && target == sender)
+		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+
+	return IDLE_PARSER_HANDLER_RESULT_HANDLED;
+}
+
+static IdleParserHandlerResult _cannot_send_handler(IdleParser *parser, IdleParserMessageCode code, GValueArray *args, gpointer user_data) {
+	IdleConnection *conn = IDLE_CONNECTION(user_data);
+	TpHandle target = g_value_get_uint(g_value_array_get_nth(args, 0));
+	TpHandleType target_type = (code == IDLE_PARSER_NUMERIC_CANNOTSENDTOCHAN) ? TP_HANDLE_TYPE_ROOM : TP_HANDLE_TYPE_CONTACT;
+	IdlePendingSend *pending = _find_pending_send(conn, target_type, target);
+	GError error = {TP_ERROR, TP_ERROR_PERMISSION_DENIED, "the server refused the message"};
+
+	/* as with echoes, the refusal can only be of a line which has already
+	 * gone out; if nothing has, it was for a raw command */
+	if (pending == NULL)
+		return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+
+	if (code == IDLE_PARSER_NUMERIC_NOSUCHNICK) {
+		error.code = TP_ERROR_OFFLINE;
+		error.message = "no such nick";
+	}
+
+	_pending_send_report(pending, 0, &error);
+
+	return IDLE_PARSER_HANDLER_RESULT_NOT_HANDLED;
+}
+
+static void _status_changed_cb(IdleConnection *conn, guint status, guint reason, gpointer user_data) {
+	GError error = {TP_ERROR, TP_ERROR_DISCONNECTED, "disconnected before the message was sent"};
+	IdlePendingSend *pending;
+
+	if (status != TP_CONNECTION_STATUS_DISCONNECTED)
+		return;
+
+	while ((pending = g_queue_peek_head(conn->pending_sends)) != NULL)
+		_pending_send_report(pending, 0, &error);
 }
 
-void idle_text_send(GObject *obj, TpMessage *message, TpMessageSendingFlags flags, const gchar *recipient, IdleConnection *conn) {
+void idle_text_init(IdleConnection *conn) {
+	conn->pending_sends = g_queue_new();
+
+	g_signal_connect(conn, "status-changed", G_CALLBACK(_status_changed_cb), NULL);
+
+	idle_parser_add_handler_with_priority(conn->parser, IDLE_PARSER_PREFIXCMD_PRIVMSG_CHANNEL, _echo_handler, conn, IDLE_PARSER_HANDLER_PRIORITY_FIRST);
+	idle_parser_add_handler_with_priority(conn->parser, IDLE_PARSER_PREFIXCMD_PRIVMSG_USER, _echo_handler, conn, IDLE_PARSER_HANDLER_PRIORITY_FIRST);
+	idle_parser_add_handler_with_priority(conn->parser, IDLE_PARSER_PREFIXCMD_NOTICE_CHANNEL, _echo_handler, conn, IDLE_PARSER_HANDLER_PRIORITY_FIRST);
+	idle_parser_add_handler_with_priority(conn->parser, IDLE_PARSER_PREFIXCMD_NOTICE_USER, _echo_handler, conn, IDLE_PARSER_HANDLER_PRIORITY_FIRST);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_CANNOTSENDTOCHAN, _cannot_send_handler, conn);
+	idle_parser_add_handler(conn->parser, IDLE_PARSER_NUMERIC_NOSUCHNICK, _cannot_send_handler, conn);
+}
+
+/* must be called once the flood queue has been emptied */
+void idle_text_finalize(GObject *object) {
+	IdleConnection *conn = IDLE_CONNECTION(object);
+
+	/* anything still pending was reported when we disconnected */
+	_status_changed_cb(conn, TP_CONNECTION_STATUS_DISCONNECTED, TP_CONNECTION_STATUS_REASON_NONE_SPECIFIED, NULL);
+	g_queue_free(conn->pending_sends);
+}
+
+void idle_text_send(GObject *obj, TpMessage *message, TpMessageSendingFlags flags, IdleTextTarget *target, IdleConnection *conn) {
 	GError *error = NULL;
 	const GHashTable *part;
 	TpChannelTextMessageType type = TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL;
@@ -158,8 +656,12 @@ void idle_text_send(GObject *obj, TpMessage *message, TpMessageSendingFlags flag
 	guint n_parts;
 	GStrv messages;
 	GStrv bodies;
+	gboolean *continued;
+	guint max_bytes, max_lines;
 	gsize msg_len;
 	guint i;
+	IdlePendingSend *pending;
+	static guint64 last_token = 0;
 
 	#define INVALID_ARGUMENT(msg, ...) \
 	G_STMT_START { \
@@ -169,7 +671,7 @@ void idle_text_send(GObject *obj, TpMessage *message, TpMessageSendingFlags flag
 		goto failed; \
 	} G_STMT_END
 
-	g_return_if_fail (recipient != NULL);
+	g_return_if_fail (target != NULL);
 
 	part = tp_message_peek (message, 0);
 
@@ -200,19 +702,71 @@ void idle_text_send(GObject *obj, TpMessage *message, TpMessageSendingFlags flag
 	/* Okay, it's valid. Let's send it. */
 
 	msg_len = idle_connection_get_max_message_length(conn);
-	messages = idle_text_encode_and_split(type, recipient, text, msg_len, &bodies, &error);
+	messages = _encode_and_split(target, type, text, msg_len, &bodies, &continued, &error);
 	if (messages == NULL)
 		goto failed;
 
-	for(i = 0; messages[i] != NULL; i++) {
+	/* Report it as sent once it has really gone out: when the server echoes
+	 * it back if it can, or else when the flood queue has written it. */
+	pending = g_slice_new0(IdlePendingSend);
+	pending->refcount = 1;
+	pending->conn = conn;
+	pending->channel = g_object_ref(obj);
+	pending->message = message;
+	pending->flags = flags;
+	pending->token = g_strdup_printf("%" G_GUINT64_FORMAT, ++last_token);
+	pending->target = tp_base_channel_get_target_handle(TP_BASE_CHANNEL(obj));
+	pending->target_type = TP_BASE_CHANNEL_GET_CLASS(obj)->target_handle_type;
+	pending->lines = g_new0(gchar *, g_strv_length(messages) + 1);
+	pending->echo = idle_connection_has_cap(conn, "echo-message");
+	pending->queued_at = g_get_monotonic_time();
+	g_queue_push_tail(conn->pending_sends, pending);
+
+	for (i = 0; messages[i] != NULL; i++) {
+		const gchar *trailing = strstr(messages[i], " :");
+
 		g_assert(bodies[i] != NULL);
-		idle_connection_send(conn, messages[i]);
+		g_assert(trailing != NULL);
+
+		/* as the flood queue will have mangled it */
+		pending->lines[i] = g_strdelimit(g_strdup(trailing + 2), "\r\n", ' ');
+	}
+
+	/* CTCP ACTIONs can't span lines, so only go in batches of one */
+	if (messages[1] != NULL && type != TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION &&
+			idle_connection_get_multiline_limits(conn, &max_bytes, &max_lines)) {
+		GPtrArray *batches = _pack_multiline(target->recipient, messages, bodies, continued, max_bytes, max_lines);
+
+		pending->n_sends = batches->len;
+		pending->send_lengths = g_new(guint, pending->n_sends);
+
+		for (i = 0; i < batches->len; i++) {
+			GStrv lines = g_ptr_array_index(batches, i);
+			guint n_lines = g_strv_length(lines);
+
+			/* not counting BATCH +ref and BATCH -ref */
+			pending->send_lengths[i] = (n_lines == 1) ? 1 : n_lines - 2;
+			pending->refcount++;
+			idle_connection_send_batch_with_callback(conn, (const gchar * const *) lines, _line_sent_cb, pending);
+			g_strfreev(lines);
+		}
+
+		g_ptr_array_free(batches, TRUE);
+	} else {
+		pending->n_sends = g_strv_length(messages);
+		pending->send_lengths = g_new(guint, pending->n_sends);
+
+		for (i = 0; messages[i] != NULL; i++) {
+			pending->send_lengths[i] = 1;
+			pending->refcount++;
+			idle_connection_send_with_callback(conn, messages[i], _line_sent_cb, pending);
+		}
 	}
 
 	g_strfreev(messages);
 	g_strfreev(bodies);
+	g_free(continued);
 
-	tp_message_mixin_sent (obj, message, flags, "", NULL);
 	return;
 
 failed:
@@ -229,10 +783,13 @@ idle_text_received (GObject *chan,
 	TpHandle sender)
 {
 	TpMessage *msg;
+	gint64 server_time = idle_parser_get_server_time (IDLE_CONNECTION (base_conn)->parser);
 
 	msg = tp_cm_message_new_text (base_conn, sender, type, text);
 
 	tp_message_set_int64 (msg, 0, "message-received", time (NULL));
+	if (server_time != 0)
+		tp_message_set_int64 (msg, 0, "message-sent", server_time);
 
 	tp_message_mixin_take_received (chan, msg);
 	return TRUE;
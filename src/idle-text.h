@@ -31,9 +31,16 @@
 
 G_BEGIN_DECLS
 
+typedef struct _IdleTextTarget IdleTextTarget;
+
+IdleTextTarget *idle_text_target_new(const gchar *recipient);
+void idle_text_target_free(IdleTextTarget *target);
+
 gboolean idle_text_decode(const gchar *text, TpChannelTextMessageType *type, gchar **body);
 GStrv idle_text_encode_and_split(TpChannelTextMessageType type, const gchar *recipient, const gchar *text, gsize max_msg_len, GStrv *bodies_out, GError **error);
-void idle_text_send(GObject *obj, TpMessage *message, TpMessageSendingFlags flags, const gchar *recipient, IdleConnection *conn);
+void idle_text_send(GObject *obj, TpMessage *message, TpMessageSendingFlags flags, IdleTextTarget *target, IdleConnection *conn);
+void idle_text_init(IdleConnection *conn);
+void idle_text_finalize(GObject *object);
 
 gboolean idle_text_received (GObject *chan,
 	TpBaseConnection *base_conn,
@@ -36,6 +36,10 @@
 #define VCARD_FIELD_NAME "x-" PROTOCOL_NAME
 #define DEFAULT_PORT 6667
 #define DEFAULT_KEEPALIVE_INTERVAL 30 /* sec */
+#define DEFAULT_WHOIS_PIPELINE_DEPTH 4
+#define DEFAULT_CONTACT_INFO_TTL 300 /* sec */
+#define DEFAULT_ROOM_LIST_TTL 300 /* sec */
+#define DEFAULT_MEMBERS_FLUSH_INTERVAL 100 /* ms */
 
 G_DEFINE_TYPE (IdleProtocol, idle_protocol, TP_TYPE_BASE_PROTOCOL)
 
@@ -87,6 +91,28 @@ filter_username (const TpCMParamSpec *paramspec,
   return TRUE;
 }
 
+static gboolean
+filter_sasl_mechanism (const TpCMParamSpec *paramspec,
+    GValue *value,
+    GError **error)
+{
+  const gchar *mechanism = g_value_get_string (value);
+
+  g_assert (value);
+  g_assert (G_VALUE_HOLDS_STRING (value));
+
+  if (!tp_str_empty (mechanism) &&
+      g_ascii_strcasecmp (mechanism, "PLAIN") &&
+      g_ascii_strcasecmp (mechanism, "EXTERNAL"))
+    {
+      g_set_error (error, TP_ERROR, TP_ERROR_INVALID_ARGUMENT,
+          "Unsupported SASL mechanism '%s'", mechanism);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 static const TpCMParamSpec idle_params[] = {
     {"account", DBUS_TYPE_STRING_AS_STRING, G_TYPE_STRING,
       TP_CONN_MGR_PARAM_FLAG_REQUIRED, NULL, 0, filter_nick},
@@ -109,6 +135,24 @@ static const TpCMParamSpec idle_params[] = {
       TP_CONN_MGR_PARAM_FLAG_HAS_DEFAULT, GINT_TO_POINTER (FALSE) },
     { "password-prompt", DBUS_TYPE_BOOLEAN_AS_STRING, G_TYPE_BOOLEAN,
       TP_CONN_MGR_PARAM_FLAG_HAS_DEFAULT, GINT_TO_POINTER (FALSE) },
+    { "sasl-mechanism", DBUS_TYPE_STRING_AS_STRING, G_TYPE_STRING, 0, NULL, 0,
+      filter_sasl_mechanism },
+    { "client-certificate", DBUS_TYPE_STRING_AS_STRING, G_TYPE_STRING, 0 },
+    { "whois-pipeline-depth", DBUS_TYPE_UINT32_AS_STRING, G_TYPE_UINT,
+      TP_CONN_MGR_PARAM_FLAG_HAS_DEFAULT,
+      GUINT_TO_POINTER (DEFAULT_WHOIS_PIPELINE_DEPTH), 0,
+      tp_cm_param_filter_uint_nonzero },
+    { "contact-info-ttl", DBUS_TYPE_UINT32_AS_STRING, G_TYPE_UINT,
+      TP_CONN_MGR_PARAM_FLAG_HAS_DEFAULT,
+      GUINT_TO_POINTER (DEFAULT_CONTACT_INFO_TTL) },
+    { "who-on-join", DBUS_TYPE_BOOLEAN_AS_STRING, G_TYPE_BOOLEAN,
+      TP_CONN_MGR_PARAM_FLAG_HAS_DEFAULT, GINT_TO_POINTER (FALSE) },
+    { "room-list-ttl", DBUS_TYPE_UINT32_AS_STRING, G_TYPE_UINT,
+      TP_CONN_MGR_PARAM_FLAG_HAS_DEFAULT,
+      GUINT_TO_POINTER (DEFAULT_ROOM_LIST_TTL) },
+    { "members-flush-interval", DBUS_TYPE_UINT32_AS_STRING, G_TYPE_UINT,
+      TP_CONN_MGR_PARAM_FLAG_HAS_DEFAULT,
+      GUINT_TO_POINTER (DEFAULT_MEMBERS_FLUSH_INTERVAL) },
     { NULL, NULL, 0, 0, NULL, 0 }
 };
 
@@ -147,6 +191,15 @@ new_connection (TpBaseProtocol *protocol G_GNUC_UNUSED,
       "use-ssl", tp_asv_get_boolean (params, "use-ssl", NULL),
       "password-prompt", tp_asv_get_boolean (params, "password-prompt",
           NULL),
+      "sasl-mechanism", tp_asv_get_string (params, "sasl-mechanism"),
+      "client-certificate", tp_asv_get_string (params, "client-certificate"),
+      "whois-pipeline-depth", tp_asv_get_uint32 (params,
+          "whois-pipeline-depth", NULL),
+      "contact-info-ttl", tp_asv_get_uint32 (params, "contact-info-ttl", NULL),
+      "who-on-join", tp_asv_get_boolean (params, "who-on-join", NULL),
+      "room-list-ttl", tp_asv_get_uint32 (params, "room-list-ttl", NULL),
+      "members-flush-interval", tp_asv_get_uint32 (params,
+          "members-flush-interval", NULL),
       NULL);
 }
 
@@ -155,7 +208,7 @@ normalize_contact (TpBaseProtocol *self G_GNUC_UNUSED,
                    const gchar *contact,
                    GError **error)
 {
-  return idle_normalize_nickname (contact, error);
+  return idle_normalize_contact_id (contact, error);
 }
 
 static gchar *
@@ -163,6 +216,8 @@ identify_account (TpBaseProtocol *self G_GNUC_UNUSED,
     GHashTable *asv,
     GError **error)
 {
+  /* not idle_normalize_contact_id(): the account's object path is derived
+   * from this, so folding "[]\" differently would orphan existing accounts */
   gchar *nick = idle_normalize_nickname (tp_asv_get_string (asv, "account"),
       error);
   gchar *server;
@@ -19,6 +19,7 @@
 
 #include "config.h"
 #include "room-config.h"
+#include "idle-isupport.h"
 #include "idle-muc-channel.h"
 
 #include <telepathy-glib/telepathy-glib.h>
@@ -143,8 +144,90 @@ send_mode (IdleRoomConfig *self,
   g_object_unref (channel);
 }
 
+/* The mode changes made by one UpdateConfiguration call, sent in as few MODE
+ * commands as the server's MODES limit on parameters allows. */
+typedef struct {
+  IdleRoomConfig *self;
+  guint max_params;
+  GString *modes;
+  GString *params;
+  gchar sign;
+  guint n_params;
+} ModeBatch;
+
+static void
+mode_batch_init (ModeBatch *batch,
+    IdleRoomConfig *self)
+{
+  TpBaseChannel *channel;
+  IdleConnection *connection;
+
+  channel = tp_base_room_config_dup_channel ((TpBaseRoomConfig *) self);
+  connection = IDLE_CONNECTION (tp_base_channel_get_connection (channel));
+
+  batch->self = self;
+  batch->max_params = MAX (idle_isupport_get_modes (
+        idle_connection_get_isupport (connection)), 1);
+  batch->modes = g_string_new (NULL);
+  batch->params = g_string_new (NULL);
+  batch->sign = '\0';
+  batch->n_params = 0;
+
+  g_object_unref (channel);
+}
+
+static void
+mode_batch_flush (ModeBatch *batch)
+{
+  if (batch->modes->len > 0)
+    {
+      g_string_append (batch->modes, batch->params->str);
+      send_mode (batch->self, batch->modes->str);
+    }
+
+  g_string_truncate (batch->modes, 0);
+  g_string_truncate (batch->params, 0);
+  batch->sign = '\0';
+  batch->n_params = 0;
+}
+
+static void
+mode_batch_add (ModeBatch *batch,
+    gboolean set,
+    gchar irc_mode,
+    const gchar *param)
+{
+  gchar sign = set ? '+' : '-';
+
+  if (param != NULL && batch->n_params >= batch->max_params)
+    mode_batch_flush (batch);
+
+  if (sign != batch->sign)
+    {
+      g_string_append_c (batch->modes, sign);
+      batch->sign = sign;
+    }
+
+  g_string_append_c (batch->modes, irc_mode);
+
+  if (param != NULL)
+    {
+      g_string_append_printf (batch->params, " %s", param);
+      batch->n_params++;
+    }
+}
+
+static void
+mode_batch_finish (ModeBatch *batch)
+{
+  mode_batch_flush (batch);
+  g_string_free (batch->modes, TRUE);
+  g_string_free (batch->params, TRUE);
+}
+
 static void
 do_quick_boolean (IdleRoomConfig *self,
+    ModeBatch *batch,
     GHashTable *properties,
     TpBaseRoomConfigProperty prop_id,
     const gchar *gobject_property_name,
@@ -161,12 +244,7 @@ do_quick_boolean (IdleRoomConfig *self,
           NULL);
 
       if (current_value != new_value)
-        {
-          gchar *cmd = g_strdup_printf ("%c%c",
-              new_value ? '+' : '-', irc_mode);
-          send_mode (self, cmd);
-          g_free (cmd);
-        }
+        mode_batch_add (batch, new_value, irc_mode, NULL);
     }
 }
 
@@ -183,6 +261,7 @@ idle_room_config_update_configuration_async (
   gboolean present = FALSE;
   gboolean password_protected = FALSE;
   const gchar *password = NULL;
+  ModeBatch batch;
 
   password_protected = tp_asv_get_boolean (validated_properties,
       GUINT_TO_POINTER (TP_BASE_ROOM_CONFIG_PASSWORD_PROTECTED), &present);
@@ -218,12 +297,14 @@ idle_room_config_update_configuration_async (
       return;
     }
 
+  mode_batch_init (&batch, self);
+
   /* okay go and do the quick ones */
-  do_quick_boolean (self, validated_properties,
+  do_quick_boolean (self, &batch, validated_properties,
       TP_BASE_ROOM_CONFIG_INVITE_ONLY, "invite-only", 'i');
-  do_quick_boolean (self, validated_properties,
+  do_quick_boolean (self, &batch, validated_properties,
       TP_BASE_ROOM_CONFIG_MODERATED, "moderated", 'm');
-  do_quick_boolean (self, validated_properties,
+  do_quick_boolean (self, &batch, validated_properties,
       TP_BASE_ROOM_CONFIG_PRIVATE, "private", 's');
 
   /* now the rest */
@@ -234,7 +315,6 @@ idle_room_config_update_configuration_async (
     {
       guint limit = tp_asv_get_uint32 (validated_properties,
           GUINT_TO_POINTER (TP_BASE_ROOM_CONFIG_LIMIT), NULL);
-      gchar *cmd = NULL;
       guint current;
 
       g_object_get (self,
@@ -246,27 +326,25 @@ idle_room_config_update_configuration_async (
           /* a non-zero limit means we want a limit enabled, so let's
            * set it. if the limit is zero let's disable the limit. */
           if (limit > 0)
-            cmd = g_strdup_printf ("+l %u", limit);
+            {
+              gchar *param = g_strdup_printf ("%u", limit);
+
+              mode_batch_add (&batch, TRUE, 'l', param);
+              g_free (param);
+            }
           else
-            cmd = g_strdup ("-l");
+            {
+              mode_batch_add (&batch, FALSE, 'l', NULL);
+            }
         }
-
-      if (cmd != NULL)
-        send_mode (self, cmd);
-      g_free (cmd);
     }
 
   /* set a new password */
   if (password != NULL)
     {
-      gchar *cmd;
-
       /* we've already validated this; either PasswordProtected was
        * not included, or it's TRUE */
-
-      cmd = g_strdup_printf ("+k %s", password);
-      send_mode (self, cmd);
-      g_free (cmd);
+      mode_batch_add (&batch, TRUE, 'k', password);
 
       /* TODO: this can be removed when we add queueing to these mode
        * changes */
@@ -278,16 +356,13 @@ idle_room_config_update_configuration_async (
   /* unset a password */
   if (!password_protected && present)
     {
-      gchar *cmd;
-
       /* we've already validated this; PasswordProtected=FALSE so no
        * Password is given */
-
-      cmd = g_strdup ("-k");
-      send_mode (self, cmd);
-      g_free (cmd);
+      mode_batch_add (&batch, FALSE, 'k', NULL);
     }
 
+  mode_batch_finish (&batch);
+
   g_simple_async_result_complete_in_idle (result);
   g_object_unref (result);
 }
@@ -0,0 +1,108 @@
+#include "config.h"
+
+#include <idle-alias-cache.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define check(cond) \
+	G_STMT_START { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			fail = TRUE; \
+		} \
+	} G_STMT_END
+
+#define MAX_ENTRIES 1000
+#define MAX_BYTES (64 * 1024)
+#define SELF_HANDLE 1
+
+static void
+_evicted (TpHandle handle,
+    gpointer user_data)
+{
+	*(TpHandle *) user_data = handle;
+}
+
+int
+main (void)
+{
+	gboolean fail = FALSE;
+	TpHandle evicted = 0;
+	IdleAliasCache *cache = idle_alias_cache_new(MAX_ENTRIES, MAX_BYTES, NULL, NULL);
+	gsize max_bytes_seen = 0;
+	guint max_size_seen = 0;
+	gchar alias[128];
+
+	idle_alias_cache_set_pinned(cache, SELF_HANDLE);
+	idle_alias_cache_insert(cache, SELF_HANDLE, "Me");
+
+	/* weeks of people coming and going, some with long nicks */
+	for (TpHandle h = 2; h < 200000; h++) {
+		snprintf(alias, sizeof(alias), "Nick%u%s", h, (h % 7) ? "" : "_With_A_Much_Longer_Name_Than_Usual");
+		idle_alias_cache_insert(cache, h, alias);
+
+		/* every so often, someone goes back to their plain nick */
+		if (h % 11 == 0)
+			idle_alias_cache_remove(cache, h - 5);
+
+		max_size_seen = MAX(max_size_seen, idle_alias_cache_get_size(cache));
+		max_bytes_seen = MAX(max_bytes_seen, idle_alias_cache_get_bytes(cache));
+	}
+
+	check(max_size_seen <= MAX_ENTRIES);
+	check(max_bytes_seen <= MAX_BYTES);
+	/* the cache should actually be used, not just kept empty */
+	check(idle_alias_cache_get_bytes(cache) > MAX_BYTES / 2);
+
+	/* we never forget our own alias */
+	check(idle_alias_cache_lookup(cache, SELF_HANDLE) != NULL);
+	check(!strcmp(idle_alias_cache_lookup(cache, SELF_HANDLE), "Me"));
+	check(idle_alias_cache_lookup(cache, 2) == NULL);
+	check(!strcmp(idle_alias_cache_lookup(cache, 199999), "Nick199999"));
+
+	/* looking something up makes it recently used */
+	idle_alias_cache_free(cache);
+	cache = idle_alias_cache_new(3, MAX_BYTES, _evicted, &evicted);
+	idle_alias_cache_insert(cache, 10, "A");
+	idle_alias_cache_insert(cache, 11, "B");
+	idle_alias_cache_insert(cache, 12, "C");
+	check(idle_alias_cache_lookup(cache, 10) != NULL);
+	check(evicted == 0);
+	idle_alias_cache_insert(cache, 13, "D");
+	check(idle_alias_cache_lookup(cache, 10) != NULL);
+	check(idle_alias_cache_lookup(cache, 11) == NULL);
+	check(idle_alias_cache_get_size(cache) == 3);
+	/* and whoever was evicted instead is owed an AliasesChanged */
+	check(evicted == 11);
+
+	/* replacing an alias doesn't leak its accounting, nor count as evicting
+	 * it; nor does removing one */
+	evicted = 0;
+	idle_alias_cache_insert(cache, 12, "Charlie");
+	idle_alias_cache_insert(cache, 12, "C");
+	idle_alias_cache_remove(cache, 10);
+	idle_alias_cache_remove(cache, 12);
+	idle_alias_cache_remove(cache, 13);
+	check(idle_alias_cache_get_size(cache) == 0);
+	check(idle_alias_cache_get_bytes(cache) == 0);
+	check(evicted == 0);
+
+	/* unpinning makes the old self handle evictable again */
+	idle_alias_cache_set_pinned(cache, 20);
+	idle_alias_cache_insert(cache, 20, "Old");
+	idle_alias_cache_insert(cache, 21, "E");
+	idle_alias_cache_insert(cache, 22, "F");
+	idle_alias_cache_insert(cache, 23, "G");
+	check(idle_alias_cache_lookup(cache, 20) != NULL);
+	idle_alias_cache_set_pinned(cache, 30);
+	idle_alias_cache_insert(cache, 24, "H");
+	check(idle_alias_cache_get_size(cache) == 3);
+
+	idle_alias_cache_free(cache);
+
+	if (fail)
+		return 1;
+	else
+		return 0;
+}
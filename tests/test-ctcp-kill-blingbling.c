@@ -5,6 +5,36 @@
 #include <stdio.h>
 #include <string.h>
 
+#define BENCHMARK_ROUNDS 20000
+
+/* a typical line of chat, long enough to go through the word-at-a-time scan */
+#define PLAIN "and then I said, well, if you restart it it'll pick up the new config"
+
+static gboolean
+benchmark (const gchar *what,
+    const gchar *msg)
+{
+	gsize len = strlen(msg);
+	gint64 start = g_get_monotonic_time();
+	gint64 elapsed;
+	gsize out = 0;
+
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		gchar *killed = idle_ctcp_kill_blingbling(msg);
+
+		out += strlen(killed);
+		g_free(killed);
+	}
+
+	elapsed = MAX(g_get_monotonic_time() - start, 1);
+
+	printf("%s: %u x %" G_GSIZE_FORMAT " bytes in %.1f ms, %.0f MB/s\n",
+		what, BENCHMARK_ROUNDS, len, elapsed / 1000.0,
+		(gdouble) len * BENCHMARK_ROUNDS / elapsed);
+
+	return out > 0;
+}
+
 int
 main (void)
 {
@@ -13,6 +43,20 @@ main (void)
 	const gchar *test_strings[] = {
 		"foobar", "foobar",
 		"foo \x03\x31\x33<3", "foo <3",
+		"", "",
+		"\x02", "",
+		"\x02\x62old\x0f and \x1ditalic\x1d and \x1funderlined\x1f", "bold and italic and underlined",
+		"\x03" "4,12red on blue\x03 plain", "red on blue plain",
+		"\x03" "04,1two-digit foreground\x03,", "two-digit foreground",
+		"\x03" "123", "3",
+		"\x11monospace\x12\x16reversed", "monospacereversed",
+		/* not formatting, so left alone */
+		"\001ACTION waves\001", "\001ACTION waves\001",
+		"tab\tseparated", "tab\tseparated",
+		PLAIN, PLAIN,
+		PLAIN "\x02!", PLAIN "!",
+		"\x02" PLAIN, PLAIN,
+		"caf\xc3\xa9 \x02\xe2\x98\x95\x02 \xf0\x9f\x8d\xb0", "caf\xc3\xa9 \xe2\x98\x95 \xf0\x9f\x8d\xb0",
 		NULL, NULL
 	};
 
@@ -27,9 +71,18 @@ main (void)
 		g_free(killed);
 	}
 
+	if (idle_ctcp_kill_blingbling(NULL) != NULL) {
+		fprintf(stderr, "NULL should be left as it is");
+		fail = TRUE;
+	}
+
+	/* most messages have no formatting at all; some have a little */
+	if (!benchmark("plain", PLAIN PLAIN PLAIN PLAIN PLAIN PLAIN) ||
+			!benchmark("formatted", "\x02" PLAIN "\x0f " PLAIN " \x03" "4,12" PLAIN "\x03 " PLAIN))
+		fail = TRUE;
+
 	if (fail)
 		return 1;
 	else
 		return 0;
 }
-
@@ -0,0 +1,122 @@
+#include "config.h"
+
+#include <idle-isupport.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define check(cond) \
+	G_STMT_START { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			fail = TRUE; \
+		} \
+	} G_STMT_END
+
+static const struct {
+	IdleCaseMapping mapping;
+	const gchar *in;
+	const gchar *out;
+} casemap_tests[] = {
+	{IDLE_CASEMAPPING_ASCII, "NickServ", "nickserv"},
+	{IDLE_CASEMAPPING_ASCII, "Foo[Bar]\\Baz^~", "foo[bar]\\baz^~"},
+	{IDLE_CASEMAPPING_RFC1459, "Foo[Bar]\\Baz^~", "foo{bar}|baz~~"},
+	{IDLE_CASEMAPPING_STRICT_RFC1459, "Foo[Bar]\\Baz^~", "foo{bar}|baz^~"},
+	{IDLE_CASEMAPPING_RFC1459, "@ABCXYZ[`abcxyz{", "@abcxyz{`abcxyz{"},
+	{IDLE_CASEMAPPING_RFC1459, "\xc3\x84RGER_Long_Nickname", "\xc3\x84rger_long_nickname"},
+	{IDLE_CASEMAPPING_ASCII, "Ab", "ab"},
+	{IDLE_CASEMAPPING_ASCII, "", ""},
+	{0, NULL, NULL}
+};
+
+int
+main (void)
+{
+	gboolean fail = FALSE;
+	IdleISupport *isupport = idle_isupport_new();
+	/* what a typical modern server sends */
+	const gchar *tokens[] = {
+		"CHANTYPES=#", "PREFIX=(ov)@+", "CHANMODES=beI,k,l,BCMNORScimnpstz",
+		"CASEMAPPING=ascii", "NICKLEN=30", "CHANNELLEN=64", "MODES=4",
+		"ELIST=CMNTU", "LINELEN=1024",
+		"WHOX", "MONITOR=100", NULL
+	};
+
+	/* defaults, before the server has told us anything */
+	check(idle_isupport_is_chantype(isupport, '#'));
+	check(idle_isupport_is_chantype(isupport, '!'));
+	check(!idle_isupport_is_chantype(isupport, '@'));
+	check(idle_isupport_is_prefix_char(isupport, '@'));
+	check(idle_isupport_prefix_char_to_mode(isupport, '%') == 'h');
+	check(idle_isupport_get_chanmode_type(isupport, 'b') == IDLE_CHANMODE_LIST);
+	check(idle_isupport_get_chanmode_type(isupport, 'l') == IDLE_CHANMODE_PARAM_WHEN_SET);
+	check(idle_isupport_get_casemapping(isupport) == IDLE_CASEMAPPING_RFC1459);
+	check(idle_isupport_get_channellen(isupport) == 50);
+	check(idle_isupport_get_linelen(isupport) == 512);
+	check(!idle_isupport_has_whox(isupport));
+	check(idle_isupport_get_monitor(isupport) == 0);
+
+	for (int i = 0; tokens[i] != NULL; i++)
+		check(idle_isupport_parse_token(isupport, tokens[i]));
+
+	check(idle_isupport_is_chantype(isupport, '#'));
+	check(!idle_isupport_is_chantype(isupport, '&'));
+	check(idle_isupport_is_prefix_char(isupport, '+'));
+	check(!idle_isupport_is_prefix_char(isupport, '%'));
+	check(idle_isupport_prefix_char_to_mode(isupport, '@') == 'o');
+	check(idle_isupport_prefix_char_to_mode(isupport, '~') == '\0');
+	check(idle_isupport_get_chanmode_type(isupport, 'o') == IDLE_CHANMODE_PREFIX);
+	check(idle_isupport_get_chanmode_type(isupport, 'q') == IDLE_CHANMODE_UNKNOWN);
+	check(idle_isupport_get_chanmode_type(isupport, 'k') == IDLE_CHANMODE_PARAM);
+	check(idle_isupport_get_chanmode_type(isupport, 'z') == IDLE_CHANMODE_FLAG);
+	check(idle_isupport_get_casemapping(isupport) == IDLE_CASEMAPPING_ASCII);
+	check(idle_isupport_get_nicklen(isupport) == 30);
+	check(idle_isupport_get_channellen(isupport) == 64);
+	check(idle_isupport_get_modes(isupport) == 4);
+	check(idle_isupport_get_elist(isupport) == (IDLE_ELIST_CREATION_TIME | IDLE_ELIST_MASK | IDLE_ELIST_NEGATIVE_MASK | IDLE_ELIST_TOPIC_TIME | IDLE_ELIST_USER_COUNT));
+	check(idle_isupport_get_linelen(isupport) == 1024);
+	check(idle_isupport_has_whox(isupport));
+	check(idle_isupport_get_monitor(isupport) == 100);
+
+	/* negation reverts to the defaults */
+	check(idle_isupport_parse_token(isupport, "-CHANTYPES"));
+	check(idle_isupport_is_chantype(isupport, '&'));
+	check(idle_isupport_parse_token(isupport, "-MODES"));
+	check(idle_isupport_get_modes(isupport) == 3);
+
+	/* a PREFIX we can't make sense of leaves us with the defaults */
+	check(idle_isupport_parse_token(isupport, "PREFIX=(ov)@"));
+	check(idle_isupport_prefix_char_to_mode(isupport, '~') == 'q');
+
+	/* escaped values */
+	check(idle_isupport_parse_token(isupport, "CHANTYPES=\\x23\\x26"));
+	check(idle_isupport_is_chantype(isupport, '&'));
+	check(!idle_isupport_is_chantype(isupport, '!'));
+
+	/* the human-readable trailer of RPL_ISUPPORT is not a parameter */
+	check(!idle_isupport_parse_token(isupport, "are"));
+	check(!idle_isupport_parse_token(isupport, "supported"));
+	check(!idle_isupport_parse_token(isupport, "-MODES=4"));
+
+	idle_isupport_free(isupport);
+
+	/* case folding, over lengths which exercise both the word-at-a-time and
+	 * the byte-at-a-time paths */
+	for (guint i = 0; casemap_tests[i].in != NULL; i++) {
+		gchar buf[64];
+		gsize len = strlen(casemap_tests[i].in);
+
+		idle_casemap_fold(casemap_tests[i].mapping, casemap_tests[i].in, buf, len);
+		buf[len] = '\0';
+
+		if (strcmp(buf, casemap_tests[i].out)) {
+			fprintf(stderr, "\"%s\" (mapping %d) -> \"%s\", should be \"%s\"\n", casemap_tests[i].in, casemap_tests[i].mapping, buf, casemap_tests[i].out);
+			fail = TRUE;
+		}
+	}
+
+	if (fail)
+		return 1;
+	else
+		return 0;
+}
@@ -0,0 +1,206 @@
+#include "config.h"
+
+#include <idle-room-directory.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define check(cond) \
+	G_STMT_START { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			fail = TRUE; \
+		} \
+	} G_STMT_END
+
+#define N_ROOMS 50000
+#define TTL (300 * G_USEC_PER_SEC)
+
+static const gchar *topics[] = {
+	"",
+	"Welcome! Please read the channel guidelines before asking",
+	"Support channel | Don't ask to ask, just ask | Pastebin: https://paste.example.net/",
+	"Off-topic chat",
+};
+
+/* what the server would send, one "322 me #room members :topic" per room */
+static GString *synthetic_list(void) {
+	GString *reply = g_string_sized_new(N_ROOMS * 80);
+	gchar line[512];
+
+	for (guint i = 0; i < N_ROOMS; i++) {
+		/* most rooms share one of a handful of topics; some have their own */
+		if (i % 10 == 0)
+			snprintf(line, sizeof(line), ":irc.example.net 322 me #room%05u %u :Room number %u\r\n", i, i % 500, i);
+		else
+			snprintf(line, sizeof(line), ":irc.example.net 322 me #room%05u %u :%s\r\n", i, i % 500, topics[i % G_N_ELEMENTS(topics)]);
+
+		g_string_append(reply, line);
+	}
+
+	return reply;
+}
+
+int
+main (void)
+{
+	gboolean fail = FALSE;
+	IdleRoomDirectory *dir = idle_room_directory_new();
+	GString *reply = synthetic_list();
+	gchar *cur = reply->str;
+	gint64 start, filled, looked_up;
+	guint members;
+	const gchar *name, *topic;
+	gint i;
+
+	check(idle_room_directory_get_size(dir) == 0);
+	check(!idle_room_directory_is_fresh(dir, 0, TTL));
+	check(idle_room_directory_lookup(dir, "#room00000") == -1);
+
+	/* the work the RPL_LIST handler does for each line, minus the parsing */
+	start = g_get_monotonic_time();
+
+	while (*cur != '\0') {
+		gchar *end = strchr(cur, '\r');
+		gchar *room_name = strchr(cur + 1, '#');
+		gchar *count = strchr(room_name, ' ');
+		gchar *trailing = strchr(count + 1, ':');
+
+		*end = '\0';
+		*count = '\0';
+		idle_room_directory_add(dir, room_name, (guint) strtoul(count + 1, NULL, 10), trailing + 1);
+		cur = end + 2;
+	}
+
+	idle_room_directory_set_complete(dir, start);
+	filled = g_get_monotonic_time();
+
+	for (guint j = 0; j < N_ROOMS; j++) {
+		gchar room_name[16];
+
+		snprintf(room_name, sizeof(room_name), "#room%05u", j);
+		if (idle_room_directory_lookup(dir, room_name) != (gint) j) {
+			fprintf(stderr, "%s not found at %u\n", room_name, j);
+			fail = TRUE;
+		}
+	}
+
+	looked_up = g_get_monotonic_time();
+
+	printf("%u rooms (%" G_GSIZE_FORMAT " bytes of LIST): filled in %.1f ms, looked up in %.1f ms, %" G_GSIZE_FORMAT " bytes stored\n",
+		N_ROOMS, reply->len, (filled - start) / 1000.0, (looked_up - filled) / 1000.0, idle_room_directory_get_bytes(dir));
+
+	check(idle_room_directory_get_size(dir) == N_ROOMS);
+	/* strings are interned, so this is smaller than the reply itself */
+	check(idle_room_directory_get_bytes(dir) < reply->len);
+
+	idle_room_directory_get(dir, 12345, &name, &members, &topic);
+	check(!strcmp(name, "#room12345"));
+	check(members == 12345 % 500);
+	check(!strcmp(topic, topics[12345 % G_N_ELEMENTS(topics)]));
+
+	idle_room_directory_get(dir, 40000, &name, &members, &topic);
+	check(!strcmp(topic, "Room number 40000"));
+
+	/* a topic isn't a room, and a room is only listed once */
+	check(idle_room_directory_lookup(dir, "Off-topic chat") == -1);
+	check(idle_room_directory_lookup(dir, "#nonexistent") == -1);
+	idle_room_directory_add(dir, "#room00001", 7, "New topic");
+	check(idle_room_directory_get_size(dir) == N_ROOMS);
+	i = idle_room_directory_lookup(dir, "#room00001");
+	idle_room_directory_get(dir, i, NULL, &members, &topic);
+	check(members == 7);
+	check(!strcmp(topic, "New topic"));
+
+	/* freshness */
+	check(idle_room_directory_is_fresh(dir, start + TTL - 1, TTL));
+	check(!idle_room_directory_is_fresh(dir, start + TTL, TTL));
+	check(!idle_room_directory_is_fresh(dir, start, 0));
+
+	idle_room_directory_clear(dir);
+	check(idle_room_directory_get_size(dir) == 0);
+	check(!idle_room_directory_is_fresh(dir, start, TTL));
+	check(idle_room_directory_lookup(dir, "#room00001") == -1);
+	idle_room_directory_add(dir, "#a", 1, NULL);
+	idle_room_directory_get(dir, 0, &name, &members, &topic);
+	check(!strcmp(name, "#a") && members == 1 && !strcmp(topic, ""));
+
+	/* names are compared the way the server does, by rfc1459 until it says
+	 * otherwise, but listed as the server spelt them */
+	idle_room_directory_add(dir, "#Foo[Bar]", 2, "");
+	check(idle_room_directory_lookup(dir, "#foo{bar}") == 1);
+	check(idle_room_directory_lookup(dir, "#FOO[BAR]") == 1);
+	idle_room_directory_add(dir, "#foo{bar}", 3, "");
+	check(idle_room_directory_get_size(dir) == 2);
+	idle_room_directory_get(dir, 1, &name, &members, NULL);
+	check(!strcmp(name, "#foo{bar}") && members == 3);
+
+	/* a listing made under another mapping is no use */
+	idle_room_directory_set_casemapping(dir, IDLE_CASEMAPPING_RFC1459);
+	check(idle_room_directory_get_size(dir) == 2);
+	idle_room_directory_set_casemapping(dir, IDLE_CASEMAPPING_ASCII);
+	check(idle_room_directory_get_size(dir) == 0);
+	idle_room_directory_add(dir, "#Foo[Bar]", 2, "");
+	check(idle_room_directory_lookup(dir, "#foo[bar]") == 0);
+	check(idle_room_directory_lookup(dir, "#foo{bar}") == -1);
+
+	idle_room_directory_free(dir);
+	g_string_free(reply, TRUE);
+
+	/* masks */
+	check(idle_mask_match("#python*", "#Python-Dev"));
+	check(idle_mask_match("*", ""));
+	check(idle_mask_match("#?oo", "#foo"));
+	check(idle_mask_match("*foo*bar", "xxfooxbarfoobar"));
+	check(!idle_mask_match("#python*", "##python"));
+	check(!idle_mask_match("#foo", "#foobar"));
+	check(!idle_mask_match("*foo*bar", "foobarx"));
+
+	/* filters */
+	{
+		IdleRoomFilter filter = { "#python*", 50, 1000, "*help*" };
+		IdleRoomFilter residual;
+		gchar *cmd;
+
+		check(idle_room_filter_matches(&filter, "#python", 50, "Get help here"));
+		check(!idle_room_filter_matches(&filter, "#python", 49, "Get help here"));
+		check(!idle_room_filter_matches(&filter, "#python", 1001, "Get help here"));
+		check(!idle_room_filter_matches(&filter, "#perl", 100, "Get help here"));
+		check(!idle_room_filter_matches(&filter, "#python", 100, NULL));
+
+		/* the server does everything but the topic */
+		cmd = idle_room_filter_to_list_command(&filter, IDLE_ELIST_MASK | IDLE_ELIST_USER_COUNT, &residual);
+		check(!strcmp(cmd, "LIST >49,<1001,#python*"));
+		check(residual.name_mask == NULL && residual.min_members == 0 && residual.max_members == 0);
+		check(!strcmp(residual.topic_mask, "*help*"));
+		g_free(cmd);
+
+		/* the server can't do masks, so we do */
+		cmd = idle_room_filter_to_list_command(&filter, IDLE_ELIST_USER_COUNT, &residual);
+		check(!strcmp(cmd, "LIST >49,<1001"));
+		check(!strcmp(residual.name_mask, "#python*"));
+		g_free(cmd);
+
+		/* ...but any server can look up one room by name */
+		filter.name_mask = "#python";
+		filter.min_members = 0;
+		cmd = idle_room_filter_to_list_command(&filter, 0, &residual);
+		check(!strcmp(cmd, "LIST #python"));
+		check(residual.name_mask == NULL && residual.max_members == 1000);
+		g_free(cmd);
+
+		filter.name_mask = NULL;
+		filter.max_members = 0;
+		check(!idle_room_filter_is_empty(&filter));
+		filter.topic_mask = "";
+		check(idle_room_filter_is_empty(&filter));
+		cmd = idle_room_filter_to_list_command(&filter, IDLE_ELIST_MASK | IDLE_ELIST_USER_COUNT, &residual);
+		check(!strcmp(cmd, "LIST"));
+		g_free(cmd);
+	}
+
+	if (fail)
+		return 1;
+	else
+		return 0;
+}
@@ -122,6 +122,97 @@ test (TpChannelTextMessageType type,
   return TRUE;
 }
 
+/* Splits @msg, and checks that every part but the last ends with @tail (or
+ * that every part's length is a multiple of @tail's, if @tail is NULL and
+ * @unit isn't 0) */
+static gboolean
+test_boundaries (const gchar *what,
+                 const gchar *msg,
+                 const gchar *tail,
+                 gsize unit)
+{
+  gchar **bodies;
+  gchar **output = idle_text_encode_and_split (
+      TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION, "ircuser", msg, 510, &bodies, NULL);
+  gboolean ok = TRUE;
+  guint n = g_strv_length (bodies);
+
+  if (n < 2)
+    {
+      fprintf (stderr, "%s: expected several parts, got %u\n", what, n);
+      ok = FALSE;
+    }
+
+  for (guint i = 0; ok && i < n; i++)
+    {
+      if (tail != NULL && i + 1 < n && !g_str_has_suffix (bodies[i], tail))
+        {
+          fprintf (stderr, "%s: part #%u split badly: ...%s\n", what, i,
+              bodies[i] + MAX (strlen (bodies[i]), 8) - 8);
+          ok = FALSE;
+        }
+
+      if (unit != 0 && strlen (bodies[i]) % unit != 0)
+        {
+          fprintf (stderr, "%s: part #%u split mid-cluster (%zu bytes)\n",
+              what, i, strlen (bodies[i]));
+          ok = FALSE;
+        }
+    }
+
+  g_strfreev (output);
+  g_strfreev (bodies);
+  return ok;
+}
+
+static gchar *
+repeat (const gchar *unit,
+        guint times)
+{
+  GString *str = g_string_sized_new (strlen (unit) * times);
+
+  for (guint i = 0; i < times; i++)
+    g_string_append (str, unit);
+
+  return g_string_free (str, FALSE);
+}
+
+/* a 100 KB paste: ragged lines of words, a few of them too long for one
+ * message, with the odd accent and emoji */
+static gboolean
+benchmark (void)
+{
+  static const gchar *words[] = { "lorem", "ipsum", "dolor", "sit", "amet,",
+      "caf\xc3\xa9", "na\xc3\xaf\xcc\x88ve", "\xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd",
+      "consectetur", "adipiscing", "elit." };
+  GString *paste = g_string_sized_new (100 * 1024 + 64);
+  gchar **output;
+  guint n_lines;
+  gint64 start, end;
+  gboolean ok;
+
+  for (guint i = 0; paste->len < 100 * 1024; i++)
+    {
+      g_string_append (paste, words[i % G_N_ELEMENTS (words)]);
+      g_string_append_c (paste, (i % 17 == 16 || i % 400 == 399) ? '\n' : ' ');
+    }
+
+  start = g_get_monotonic_time ();
+  output = idle_text_encode_and_split (TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL,
+      "#channel", paste->str, 510, NULL, NULL);
+  end = g_get_monotonic_time ();
+
+  n_lines = g_strv_length (output);
+  printf ("split %" G_GSIZE_FORMAT " bytes into %u messages in %.2f ms\n",
+      paste->len, n_lines, (end - start) / 1000.0);
+  g_strfreev (output);
+
+  /* and it still has to come out right */
+  ok = test (TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION, paste->str);
+  g_string_free (paste, TRUE);
+  return ok;
+}
+
 
 int
 main (int argc,
@@ -148,6 +239,33 @@ main (int argc,
         }
     }
 
+  {
+    /* words aren't split, so every part ends where a word does */
+    gchar *words = repeat ("word ", 300);
+    /* e + COMBINING ACUTE ACCENT */
+    gchar *accents = repeat ("e\xcc\x81", 300);
+    /* MAN ZWJ WOMAN ZWJ GIRL */
+    gchar *family = repeat (
+        "\xf0\x9f\x91\xa8\xe2\x80\x8d\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x91\xa7",
+        100);
+    /* REGIONAL INDICATOR F, REGIONAL INDICATOR R */
+    gchar *flags = repeat ("\xf0\x9f\x87\xab\xf0\x9f\x87\xb7", 200);
+
+    if (!test_boundaries ("words", words, " ", 0) ||
+        !test_boundaries ("accents", accents, "\xcc\x81", 3) ||
+        !test_boundaries ("family", family, "\xf0\x9f\x91\xa7", 18) ||
+        !test_boundaries ("flags", flags, NULL, 8))
+      sad_face = TRUE;
+
+    g_free (words);
+    g_free (accents);
+    g_free (family);
+    g_free (flags);
+  }
+
+  if (!benchmark ())
+    sad_face = TRUE;
+
   if (sad_face)
     {
       fprintf (stderr, "  :'(\n");
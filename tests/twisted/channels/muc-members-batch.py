@@ -0,0 +1,82 @@
+"""
+Test that other people's joins and parts are merged into batched
+MembersChanged signals, and that someone who joins and leaves again within
+one batch never shows up at all, unless batching is turned off
+"""
+
+from idletest import exec_test
+from servicetest import EventPattern, call_async, assertEquals
+import constants as cs
+
+CHANNEL_NAME = '#idletest'
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+    alice, bob, dave = conn.get_contact_handles_sync(['alice', 'bob', 'dave'])
+
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+         cs.TARGET_ID: CHANNEL_NAME})
+    ret = q.expect('dbus-return', method='CreateChannel')
+    path = ret.value[0]
+    q.expect('dbus-signal', signal='MembersChanged', path=path)
+
+    # dave's visit is too brief to mention
+    forbidden = [EventPattern('dbus-signal', signal='MembersChanged',
+        predicate=lambda e: dave in e.args[1] or dave in e.args[2])]
+    q.forbid_events(forbidden)
+
+    stream.sendMessage('JOIN', CHANNEL_NAME, prefix='alice!alice@idle.test.client')
+    stream.sendMessage('JOIN', CHANNEL_NAME, prefix='dave!dave@idle.test.client')
+    stream.sendMessage('JOIN', CHANNEL_NAME, prefix='bob!bob@idle.test.client')
+    stream.sendMessage('PART', CHANNEL_NAME, prefix='dave!dave@idle.test.client')
+
+    # everyone else arrives together
+    e = q.expect('dbus-signal', signal='MembersChanged', path=path)
+    assertEquals(sorted([alice, bob]), sorted(e.args[1]))
+    assertEquals([], e.args[2])
+
+    # and a message flushes what came before it, so the next batch is sent
+    # without waiting for the timer; dave isn't in that one either
+    stream.sendMessage('JOIN', CHANNEL_NAME, prefix='dave!dave@idle.test.client')
+    stream.sendMessage('PART', CHANNEL_NAME, prefix='dave!dave@idle.test.client')
+    stream.sendMessage('PRIVMSG', CHANNEL_NAME, ':hello', prefix='alice!alice@idle.test.client')
+    q.expect('dbus-signal', signal='Received')
+    q.unforbid_events(forbidden)
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+def test_unbatched(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+    alice, bob = conn.get_contact_handles_sync(['alice', 'bob'])
+
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+         cs.TARGET_ID: CHANNEL_NAME})
+    ret = q.expect('dbus-return', method='CreateChannel')
+    path = ret.value[0]
+    q.expect('dbus-signal', signal='MembersChanged', path=path)
+
+    # each join is its own change
+    stream.sendMessage('JOIN', CHANNEL_NAME, prefix='alice!alice@idle.test.client')
+    stream.sendMessage('JOIN', CHANNEL_NAME, prefix='bob!bob@idle.test.client')
+    e = q.expect('dbus-signal', signal='MembersChanged', path=path)
+    assertEquals([alice], e.args[1])
+    e = q.expect('dbus-signal', signal='MembersChanged', path=path)
+    assertEquals([bob], e.args[1])
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_test(test)
+    exec_test(test_unbatched, {'members-flush-interval': 0})
@@ -0,0 +1,98 @@
+"""
+Test that someone quitting leaves every room we share with them, and no others,
+including rooms we've since parted or been kicked from
+"""
+
+from idletest import exec_test, sync_stream
+from servicetest import EventPattern, call_async
+import constants as cs
+
+def join_room(q, conn, name):
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+         cs.TARGET_ID: name})
+    ret = q.expect('dbus-return', method='CreateChannel')
+    q.expect('dbus-signal', signal='MembersChanged', path=ret.value[0])
+    return ret.value[0]
+
+def members_changed(path, added=[], removed=[]):
+    return EventPattern('dbus-signal', signal='MembersChanged', path=path,
+        predicate=lambda e: sorted(e.args[1]) == sorted(added) and
+            sorted(e.args[2]) == sorted(removed))
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+    bob, carol = conn.get_contact_handles_sync(['bob', 'carol'])
+
+    room_a = join_room(q, conn, '#a')
+    room_b = join_room(q, conn, '#b')
+
+    # bob is in both rooms, carol only in #a
+    stream.sendMessage('JOIN', '#a', prefix='bob!bob@idle.test.client')
+    stream.sendMessage('JOIN', '#b', prefix='bob!bob@idle.test.client')
+    stream.sendMessage('JOIN', '#a', prefix='carol!carol@idle.test.client')
+    q.expect_many(
+        members_changed(room_a, added=[bob, carol]),
+        members_changed(room_b, added=[bob]))
+
+    stream.sendMessage('QUIT', ':bye', prefix='bob!bob@idle.test.client')
+    q.expect_many(
+        members_changed(room_a, removed=[bob]),
+        members_changed(room_b, removed=[bob]))
+
+    forbidden = [EventPattern('dbus-signal', signal='MembersChanged',
+        path=room_b)]
+    q.forbid_events(forbidden)
+    stream.sendMessage('QUIT', ':bye', prefix='carol!carol@idle.test.client')
+    q.expect_many(members_changed(room_a, removed=[carol]))
+    sync_stream(q, stream)
+    q.unforbid_events(forbidden)
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+def test_left(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+    bob = conn.get_contact_handles_sync(['bob'])[0]
+
+    room_a = join_room(q, conn, '#a')
+    room_b = join_room(q, conn, '#b')
+    room_c = join_room(q, conn, '#c')
+
+    for room in ['#a', '#b', '#c']:
+        stream.sendMessage('JOIN', room, prefix='bob!bob@idle.test.client')
+    q.expect_many(
+        members_changed(room_a, added=[bob]),
+        members_changed(room_b, added=[bob]),
+        members_changed(room_c, added=[bob]))
+
+    # we part one and are kicked from another
+    stream.sendPart('#b', stream.nick)
+    stream.sendMessage('KICK', '#c', stream.nick, ':out',
+        prefix='bob!bob@idle.test.client')
+    q.expect_many(
+        EventPattern('dbus-signal', signal='Closed', path=room_b),
+        EventPattern('dbus-signal', signal='Closed', path=room_c))
+
+    # so as far as we know, bob is only in #a now
+    forbidden = [EventPattern('dbus-signal', signal='MembersChanged',
+        predicate=lambda e: e.path != room_a)]
+    q.forbid_events(forbidden)
+    stream.sendMessage('QUIT', ':bye', prefix='bob!bob@idle.test.client')
+    q.expect_many(members_changed(room_a, removed=[bob]))
+    sync_stream(q, stream)
+    q.unforbid_events(forbidden)
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_test(test)
+    exec_test(test_left)
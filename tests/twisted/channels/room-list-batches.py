@@ -0,0 +1,67 @@
+"""
+Test that rooms are passed on in batches while the LIST is still coming in
+"""
+
+from idletest import exec_test, sync_stream
+from servicetest import EventPattern, call_async, assertEquals
+import dbus
+import constants as cs
+
+def send_rooms(stream, names):
+    for name in names:
+        stream.sendMessage('322', stream.nick, name, '5', ':whatever',
+                prefix='idle.test.server')
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect_many(
+            EventPattern('dbus-signal', signal='StatusChanged', args=[1, 1]),
+            EventPattern('irc-connected'))
+    q.expect('dbus-signal', signal='SelfHandleChanged',
+        args=[1])
+
+    call_async(q, conn, 'CreateChannel',
+        { cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_ROOM_LIST },
+        dbus_interface=cs.CONN_IFACE_REQUESTS)
+    ret = q.expect('dbus-return', method='CreateChannel')
+    path, properties = ret.value
+
+    chan = bus.get_object(conn.bus_name, path)
+    list_chan = dbus.Interface(chan, cs.CHANNEL_TYPE_ROOM_LIST)
+
+    call_async(q, list_chan, 'ListRooms')
+    q.expect_many(
+            EventPattern('dbus-return', method='ListRooms'),
+            EventPattern('dbus-signal', signal='ListingRooms', args=[True]),
+            EventPattern('stream-LIST'))
+
+    # the first few rooms turn up shortly, without waiting for the rest
+    send_rooms(stream, ['#first', '#second'])
+    e = q.expect('dbus-signal', signal='GotRooms')
+    assertEquals(['#first', '#second'],
+        sorted([room[2]['name'] for room in e.args[0]]))
+    assert list_chan.GetListingRooms()
+
+    # a long list comes in several signals, none of them too big
+    names = ['#room%03d' % i for i in range(250)]
+    send_rooms(stream, names)
+    stream.sendMessage('323', stream.nick, ':End of /LIST',
+        prefix='idle.test.server')
+
+    received = []
+    while len(received) < len(names):
+        e = q.expect('dbus-signal', signal='GotRooms')
+        assert 0 < len(e.args[0]) <= 100, len(e.args[0])
+        received += [room[2]['name'] for room in e.args[0]]
+
+    assertEquals(names, received)
+    q.expect('dbus-signal', signal='ListingRooms', args=[False])
+
+    call_async(q, conn, 'Disconnect')
+    q.expect_many(
+            EventPattern('dbus-return', method='Disconnect'),
+            EventPattern('dbus-signal', signal='StatusChanged', args=[2, 1]))
+    return True
+
+if __name__ == '__main__':
+    exec_test(test)
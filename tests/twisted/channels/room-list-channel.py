@@ -3,7 +3,7 @@
 Test getting a room-list channel
 """
 
-from idletest import exec_test, BaseIRCServer
+from idletest import exec_test, BaseIRCServer, sync_stream
 from servicetest import EventPattern, call_async, tp_name_prefix, tp_path_prefix, assertEquals
 import dbus
 import constants as cs
@@ -16,6 +16,8 @@ TEST_CHANNELS = (
 
 def check_rooms(received_rooms):
     for room in received_rooms:
+        # listed rooms don't get handles until someone asks for them
+        assert room[0] == 0
         assert room[1] == tp_name_prefix + '.Channel.Type.Text'
         info = room[2]
         found = False
@@ -67,7 +69,22 @@ def test(q, bus, conn, stream):
     chan = bus.get_object(conn.bus_name, path)
     list_chan = dbus.Interface(chan, cs.CHANNEL_TYPE_ROOM_LIST)
     list_chan.ListRooms();
-    q.expect('dbus-signal', signal='GotRooms', predicate=lambda x:check_rooms(x.args[0]))
+    q.expect_many(
+            EventPattern('stream-LIST'),
+            EventPattern('dbus-signal', signal='GotRooms', predicate=lambda x:check_rooms(x.args[0])),
+            EventPattern('dbus-signal', signal='ListingRooms', args=[False]))
+
+    # the list we just got is still fresh, so asking again doesn't bother the
+    # server
+    forbidden = [EventPattern('stream-LIST')]
+    q.forbid_events(forbidden)
+    list_chan.ListRooms();
+    e = q.expect('dbus-signal', signal='GotRooms')
+    assertEquals(len(TEST_CHANNELS), len(e.args[0]))
+    check_rooms(e.args[0])
+    q.expect('dbus-signal', signal='ListingRooms', args=[False])
+    sync_stream(q, stream)
+    q.unforbid_events(forbidden)
 
     call_async(q, conn, 'Disconnect')
     q.expect_many(
@@ -0,0 +1,118 @@
+"""
+Test filtering a room list, on the server where ELIST allows it and in the
+connection manager where it doesn't, and looking a single room up in the
+cached list the way the server compares names
+"""
+
+from idletest import exec_test, BaseIRCServer, sync_stream
+from servicetest import EventPattern, call_async, assertEquals
+import dbus
+import constants as cs
+
+FILTER = cs.CHANNEL + '.Interface.RoomListFilter1'
+
+TEST_CHANNELS = (
+        ('#python', 1500, 'the python language'),
+        ('#python-dev', 200, 'help with writing python itself'),
+        ('#python-fr', 60, 'python en francais'),
+        ('#pythonistas', 51, ''),
+        )
+
+class FilteringServer(BaseIRCServer):
+    def handleLIST(self, args, prefix):
+        # pretend to apply ">50,<1000,#python*" as a real server would
+        assertEquals(['>49,<1001,#python*'], args)
+        for chan in TEST_CHANNELS:
+            if chan[1] > 49 and chan[1] < 1001:
+                self.sendMessage('322', '%s %s %d :%s' % (self.nick, chan[0], chan[1], chan[2]),
+                        prefix="idle.test.server")
+        self.sendMessage('323', '%s :End of /LIST' % self.nick, prefix="idle.test.server")
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect_many(
+            EventPattern('dbus-signal', signal='StatusChanged', args=[1, 1]),
+            EventPattern('irc-connected'))
+    q.expect('dbus-signal', signal='SelfHandleChanged',
+        args=[1])
+    stream.sendMessage('005', stream.nick, 'ELIST=MU', ':are supported by this server',
+            prefix='idle.test.server')
+    sync_stream(q, stream)
+
+    call_async(q, conn, 'CreateChannel',
+        { cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_ROOM_LIST },
+        dbus_interface=cs.CONN_IFACE_REQUESTS)
+    ret = q.expect('dbus-return', method='CreateChannel')
+    path, properties = ret.value
+    assert FILTER in properties[cs.INTERFACES], properties[cs.INTERFACES]
+
+    chan = bus.get_object(conn.bus_name, path)
+    props = dbus.Interface(chan, cs.PROPERTIES_IFACE)
+    assertEquals('', props.Get(FILTER, 'NameMask'))
+    props.Set(FILTER, 'NameMask', '#python*')
+    props.Set(FILTER, 'MinMembers', dbus.UInt32(50))
+    props.Set(FILTER, 'MaxMembers', dbus.UInt32(1000))
+    # servers can't filter by topic, so this one is up to Idle
+    props.Set(FILTER, 'TopicMask', '*python*')
+
+    list_chan = dbus.Interface(chan, cs.CHANNEL_TYPE_ROOM_LIST)
+    list_chan.ListRooms()
+    q.expect('stream-LIST', data=['>49,<1001,#python*'])
+    e = q.expect('dbus-signal', signal='GotRooms')
+    names = sorted([room[2]['name'] for room in e.args[0]])
+    assertEquals(['#python-dev', '#python-fr'], names)
+    q.expect('dbus-signal', signal='ListingRooms', args=[False])
+
+    call_async(q, conn, 'Disconnect')
+    q.expect_many(
+            EventPattern('dbus-return', method='Disconnect'),
+            EventPattern('dbus-signal', signal='StatusChanged', args=[2, 1]))
+    return True
+
+def test_cached_name(q, bus, conn, stream):
+    conn.Connect()
+    q.expect_many(
+            EventPattern('dbus-signal', signal='StatusChanged', args=[1, 1]),
+            EventPattern('irc-connected'))
+
+    call_async(q, conn, 'CreateChannel',
+        { cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_ROOM_LIST },
+        dbus_interface=cs.CONN_IFACE_REQUESTS)
+    ret = q.expect('dbus-return', method='CreateChannel')
+    path, properties = ret.value
+    chan = bus.get_object(conn.bus_name, path)
+    props = dbus.Interface(chan, cs.PROPERTIES_IFACE)
+    list_chan = dbus.Interface(chan, cs.CHANNEL_TYPE_ROOM_LIST)
+
+    # the whole list, which is kept
+    call_async(q, list_chan, 'ListRooms')
+    q.expect('stream-LIST')
+    for name, members in [('#python', 1500), ('#Python[fr]', 60), ('#pythonfr', 5)]:
+        stream.sendMessage('322', stream.nick, name, str(members), ':whatever',
+                prefix='idle.test.server')
+    stream.sendMessage('323', stream.nick, ':End of /LIST', prefix='idle.test.server')
+    q.expect('dbus-signal', signal='ListingRooms', args=[False])
+
+    # by rfc1459, "{}" are the lower case of "[]"
+    forbidden = [EventPattern('stream-LIST')]
+    q.forbid_events(forbidden)
+
+    props.Set(FILTER, 'NameMask', '#PYTHON{fr}')
+    call_async(q, list_chan, 'ListRooms')
+    e = q.expect('dbus-signal', signal='GotRooms')
+    assertEquals(['#Python[fr]'], [room[2]['name'] for room in e.args[0]])
+    q.expect('dbus-signal', signal='ListingRooms', args=[False])
+
+    sync_stream(q, stream)
+    q.unforbid_events(forbidden)
+
+    call_async(q, conn, 'Disconnect')
+    q.expect_many(
+            EventPattern('dbus-return', method='Disconnect'),
+            EventPattern('dbus-signal', signal='StatusChanged', args=[2, 1]))
+    return True
+
+if __name__ == '__main__':
+    exec_test(test, protocol=FilteringServer)
+    exec_test(test_cached_name)
+
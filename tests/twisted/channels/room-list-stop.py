@@ -0,0 +1,113 @@
+"""
+Test stopping a room listing while the server is still sending it, and that
+a LIST the server refuses doesn't hold up the next one
+"""
+
+from idletest import exec_test, sync_stream
+from servicetest import EventPattern, call_async, assertEquals
+import dbus
+import constants as cs
+
+def send_rooms(stream, rooms):
+    for name, members in rooms:
+        stream.sendMessage('322', stream.nick, name, str(members), ':whatever',
+                prefix='idle.test.server')
+    stream.sendMessage('323', stream.nick, ':End of /LIST', prefix='idle.test.server')
+
+def setup(q, bus, conn, stream):
+    conn.Connect()
+    q.expect_many(
+            EventPattern('dbus-signal', signal='StatusChanged', args=[1, 1]),
+            EventPattern('irc-connected'))
+    q.expect('dbus-signal', signal='SelfHandleChanged',
+        args=[1])
+
+    call_async(q, conn, 'CreateChannel',
+        { cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_ROOM_LIST },
+        dbus_interface=cs.CONN_IFACE_REQUESTS)
+    ret = q.expect('dbus-return', method='CreateChannel')
+    path, properties = ret.value
+
+    chan = bus.get_object(conn.bus_name, path)
+    return dbus.Interface(chan, cs.CHANNEL_TYPE_ROOM_LIST)
+
+def disconnect(q, conn):
+    call_async(q, conn, 'Disconnect')
+    q.expect_many(
+            EventPattern('dbus-return', method='Disconnect'),
+            EventPattern('dbus-signal', signal='StatusChanged', args=[2, 1]))
+
+def test(q, bus, conn, stream):
+    list_chan = setup(q, bus, conn, stream)
+
+    call_async(q, list_chan, 'ListRooms')
+    q.expect_many(
+            EventPattern('dbus-return', method='ListRooms'),
+            EventPattern('dbus-signal', signal='ListingRooms', args=[True]),
+            EventPattern('stream-LIST'))
+
+    call_async(q, list_chan, 'StopListing')
+    q.expect_many(
+            EventPattern('dbus-return', method='StopListing'),
+            EventPattern('dbus-signal', signal='ListingRooms', args=[False]))
+    assert not list_chan.GetListingRooms()
+
+    # the server carries on regardless; none of that should reach the client
+    forbidden = [EventPattern('dbus-signal', signal='GotRooms'),
+        EventPattern('dbus-signal', signal='ListingRooms')]
+    q.forbid_events(forbidden)
+
+    send_rooms(stream, [('#stale%d' % i, i) for i in range(100)])
+    sync_stream(q, stream)
+
+    q.unforbid_events(forbidden)
+
+    # the stopped reply wasn't cached, so this goes to the server again; and
+    # only what it sends now turns up
+    call_async(q, list_chan, 'ListRooms')
+    q.expect('stream-LIST')
+    send_rooms(stream, [('#fresh', 3)])
+    e = q.expect('dbus-signal', signal='GotRooms')
+    assertEquals(['#fresh'], [room[2]['name'] for room in e.args[0]])
+    q.expect('dbus-signal', signal='ListingRooms', args=[False])
+
+    disconnect(q, conn)
+    return True
+
+def test_list_error(q, bus, conn, stream):
+    list_chan = setup(q, bus, conn, stream)
+
+    # a reply cut short ends the listing, but isn't cached as the whole list
+    call_async(q, list_chan, 'ListRooms')
+    q.expect('stream-LIST')
+    stream.sendMessage('322', stream.nick, '#partial', '5', ':whatever',
+            prefix='idle.test.server')
+    stream.sendMessage('416', stream.nick, 'LIST',
+        ':Output too large, truncated', prefix='idle.test.server')
+    q.expect('dbus-signal', signal='ListingRooms', args=[False])
+    assert not list_chan.GetListingRooms()
+
+    # so this goes to the server again; and is stopped, then refused without
+    # an RPL_LISTEND
+    call_async(q, list_chan, 'ListRooms')
+    q.expect('stream-LIST')
+    call_async(q, list_chan, 'StopListing')
+    q.expect('dbus-return', method='StopListing')
+    stream.sendMessage('263', stream.nick, 'LIST',
+        ':Server load is temporarily too heavy', prefix='idle.test.server')
+
+    # the next reply isn't mistaken for the rest of the refused one
+    call_async(q, list_chan, 'ListRooms')
+    q.expect('stream-LIST')
+    send_rooms(stream, [('#fresh', 3)])
+    e = q.expect('dbus-signal', signal='GotRooms')
+    assertEquals(['#fresh'], [room[2]['name'] for room in e.args[0]])
+    q.expect('dbus-signal', signal='ListingRooms', args=[False])
+
+    disconnect(q, conn)
+    return True
+
+if __name__ == '__main__':
+    exec_test(test)
+    exec_test(test_list_error)
+
@@ -44,6 +44,8 @@ def test(q, bus, conn, server):
     assertContains(cs.CONN_IFACE_REQUESTS, proto_props['ConnectionInterfaces'])
 
     assertEquals('robot101', unwrap(proto_iface.NormalizeContact('Robot101')))
+    # folded the way a connection does before the server says otherwise
+    assertEquals('{robot}|101', unwrap(proto_iface.NormalizeContact('[Robot]\\101')))
 
     call_async(q, proto_iface, 'IdentifyAccount', {'account': 'Robot101'})
     q.expect('dbus-error', method='IdentifyAccount', name=cs.INVALID_ARGUMENT)
@@ -0,0 +1,71 @@
+"""
+Test that our own handle follows the server's CASEMAPPING, once it says what
+that is; and that other handles made before then keep what the default mapping
+made of them, which is a known limitation
+"""
+
+from idletest import exec_test, sync_stream
+from servicetest import EventPattern, call_async, assertEquals, \
+    assertNotEquals
+import constants as cs
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+
+    # until 005 arrives, the rfc1459 mapping folds [ to {
+    old_handle = conn.Get(cs.CONN, 'SelfHandle',
+        dbus_interface=cs.PROPERTIES_IFACE)
+    assertEquals('{test}', conn.inspect_contact_sync(old_handle))
+
+    stream.sendMessage('005', stream.nick, 'CASEMAPPING=ascii',
+        ':are supported by this server', prefix='idle.test.server')
+
+    e = q.expect('dbus-signal', signal='SelfHandleChanged')
+    new_handle = e.args[0]
+    assertNotEquals(old_handle, new_handle)
+    assertEquals('[test]', conn.inspect_contact_sync(new_handle))
+    assertEquals(new_handle, conn.Get(cs.CONN, 'SelfHandle',
+        dbus_interface=cs.PROPERTIES_IFACE))
+
+    conn.Disconnect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+def open_im(q, conn, nick):
+    call_async(q, conn.Requests, 'EnsureChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_CONTACT,
+         cs.TARGET_ID: nick})
+    e = q.expect('dbus-return', method='EnsureChannel')
+    return e.value[1], e.value[2]
+
+def test_other_handles(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+
+    old_path, old_props = open_im(q, conn, '[Bob]')
+    assertEquals('{bob}', old_props[cs.TARGET_ID])
+
+    stream.sendMessage('005', stream.nick, 'CASEMAPPING=ascii',
+        ':are supported by this server', prefix='idle.test.server')
+    sync_stream(q, stream)
+
+    # the existing handle and channel aren't renamed...
+    assertEquals('{bob}', conn.inspect_contact_sync(old_props[cs.TARGET_HANDLE]))
+
+    # ...so the same nick now resolves to a different handle, and channel
+    new_path, new_props = open_im(q, conn, '[Bob]')
+    assertEquals('[bob]', new_props[cs.TARGET_ID])
+    assertNotEquals(old_props[cs.TARGET_HANDLE], new_props[cs.TARGET_HANDLE])
+    assertNotEquals(old_path, new_path)
+
+    conn.Disconnect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_test(test, {'account': '[Test]'})
+    exec_test(test_other_handles)
@@ -0,0 +1,113 @@
+"""
+Test logging in with SASL PLAIN or EXTERNAL during registration, and that the
+password never goes out as PASS, or the connection registers without it, when
+the server can't take it
+"""
+
+import base64
+from idletest import exec_test, exec_tests
+from servicetest import EventPattern, assertEquals
+import constants as cs
+
+PASSWORD = 'hunter2'
+USERNAME = 'account'
+
+def start(q, stream, caps):
+    stream.caps = caps
+    stream.caps_enabled = []
+    stream.negotiating = False
+    stream.passwd = None
+
+def authenticate(q, stream):
+    q.expect('stream-CAP', data=['REQ', 'sasl'])
+    q.expect('stream-AUTHENTICATE', data=['PLAIN'])
+    stream.sendMessage('AUTHENTICATE', '+')
+
+    # no authzid, and the account isn't our nick
+    e = q.expect('stream-AUTHENTICATE')
+    assertEquals(b'\0' + USERNAME.encode() + b'\0' + PASSWORD.encode(),
+        base64.b64decode(e.data[0]))
+
+def test_success(q, bus, conn, stream):
+    start(q, stream, ['sasl=PLAIN,EXTERNAL'])
+    q.forbid_events([EventPattern('stream-PASS')])
+
+    conn.Connect()
+    authenticate(q, stream)
+    stream.sendMessage('903', '*', ':SASL authentication successful',
+        prefix='idle.test.server')
+
+    # only now does registration go ahead
+    q.expect('stream-CAP', data=['END'])
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+
+    conn.Disconnect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+    q.unforbid_all()
+
+def test_failure(q, bus, conn, stream):
+    start(q, stream, ['sasl'])
+    q.forbid_events([EventPattern('stream-PASS'),
+        EventPattern('stream-CAP', data=['END'])])
+
+    conn.Connect()
+    authenticate(q, stream)
+    stream.sendMessage('904', '*', ':SASL authentication failed',
+        prefix='idle.test.server')
+
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_AUTHENTICATION_FAILED])
+    q.unforbid_all()
+
+def test_no_sasl(q, bus, conn, stream):
+    # the server knows about CAP, but not SASL
+    start(q, stream, ['multi-prefix'])
+    q.forbid_events([EventPattern('stream-PASS'),
+        EventPattern('stream-AUTHENTICATE'),
+        EventPattern('stream-CAP', data=['END'])])
+
+    conn.Connect()
+    q.expect('stream-CAP', data=['REQ', 'multi-prefix'])
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_AUTHENTICATION_FAILED])
+    q.unforbid_all()
+
+def test_no_cap(q, bus, conn, stream):
+    # the server ignores CAP, and registers us as soon as it has NICK and USER
+    start(q, stream, None)
+    q.forbid_events([EventPattern('stream-PASS'),
+        EventPattern('stream-AUTHENTICATE')])
+
+    conn.Connect()
+    q.expect('stream-USER')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_AUTHENTICATION_FAILED])
+    q.unforbid_all()
+
+def test_external(q, bus, conn, stream):
+    start(q, stream, ['sasl=PLAIN,EXTERNAL'])
+
+    conn.Connect()
+    q.expect('stream-CAP', data=['REQ', 'sasl'])
+    q.expect('stream-AUTHENTICATE', data=['EXTERNAL'])
+    stream.sendMessage('AUTHENTICATE', '+')
+
+    # the certificate says who we are, so there's nothing more to send
+    q.expect('stream-AUTHENTICATE', data=['+'])
+    stream.sendMessage('903', '*', ':SASL authentication successful',
+        prefix='idle.test.server')
+
+    q.expect('stream-CAP', data=['END'])
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+
+    conn.Disconnect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_tests([test_success, test_failure, test_no_sasl, test_no_cap],
+        {'password': PASSWORD, 'username': USERNAME, 'sasl-mechanism': 'PLAIN'})
+    exec_test(test_external, {'sasl-mechanism': 'EXTERNAL'})
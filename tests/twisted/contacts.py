@@ -3,9 +3,12 @@ Test the Contacts interface.
 """
 
 from idletest import exec_test
-from servicetest import assertContains, assertEquals
+from servicetest import assertContains, assertEquals, call_async
 import constants as cs
 
+# as in idle-connection.c
+ALIAS_CACHE_MAX_ENTRIES = 4096
+
 def test(q, bus, conn, stream):
     conn.Connect()
     q.expect('dbus-signal', signal='StatusChanged', args=[0, 1])
@@ -47,6 +50,28 @@ def test(q, bus, conn, stream):
         [cs.CONN_IFACE_ALIASING], True)
     assertEquals(bRiL, attrs[brillana][cs.CONN_IFACE_ALIASING + "/alias"])
 
+    # A crowd of people we'll only ever see once pushes her out of the alias
+    # cache, which shows as her alias going back to the lowercase one.
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+         cs.TARGET_ID: '#crowded'})
+    q.expect('dbus-return', method='CreateChannel')
+
+    for i in range(ALIAS_CACHE_MAX_ENTRIES):
+        stream.sendMessage('JOIN', '#crowded', prefix='Passer%dBy' % i)
+
+    q.expect('dbus-signal', signal='AliasesChanged',
+        predicate=lambda e: (brillana, 'brillana') in e.args[0])
+    attrs = conn.Contacts.GetContactAttributes([brillana],
+        [cs.CONN_IFACE_ALIASING], True)
+    assertEquals('brillana', attrs[brillana][cs.CONN_IFACE_ALIASING + "/alias"])
+
+    # The next thing she says brings it back.
+    stream.sendMessage('PRIVMSG', stream.nick, ':brb', prefix=bRiL)
+    q.expect('dbus-signal', signal='AliasesChanged',
+        predicate=lambda e: (brillana, bRiL) in e.args[0])
+
 if __name__ == '__main__':
     exec_test(test)
 
@@ -44,6 +44,12 @@ class BaseIRCServer(irc.IRC):
         self.require_pass = False
         self.rooms = []
         self.secure = False
+        # capabilities to offer in reply to CAP LS, as "name" or "name=value";
+        # None to not know about CAP at all, like older servers
+        self.caps = None
+        self.caps_enabled = []
+        # TRUE from CAP LS until CAP END, during which registration waits
+        self.negotiating = False
 
     def listen(self, port, factory):
         self.log ("BaseIRCServer listening...")
@@ -65,10 +71,40 @@ class BaseIRCServer(irc.IRC):
     def handleUSER(self, args, prefix):
         self.user = args[0]
         self.real_name = args[3]
+        self.maybeWelcome()
+
+    def maybeWelcome(self):
         if ((not self.require_pass) or (self.passwd is not None)) \
-            and (self.nick is not None and self.user is not None):
+            and (self.nick is not None and self.user is not None) \
+            and not self.negotiating:
                 self.sendWelcome()
 
+    def handleCAP(self, args, prefix):
+        if self.caps is None:
+            return
+
+        nick = self.nick or '*'
+
+        if args[0] == 'LS':
+            self.negotiating = True
+            self.sendMessage('CAP', nick, 'LS', ':%s' % ' '.join(self.caps),
+                prefix='idle.test.server')
+        elif args[0] == 'REQ':
+            wanted = args[1].split()
+            offered = [cap.split('=', 1)[0] for cap in self.caps]
+
+            if all(cap in offered for cap in wanted):
+                self.caps_enabled.extend(wanted)
+                self.sendMessage('CAP', nick, 'ACK', ':%s' % args[1],
+                    prefix='idle.test.server')
+            else:
+                self.sendMessage('CAP', nick, 'NAK', ':%s' % args[1],
+                    prefix='idle.test.server')
+        elif args[0] == 'END':
+            if self.negotiating:
+                self.negotiating = False
+                self.maybeWelcome()
+
     def handleWHOIS(self, args, prefix):
         self.busy = not self.busy
 
@@ -0,0 +1,65 @@
+"""
+Test that a WHOIS reply is reused for later RequestContactInfo calls, until
+the contact changes nick
+"""
+
+from idletest import exec_test, BaseIRCServer, sync_stream
+from servicetest import EventPattern, assertEquals, call_async
+import constants as cs
+import dbus
+
+class QuietWhoisServer(BaseIRCServer):
+    # the test answers WHOIS itself
+    def handleWHOIS(self, args, prefix):
+        pass
+
+def send_whois_reply(stream, nick, realname):
+    stream.sendMessage('311', stream.nick, nick, nick, 'idle.test.client', '*',
+        ':%s' % realname, prefix='idle.test.server')
+    stream.sendMessage('318', stream.nick, nick, ':End of /WHOIS list.',
+        prefix='idle.test.server')
+
+def get_field(vcard, field):
+    for (name, parameters, value) in vcard:
+        if name == field:
+            return value[0]
+    return None
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+    contact_info = dbus.Interface(conn, cs.CONN_IFACE_CONTACT_INFO)
+    alice = conn.get_contact_handles_sync(['alice'])[0]
+    whois = EventPattern('stream-WHOIS', data=['alice', 'alice'])
+
+    call_async(q, contact_info, 'RequestContactInfo', alice)
+    q.expect_many(whois)
+    send_whois_reply(stream, 'alice', 'Alice Liddell')
+    e = q.expect('dbus-return', method='RequestContactInfo')
+    assertEquals('Alice Liddell', get_field(e.value[0], 'fn'))
+
+    # asking again is answered from the cache, without a second WHOIS
+    q.forbid_events([whois])
+    call_async(q, contact_info, 'RequestContactInfo', alice)
+    e = q.expect('dbus-return', method='RequestContactInfo')
+    assertEquals('Alice Liddell', get_field(e.value[0], 'fn'))
+    sync_stream(q, stream)
+    q.unforbid_events([whois])
+
+    # once she's renamed, whoever is called alice next is someone else
+    stream.sendMessage('NICK', 'alicia', prefix='alice')
+    sync_stream(q, stream)
+
+    call_async(q, contact_info, 'RequestContactInfo', alice)
+    q.expect_many(whois)
+    send_whois_reply(stream, 'alice', 'Alice Cooper')
+    e = q.expect('dbus-return', method='RequestContactInfo')
+    assertEquals('Alice Cooper', get_field(e.value[0], 'fn'))
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_test(test, protocol=QuietWhoisServer)
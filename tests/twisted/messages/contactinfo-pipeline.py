@@ -0,0 +1,74 @@
+"""
+Test that WHOIS requests for contact info are pipelined up to
+whois-pipeline-depth, and that replies are matched to requests by nick rather
+than by order
+"""
+
+from idletest import exec_test, BaseIRCServer, sync_stream
+from servicetest import EventPattern, assertEquals, call_async
+import constants as cs
+import dbus
+
+class QuietWhoisServer(BaseIRCServer):
+    # the test answers WHOIS itself
+    def handleWHOIS(self, args, prefix):
+        pass
+
+def send_whois_reply(stream, nick, realname):
+    stream.sendMessage('311', stream.nick, nick, nick, 'idle.test.client', '*',
+        ':%s' % realname, prefix='idle.test.server')
+    stream.sendMessage('318', stream.nick, nick, ':End of /WHOIS list.',
+        prefix='idle.test.server')
+
+def get_field(vcard, field):
+    for (name, parameters, value) in vcard:
+        if name == field:
+            return value[0]
+    return None
+
+def expect_info(q, handle, realname):
+    changed, ret = q.expect_many(
+        EventPattern('dbus-signal', signal='ContactInfoChanged'),
+        EventPattern('dbus-return', method='RequestContactInfo'))
+    assertEquals(handle, changed.args[0])
+    assertEquals(realname, get_field(changed.args[1], 'fn'))
+    assertEquals(realname, get_field(ret.value[0], 'fn'))
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+    contact_info = dbus.Interface(conn, cs.CONN_IFACE_CONTACT_INFO)
+    alice, bob, carol = conn.get_contact_handles_sync(['alice', 'bob', 'carol'])
+
+    # with a depth of 2, the third request waits for a reply
+    carol_whois = EventPattern('stream-WHOIS', data=['carol', 'carol'])
+    q.forbid_events([carol_whois])
+
+    for handle in [alice, bob, carol]:
+        call_async(q, contact_info, 'RequestContactInfo', handle)
+
+    q.expect('stream-WHOIS', data=['alice', 'alice'])
+    q.expect('stream-WHOIS', data=['bob', 'bob'])
+    sync_stream(q, stream)
+
+    # bob's reply overtakes alice's, and still completes the right request
+    send_whois_reply(stream, 'bob', 'Bob Dobbs')
+    expect_info(q, bob, 'Bob Dobbs')
+
+    q.unforbid_events([carol_whois])
+    q.expect('stream-WHOIS', data=['carol', 'carol'])
+
+    send_whois_reply(stream, 'alice', 'Alice Liddell')
+    expect_info(q, alice, 'Alice Liddell')
+
+    send_whois_reply(stream, 'carol', 'Carol Danvers')
+    expect_info(q, carol, 'Carol Danvers')
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_test(test, {'whois-pipeline-depth': dbus.UInt32(2)},
+        protocol=QuietWhoisServer)
@@ -0,0 +1,97 @@
+"""
+Test that what a WHO reply on joining a channel tells us about its members, or
+an extended JOIN about a newcomer, is returned by GetContactInfo without being
+announced to clients who never asked for it
+"""
+
+from idletest import exec_test, BaseIRCServer, sync_stream
+from servicetest import EventPattern, assertEquals, call_async
+import constants as cs
+import dbus
+
+CHANNEL_NAME = '#idletest'
+
+class QuietWhoisServer(BaseIRCServer):
+    # the test answers WHOIS itself, if at all
+    def handleWHOIS(self, args, prefix):
+        pass
+
+def get_field(vcard, field):
+    for (name, parameters, value) in vcard:
+        if name == field:
+            return value[0]
+    return None
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+    contact_info = dbus.Interface(conn, cs.CONN_IFACE_CONTACT_INFO)
+    dave = conn.get_contact_handles_sync(['dave'])[0]
+
+    # one WHO per channel member would be one signal per member
+    forbidden = [EventPattern('dbus-signal', signal='ContactInfoChanged')]
+    q.forbid_events(forbidden)
+
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+         cs.TARGET_ID: CHANNEL_NAME})
+    q.expect('stream-WHO', data=[CHANNEL_NAME])
+
+    stream.sendMessage('352', stream.nick, CHANNEL_NAME, 'dave', 'red.dwarf',
+        'idle.test.server', 'dave', 'G', ':0 Dave Lister',
+        prefix='idle.test.server')
+    sync_stream(q, stream)
+
+    infos = contact_info.GetContactInfo([dave])
+    assertEquals('Dave Lister', get_field(infos[dave], 'fn'))
+    assertEquals('dave@red.dwarf', get_field(infos[dave], 'x-host'))
+    assertEquals('away', get_field(infos[dave], 'x-presence-status-identifier'))
+
+    # but it's not the whole story, so asking for it still goes to the server
+    call_async(q, contact_info, 'RequestContactInfo', dave)
+    q.expect('stream-WHOIS', data=['dave', 'dave'])
+
+    # with extended-join, someone joining later tells us who they are too
+    eve = conn.get_contact_handles_sync(['eve'])[0]
+    stream.sendMessage('JOIN', CHANNEL_NAME, 'eve', ':Eve Online',
+        prefix='eve!eve@idle.test.client')
+    sync_stream(q, stream)
+
+    infos = contact_info.GetContactInfo([eve])
+    assertEquals('Eve Online', get_field(infos[eve], 'fn'))
+    assertEquals('eve', get_field(infos[eve], 'nickname'))
+    assertEquals('true', get_field(infos[eve], 'x-irc-registered-nick'))
+
+    q.unforbid_events(forbidden)
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+def test_off(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+
+    # unless asked for, joining doesn't cost a WHO
+    forbidden = [EventPattern('stream-WHO')]
+    q.forbid_events(forbidden)
+
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+         cs.TARGET_ID: CHANNEL_NAME})
+    q.expect('dbus-return', method='CreateChannel')
+    sync_stream(q, stream)
+
+    q.unforbid_events(forbidden)
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_test(test, {'who-on-join': True}, protocol=QuietWhoisServer)
+    exec_test(test_off, protocol=QuietWhoisServer)
@@ -0,0 +1,86 @@
+"""
+Test that with echo-message, a message is only reported as sent once the
+server has echoed it back, even if the echo isn't quite what we sent, and that
+echoes of things we didn't send through the channel are shown as received
+"""
+
+from idletest import exec_test, BaseIRCServer, sync_stream
+from servicetest import EventPattern, call_async, assertEquals
+import constants as cs
+import dbus
+
+class EchoServer(BaseIRCServer):
+    def __init__(self, event_func):
+        BaseIRCServer.__init__(self, event_func)
+        self.caps = ['echo-message']
+
+CHANNEL_NAME = '#idletest'
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect_many(
+            EventPattern('stream-CAP', data=['REQ', 'echo-message']),
+            EventPattern('dbus-signal', signal='StatusChanged',
+                args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED]))
+    self_handle = conn.Get(cs.CONN, 'SelfHandle',
+        dbus_interface=cs.PROPERTIES_IFACE)
+
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+         cs.TARGET_ID: CHANNEL_NAME})
+
+    ret = q.expect('dbus-return', method='CreateChannel')
+    q.expect('dbus-signal', signal='MembersChanged')
+    chan = bus.get_object(conn.bus_name, ret.value[0])
+    text_chan = dbus.Interface(chan, cs.CHANNEL_TYPE_TEXT)
+
+    sent = [EventPattern('dbus-signal', signal='Sent'),
+            EventPattern('dbus-signal', signal='MessageSent')]
+    received = [EventPattern('dbus-signal', signal='Received'),
+            EventPattern('dbus-signal', signal='MessageReceived')]
+
+    # written out, but not yet echoed: not sent yet
+    q.forbid_events(sent)
+    call_async(q, text_chan, 'Send', cs.MT_NORMAL, 'hello   ')
+    e = q.expect('stream-PRIVMSG')
+    assertEquals([CHANNEL_NAME, 'hello   '], e.data)
+    sync_stream(q, stream)
+    q.unforbid_events(sent)
+
+    # the server trims the trailing spaces, which doesn't stop the echo from
+    # confirming the message; nor is the echo shown as a received message
+    q.forbid_events(received)
+    stream.sendMessage('PRIVMSG', CHANNEL_NAME, ':hello', prefix=stream.nick)
+    q.expect_many(*sent)
+    sync_stream(q, stream)
+    q.unforbid_events(received)
+
+    # something said from another client on the same bouncer confirms nothing,
+    # so is shown like any other message
+    stream.sendMessage('PRIVMSG', CHANNEL_NAME, ':from my phone',
+        prefix=stream.nick)
+    e = q.expect('dbus-signal', signal='Received')
+    assertEquals(self_handle, e.args[2])
+    assertEquals('from my phone', e.args[5])
+
+    # and the same goes for a private message to someone else
+    stream.sendMessage('PRIVMSG', 'alice', ':psst', prefix=stream.nick)
+    e = q.expect('dbus-signal', signal='NewChannels')
+    channel_props = e.args[0][0][1]
+    assertEquals('alice', channel_props[cs.TARGET_ID])
+    e = q.expect('dbus-signal', signal='Received')
+    assertEquals(self_handle, e.args[2])
+    assertEquals('psst', e.args[5])
+
+    # a message the server refuses fails, once it has gone out
+    call_async(q, text_chan, 'Send', cs.MT_NORMAL, 'anyone?')
+    q.expect('stream-PRIVMSG', data=[CHANNEL_NAME, 'anyone?'])
+    stream.sendMessage('404', stream.nick, CHANNEL_NAME,
+        ':Cannot send to channel', prefix='idle.test.server')
+    q.expect('dbus-error', method='Send')
+
+    call_async(q, conn, 'Disconnect')
+
+if __name__ == '__main__':
+    exec_test(test, protocol=EchoServer)
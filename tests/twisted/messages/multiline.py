@@ -0,0 +1,103 @@
+"""
+Test that a multi-line message is sent as draft/multiline batches when the
+server supports them
+"""
+
+from idletest import exec_test, BaseIRCServer, sync_stream
+from servicetest import Event, EventPattern, call_async, assertEquals
+from constants import *
+import dbus
+
+class MultilineServer(BaseIRCServer):
+    def __init__(self, event_func):
+        BaseIRCServer.__init__(self, event_func)
+        self.tag_buffer = ''
+        self.tags = ''
+
+    def dataReceived(self, data):
+        # Twisted knows nothing of message tags, so take them off each line
+        # before it sees it
+        if isinstance(data, bytes):
+            data = data.decode('utf-8')
+
+        lines = (self.tag_buffer + data).split('\n')
+        self.tag_buffer = lines.pop()
+
+        for line in lines:
+            self.tags = ''
+            if line.startswith('@'):
+                self.tags, line = line[1:].split(' ', 1)
+            BaseIRCServer.dataReceived(self, line + '\n')
+
+    def handleCAP(self, args, prefix):
+        if args[0] == 'LS':
+            self.sendMessage('CAP', '*', 'LS',
+                ':batch draft/multiline=max-bytes=4096,max-lines=4',
+                prefix='idle.test.server')
+        elif args[0] == 'REQ':
+            self.sendMessage('CAP', '*', 'ACK', ':%s' % args[1],
+                prefix='idle.test.server')
+
+    def handlePRIVMSG(self, args, prefix):
+        self.event_func(Event('tagged-PRIVMSG', tags=self.tags, args=args))
+
+LONG_LINE = ' '.join(['word'] * 150)
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect_many(
+            EventPattern('stream-CAP', data=['REQ', 'batch draft/multiline']),
+            EventPattern('dbus-signal', signal='StatusChanged', args=[0, 1]))
+    sync_stream(q, stream)
+
+    CHANNEL_NAME = '#idletest'
+    call_async(q, conn.Requests, 'CreateChannel',
+            { CHANNEL_TYPE: CHANNEL_TYPE_TEXT,
+              TARGET_HANDLE_TYPE: HT_ROOM,
+              TARGET_ID: CHANNEL_NAME })
+
+    ret = q.expect('dbus-return', method='CreateChannel')
+    q.expect('dbus-signal', signal='MembersChanged')
+    chan = bus.get_object(conn.bus_name, ret.value[0])
+    text_chan = dbus.Interface(chan, CHANNEL_TYPE_TEXT)
+
+    # the long line has to be broken in two, which makes six parts: four in
+    # the first batch, and two in the second
+    call_async(q, text_chan, 'Send', 0,
+        '\n'.join(['one', 'two', LONG_LINE, 'four', 'five']))
+
+    for ref, parts in [('idle1', 4), ('idle2', 2)]:
+        q.expect('stream-BATCH', data=['+' + ref, 'draft/multiline', CHANNEL_NAME])
+
+        text = ''
+        for i in range(parts):
+            e = q.expect('tagged-PRIVMSG')
+            assertEquals(CHANNEL_NAME, e.args[0])
+
+            if ref == 'idle1' and i == 3:
+                assertEquals('batch=%s;draft/multiline-concat' % ref, e.tags)
+                text += e.args[1]
+            else:
+                assertEquals('batch=%s' % ref, e.tags)
+                text += '\n' + e.args[1]
+
+        q.expect('stream-BATCH', data=['-' + ref])
+
+        if ref == 'idle1':
+            assertEquals('\none\ntwo\n' + LONG_LINE, text)
+        else:
+            assertEquals('\nfour\nfive', text)
+
+    q.expect('dbus-signal', signal='Sent')
+
+    # a single line goes out as it always has
+    call_async(q, text_chan, 'Send', 0, 'just the one')
+    e = q.expect('tagged-PRIVMSG')
+    assertEquals('', e.tags)
+    assertEquals([CHANNEL_NAME, 'just the one'], e.args)
+
+    call_async(q, conn, 'Disconnect')
+    return True
+
+if __name__ == '__main__':
+    exec_test(test, protocol=MultilineServer)
@@ -114,11 +114,9 @@ def test_simple_bools(q, bus, conn, stream):
                 'Moderated': True,
                 'Private': True})
 
-    # ... and a monster return
+    # ... all in one MODE, and a monster return
     q.expect_many(EventPattern('dbus-return', method='UpdateConfiguration'),
-                  EventPattern('stream-MODE', data=['#test', '+i']),
-                  EventPattern('stream-MODE', data=['#test', '+m']),
-                  EventPattern('stream-MODE', data=['#test', '+s']),
+                  EventPattern('stream-MODE', data=['#test', '+ims']),
                   EventPattern('dbus-signal', signal='PropertiesChanged',
                                args=[cs.CHANNEL_IFACE_ROOM_CONFIG,
                                      {'InviteOnly': True,
@@ -326,6 +324,29 @@ def test_modechanges(q, bus, conn, stream):
                     'Password': 'holly'},
                    []])
 
+def test_mode_batching(q, bus, conn, stream):
+    chan = setup(q, bus, conn, stream)
+
+    # by default, a limit and a key fit in one MODE
+    call_async(q, chan.RoomConfig1, 'UpdateConfiguration',
+               {'Limit': dbus.UInt32(5),
+                'Password': 'holly'})
+    q.expect_many(EventPattern('dbus-return', method='UpdateConfiguration'),
+                  EventPattern('stream-MODE',
+                               data=['#test', '+lk', '5', 'holly']))
+
+    # but not if the server only takes one parameter per MODE
+    stream.sendMessage('005', stream.nick, 'MODES=1',
+                       ':are supported by this server',
+                       prefix='idle.test.server')
+    sync_stream(q, stream)
+    call_async(q, chan.RoomConfig1, 'UpdateConfiguration',
+               {'InviteOnly': True,
+                'Limit': dbus.UInt32(6),
+                'Password': 'kryten'})
+    q.expect('stream-MODE', data=['#test', '+il', '6'])
+    q.expect('stream-MODE', data=['#test', '+k', 'kryten'])
+
 def test_mode_no_op(q, bus, conn, stream):
     chan = setup(q, bus, conn, stream, op_user=False)
 
@@ -356,10 +377,35 @@ def test_mode_no_op(q, bus, conn, stream):
                    {'CanUpdateConfiguration': False},
                    []])
 
+def test_mode_list_param(q, bus, conn, stream):
+    chan = setup(q, bus, conn, stream, op_user=False)
+
+    # the ban mask belongs to 'b', so it mustn't be taken for the nick being
+    # opped
+    stream.sendMessage('MODE', '#test', '+bo', '*!*@spam.example', 'test',
+                       prefix='chanserv')
+    q.expect_many(EventPattern('dbus-signal', signal='GroupFlagsChanged',
+                               args=[cs.GF_MESSAGE_REMOVE | cs.GF_CAN_REMOVE, 0]),
+                  EventPattern('dbus-signal', signal='PropertiesChanged',
+                               args=[cs.CHANNEL_IFACE_ROOM_CONFIG,
+                                     {'CanUpdateConfiguration': True},
+                                     []]))
+
+    # list modes take a parameter when unset, too; and so does 'k'
+    change_channel_mode(stream, '-b+kl *!*@spam.example holly 42')
+    q.expect('dbus-signal', signal='PropertiesChanged',
+             args=[cs.CHANNEL_IFACE_ROOM_CONFIG,
+                   {'PasswordProtected': True,
+                    'Password': 'holly',
+                    'Limit': 42},
+                   []])
+
 if __name__ == '__main__':
     exec_test(test_props_present)
     exec_test(test_simple_bools)
     exec_test(test_limit)
     exec_test(test_password)
     exec_test(test_modechanges)
+    exec_test(test_mode_batching)
     exec_test(test_mode_no_op)
+    exec_test(test_mode_list_param)
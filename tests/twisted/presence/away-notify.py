@@ -0,0 +1,69 @@
+"""
+Test that with away-notify, a watched contact going away or coming back is
+reported without waiting for a poll, and that their joining a channel we're
+in tells us they're online
+"""
+
+from idletest import exec_test, BaseIRCServer, sync_stream
+from servicetest import EventPattern, call_async
+import constants as cs
+
+CHANNEL_NAME = '#idletest'
+
+class AwayNotifyServer(BaseIRCServer):
+    def __init__(self, event_func):
+        BaseIRCServer.__init__(self, event_func)
+        self.caps = ['away-notify']
+
+def expect_presence(q, handle, presence, status, message=''):
+    q.expect('dbus-signal', signal='PresencesChanged',
+        args=[{handle: (presence, status, message)}])
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect_many(
+        EventPattern('stream-CAP', data=['REQ', 'away-notify']),
+        EventPattern('dbus-signal', signal='StatusChanged',
+            args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED]))
+    alice = conn.get_contact_handles_sync(['alice'])[0]
+
+    # alice is watched; bob isn't
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_CONTACT,
+         cs.TARGET_ID: 'alice'})
+    q.expect('dbus-return', method='CreateChannel')
+
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+         cs.TARGET_ID: CHANNEL_NAME})
+    q.expect('dbus-return', method='CreateChannel')
+
+    stream.sendMessage('JOIN', CHANNEL_NAME, prefix='alice!alice@idle.test.client')
+    expect_presence(q, alice, cs.PRESENCE_AVAILABLE, 'available')
+
+    stream.sendMessage('AWAY', ':gone fishing', prefix='alice!alice@idle.test.client')
+    expect_presence(q, alice, cs.PRESENCE_AWAY, 'away', 'gone fishing')
+
+    # joining somewhere else doesn't mean she's back
+    forbidden = [EventPattern('dbus-signal', signal='PresencesChanged')]
+    q.forbid_events(forbidden)
+    stream.sendMessage('JOIN', CHANNEL_NAME, prefix='alice!alice@idle.test.client')
+    stream.sendMessage('AWAY', ':out', prefix='bob!bob@idle.test.client')
+    sync_stream(q, stream)
+    q.unforbid_events(forbidden)
+
+    # an AWAY with no message means she is
+    stream.sendMessage('AWAY', prefix='alice!alice@idle.test.client')
+    expect_presence(q, alice, cs.PRESENCE_AVAILABLE, 'available')
+
+    stream.sendMessage('QUIT', ':bye', prefix='alice!alice@idle.test.client')
+    expect_presence(q, alice, cs.PRESENCE_OFFLINE, 'offline')
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_test(test, protocol=AwayNotifyServer)
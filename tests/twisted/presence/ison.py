@@ -0,0 +1,55 @@
+"""
+Test that without MONITOR, contacts we have an IM channel with are polled with
+ISON, as many to a line as fit, and that whoever a 303 reply leaves out is
+offline
+"""
+
+from idletest import exec_test
+from servicetest import call_async, assertEquals
+import constants as cs
+
+# long enough that they don't all fit in one 512-byte ISON
+NICKS = ['contact%02d%s' % (i, 'x' * 31) for i in range(16)]
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+    handles = conn.get_contact_handles_sync(NICKS)
+
+    # open them all before the first poll, so it asks about all of them
+    for nick in NICKS:
+        call_async(q, conn.Requests, 'CreateChannel',
+            {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+             cs.TARGET_HANDLE_TYPE: cs.HT_CONTACT,
+             cs.TARGET_ID: nick})
+
+    lines = [q.expect('stream-ISON').data, q.expect('stream-ISON').data]
+    assert len(lines[0]) > 1, lines
+    assert len(lines[1]) > 1, lines
+    assertEquals(sorted(NICKS), sorted(lines[0] + lines[1]))
+
+    # the first nick of each line is online; everyone else isn't
+    online = [lines[0][0], lines[1][0]]
+    for line in lines:
+        stream.sendMessage('303', stream.nick, ':%s' % line[0],
+            prefix='idle.test.server')
+
+    statuses = {}
+    while len(statuses) < len(handles):
+        e = q.expect('dbus-signal', signal='PresencesChanged')
+        for handle, presence in e.args[0].items():
+            statuses[handle] = presence[0]
+
+    for nick, handle in zip(NICKS, handles):
+        if nick in online:
+            assertEquals(cs.PRESENCE_AVAILABLE, statuses[handle])
+        else:
+            assertEquals(cs.PRESENCE_OFFLINE, statuses[handle])
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_test(test)
@@ -0,0 +1,62 @@
+"""
+Test that contacts we have an IM channel with are watched with MONITOR when
+the server supports it, and that its replies update their presence
+"""
+
+from idletest import exec_test
+from servicetest import EventPattern, call_async
+import constants as cs
+
+def open_im(q, bus, conn, nick):
+    call_async(q, conn.Requests, 'CreateChannel',
+        {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_TEXT,
+         cs.TARGET_HANDLE_TYPE: cs.HT_CONTACT,
+         cs.TARGET_ID: nick})
+    ret = q.expect('dbus-return', method='CreateChannel')
+    return bus.get_object(conn.bus_name, ret.value[0])
+
+def expect_presence(q, handle, presence, status):
+    q.expect('dbus-signal', signal='PresencesChanged',
+        args=[{handle: (presence, status, '')}])
+
+def test(q, bus, conn, stream):
+    conn.Connect()
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_CONNECTED, cs.CSR_REQUESTED])
+    alice, bob = conn.get_contact_handles_sync(['alice', 'bob'])
+
+    # RPL_ISUPPORT arrives before the first poll decides how to watch people
+    q.forbid_events([EventPattern('stream-ISON')])
+    stream.sendMessage('005', stream.nick, 'MONITOR=100',
+        ':are supported by this server', prefix='idle.test.server')
+
+    # a channel opened before then is watched once we know how
+    alice_chan = open_im(q, bus, conn, 'alice')
+    q.expect('stream-MONITOR', data=['+', 'alice'])
+
+    # one opened afterwards is watched straight away
+    open_im(q, bus, conn, 'bob')
+    q.expect('stream-MONITOR', data=['+', 'bob'])
+
+    stream.sendMessage('730', stream.nick, ':alice!alice@idle.test.client',
+        prefix='idle.test.server')
+    expect_presence(q, alice, cs.PRESENCE_AVAILABLE, 'available')
+
+    stream.sendMessage('731', stream.nick, ':alice,bob',
+        prefix='idle.test.server')
+    q.expect_many(
+        EventPattern('dbus-signal', signal='PresencesChanged',
+            args=[{alice: (cs.PRESENCE_OFFLINE, 'offline', '')}]),
+        EventPattern('dbus-signal', signal='PresencesChanged',
+            args=[{bob: (cs.PRESENCE_OFFLINE, 'offline', '')}]))
+
+    # closing the channel stops watching them
+    call_async(q, alice_chan, 'Close', dbus_interface=cs.CHANNEL)
+    q.expect('stream-MONITOR', data=['-', 'alice'])
+
+    call_async(q, conn, 'Disconnect')
+    q.expect('dbus-signal', signal='StatusChanged',
+        args=[cs.CONN_STATUS_DISCONNECTED, cs.CSR_REQUESTED])
+
+if __name__ == '__main__':
+    exec_test(test)
@@ -42,8 +42,9 @@ def file_set_contents(filename, contents):
     os.rename(filename + '.tmp', filename)
 
 def cmp_by_name(node1, node2):
-    return cmp(node1.getAttributeNode("name").nodeValue,
-               node2.getAttributeNode("name").nodeValue)
+    name1 = node1.getAttributeNode("name").nodeValue
+    name2 = node2.getAttributeNode("name").nodeValue
+    return (name1 > name2) - (name1 < name2)
 
 
 def escape_as_identifier(identifier):